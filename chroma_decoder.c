@@ -0,0 +1,373 @@
+/* Before errors.h, whose log() macro would otherwise clash */
+#include <math.h>
+
+#include "chroma_decoder.h"
+#include "errors.h"
+#if defined(__AVX2__) && defined(__FMA__)
+#include <immintrin.h>
+#endif
+
+/* Chroma bandwidth kept after demodulation, and how far either side of a sample the lowpass reaches */
+static const double chroma_decoder_bandwidth_hz = 1.3e6;
+static const double chroma_decoder_filter_reach_ns = 800;
+/* Scale from U and V, as fractions of the luma range, to Cb and Cr */
+static const double chroma_decoder_cb_per_u = 255 * 0.564 / 0.493;
+static const double chroma_decoder_cr_per_v = 255 * 0.713 / 0.877;
+/* Burst amplitude as a fraction of the luma range, which scales the chroma of each line */
+static const double chroma_decoder_burst_level = 3.0 / 14;
+
+static double chroma_decoder_turns(uint64_t phase)
+{
+	return ldexp((double) phase, -64);
+}
+
+/* Subcarrier phasor e^-jw(at) at absolute sample offset (at) */
+static void chroma_decoder_base(const struct chroma_decoder *self, offset_t at, float *re, float *im)
+{
+	double angle = 2 * M_PI * chroma_decoder_turns((uint64_t) at * self->phase_step);
+	*re = cos(angle);
+	*im = -sin(angle);
+}
+
+/* Burst phasor of the window starting at data[0], which is at absolute offset (origin) */
+static void chroma_decoder_burst(const struct chroma_decoder *self, const sample_t *data, offset_t origin, float *re, float *im)
+{
+	float base_re;
+	float base_im;
+	chroma_decoder_base(self, origin, &base_re, &base_im);
+	float mean = 0;
+	float sum_re = 0;
+	float sum_im = 0;
+	float carrier_sum_re = 0;
+	float carrier_sum_im = 0;
+	for (size_t index = 0; index < self->burst_length; index++) {
+		float carrier_re = base_re * self->carrier_re[index] - base_im * self->carrier_im[index];
+		float carrier_im = base_re * self->carrier_im[index] + base_im * self->carrier_re[index];
+		mean += data[index];
+		sum_re += data[index] * carrier_re;
+		sum_im += data[index] * carrier_im;
+		carrier_sum_re += carrier_re;
+		carrier_sum_im += carrier_im;
+	}
+	/* Take out the blanking level, as the window need not hold whole cycles */
+	mean /= self->burst_length;
+	*re = sum_re - mean * carrier_sum_re;
+	*im = sum_im - mean * carrier_sum_im;
+}
+
+/*
+ * Demodulate (count) samples from data[0] at absolute offset (origin) with the
+ * subcarrier, and weigh the result into U and V by (weights): U from its real
+ * and imaginary parts, then V.  The first line demodulated sets U and V, and
+ * keeps its levels and subcarrier; the next adds to them.
+ */
+static void chroma_decoder_mix(struct chroma_decoder *self, const sample_t *data, offset_t origin, size_t count, const float *weights, bool first_line)
+{
+	float base_re;
+	float base_im;
+	chroma_decoder_base(self, origin, &base_re, &base_im);
+	float *u = self->mixed[0];
+	float *v = self->mixed[1];
+	size_t index = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+	if (sizeof(sample_t) == sizeof(int64_t)) {
+		/* Low halves of eight 64-bit samples, which hold the whole values as they fit in 32 bits */
+		const __m256i low_words = _mm256_setr_epi32(0, 2, 4, 6, 1, 3, 5, 7);
+		const __m256 vector_base_re = _mm256_set1_ps(base_re);
+		const __m256 vector_base_im = _mm256_set1_ps(base_im);
+		const __m256 u_re = _mm256_set1_ps(weights[0]);
+		const __m256 u_im = _mm256_set1_ps(weights[1]);
+		const __m256 v_re = _mm256_set1_ps(weights[2]);
+		const __m256 v_im = _mm256_set1_ps(weights[3]);
+		for (; index + 8 <= count; index += 8) {
+			__m256i first = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *) &data[index]), low_words);
+			__m256i second = _mm256_permutevar8x32_epi32(_mm256_loadu_si256((const __m256i *) &data[index + 4]), low_words);
+			__m256 level = _mm256_cvtepi32_ps(_mm256_permute2x128_si256(first, second, 0x20));
+			__m256 table_re = _mm256_loadu_ps(&self->carrier_re[index]);
+			__m256 table_im = _mm256_loadu_ps(&self->carrier_im[index]);
+			__m256 carrier_re = _mm256_fmsub_ps(vector_base_re, table_re, _mm256_mul_ps(vector_base_im, table_im));
+			__m256 carrier_im = _mm256_fmadd_ps(vector_base_re, table_im, _mm256_mul_ps(vector_base_im, table_re));
+			__m256 mixed_re = _mm256_mul_ps(level, carrier_re);
+			__m256 mixed_im = _mm256_mul_ps(level, carrier_im);
+			__m256 line_u = _mm256_fmadd_ps(u_re, mixed_re, _mm256_mul_ps(u_im, mixed_im));
+			__m256 line_v = _mm256_fmadd_ps(v_re, mixed_re, _mm256_mul_ps(v_im, mixed_im));
+			if (first_line) {
+				_mm256_storeu_ps(&u[index], line_u);
+				_mm256_storeu_ps(&v[index], line_v);
+				_mm256_storeu_ps(&self->level[index], level);
+				_mm256_storeu_ps(&self->oscillator_re[index], carrier_re);
+				_mm256_storeu_ps(&self->oscillator_im[index], carrier_im);
+			} else {
+				_mm256_storeu_ps(&u[index], _mm256_add_ps(_mm256_loadu_ps(&u[index]), line_u));
+				_mm256_storeu_ps(&v[index], _mm256_add_ps(_mm256_loadu_ps(&v[index]), line_v));
+			}
+		}
+	}
+#endif
+	for (; index < count; index++) {
+		float level = data[index];
+		float carrier_re = base_re * self->carrier_re[index] - base_im * self->carrier_im[index];
+		float carrier_im = base_re * self->carrier_im[index] + base_im * self->carrier_re[index];
+		float mixed_re = level * carrier_re;
+		float mixed_im = level * carrier_im;
+		float line_u = weights[0] * mixed_re + weights[1] * mixed_im;
+		float line_v = weights[2] * mixed_re + weights[3] * mixed_im;
+		if (first_line) {
+			u[index] = line_u;
+			v[index] = line_v;
+			self->level[index] = level;
+			self->oscillator_re[index] = carrier_re;
+			self->oscillator_im[index] = carrier_im;
+		} else {
+			u[index] += line_u;
+			v[index] += line_v;
+		}
+	}
+}
+
+#if defined(__AVX2__) && defined(__FMA__)
+/* Luma, Cb and Cr of the eight outputs from (index), given U and V filtered */
+static inline void chroma_decoder_output_avx2(const struct chroma_decoder *self, size_t index, __m256 u, __m256 v, const __m256 *remodulate, sample_t *luma, sample_t *cb, sample_t *cr)
+{
+	const size_t centre = self->half_taps;
+	__m256 oscillator_re = _mm256_loadu_ps(&self->oscillator_re[index + centre]);
+	__m256 oscillator_im = _mm256_loadu_ps(&self->oscillator_im[index + centre]);
+	__m256 from_u = _mm256_fmadd_ps(remodulate[0], oscillator_re, _mm256_mul_ps(remodulate[1], oscillator_im));
+	__m256 from_v = _mm256_fmadd_ps(remodulate[2], oscillator_re, _mm256_mul_ps(remodulate[3], oscillator_im));
+	__m256 chroma = _mm256_fmadd_ps(u, from_u, _mm256_mul_ps(v, from_v));
+	__m256 y = _mm256_sub_ps(_mm256_loadu_ps(&self->level[index + centre]), chroma);
+	const __m256 outputs[3] = { y, u, v };
+	sample_t *const destinations[3] = { luma, cb, cr };
+	for (int output = 0; output < 3; output++) {
+		__m256i rounded = _mm256_cvtps_epi32(outputs[output]);
+		_mm256_storeu_si256((__m256i *) &destinations[output][index], _mm256_cvtepi32_epi64(_mm256_castsi256_si128(rounded)));
+		_mm256_storeu_si256((__m256i *) &destinations[output][index + 4], _mm256_cvtepi32_epi64(_mm256_extracti128_si256(rounded, 1)));
+	}
+}
+#endif
+
+/*
+ * Lowpass U and V into Cb and Cr, and take the chroma that they make with the
+ * subcarrier of this line, remodulated by (remodulate) (from U, its weights of
+ * the real and imaginary subcarrier, then from V), back off its levels for luma.
+ */
+static void chroma_decoder_filter(struct chroma_decoder *self, size_t count, const float *remodulate, sample_t *luma, sample_t *cb, sample_t *cr)
+{
+	const size_t taps = 2 * self->half_taps + 1;
+	const size_t centre = self->half_taps;
+	const float *const tap_weights = self->taps;
+	const float *const u = self->mixed[0];
+	const float *const v = self->mixed[1];
+	size_t index = 0;
+#if defined(__AVX2__) && defined(__FMA__)
+	if (sizeof(sample_t) == sizeof(int64_t)) {
+		const __m256 vector_remodulate[4] = {
+			_mm256_set1_ps(remodulate[0]),
+			_mm256_set1_ps(remodulate[1]),
+			_mm256_set1_ps(remodulate[2]),
+			_mm256_set1_ps(remodulate[3]),
+		};
+		/* Four vectors at a time, so that the sums' latency overlaps */
+		for (; index + 32 <= count; index += 32) {
+			__m256 u0 = _mm256_setzero_ps();
+			__m256 u1 = _mm256_setzero_ps();
+			__m256 u2 = _mm256_setzero_ps();
+			__m256 u3 = _mm256_setzero_ps();
+			__m256 v0 = _mm256_setzero_ps();
+			__m256 v1 = _mm256_setzero_ps();
+			__m256 v2 = _mm256_setzero_ps();
+			__m256 v3 = _mm256_setzero_ps();
+			for (size_t tap = 0; tap < taps; tap++) {
+				const __m256 weight = _mm256_set1_ps(tap_weights[tap]);
+				const float *const u_at = &u[index + tap];
+				const float *const v_at = &v[index + tap];
+				u0 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(&u_at[0]), u0);
+				u1 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(&u_at[8]), u1);
+				u2 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(&u_at[16]), u2);
+				u3 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(&u_at[24]), u3);
+				v0 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(&v_at[0]), v0);
+				v1 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(&v_at[8]), v1);
+				v2 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(&v_at[16]), v2);
+				v3 = _mm256_fmadd_ps(weight, _mm256_loadu_ps(&v_at[24]), v3);
+			}
+			chroma_decoder_output_avx2(self, index, u0, v0, vector_remodulate, luma, cb, cr);
+			chroma_decoder_output_avx2(self, index + 8, u1, v1, vector_remodulate, luma, cb, cr);
+			chroma_decoder_output_avx2(self, index + 16, u2, v2, vector_remodulate, luma, cb, cr);
+			chroma_decoder_output_avx2(self, index + 24, u3, v3, vector_remodulate, luma, cb, cr);
+		}
+		for (; index + 8 <= count; index += 8) {
+			__m256 filtered_u = _mm256_setzero_ps();
+			__m256 filtered_v = _mm256_setzero_ps();
+			for (size_t tap = 0; tap < taps; tap++) {
+				const __m256 weight = _mm256_set1_ps(tap_weights[tap]);
+				filtered_u = _mm256_fmadd_ps(weight, _mm256_loadu_ps(&u[index + tap]), filtered_u);
+				filtered_v = _mm256_fmadd_ps(weight, _mm256_loadu_ps(&v[index + tap]), filtered_v);
+			}
+			chroma_decoder_output_avx2(self, index, filtered_u, filtered_v, vector_remodulate, luma, cb, cr);
+		}
+	}
+#endif
+	for (; index < count; index++) {
+		float filtered_u = 0;
+		float filtered_v = 0;
+		for (size_t tap = 0; tap < taps; tap++) {
+			filtered_u += tap_weights[tap] * u[index + tap];
+			filtered_v += tap_weights[tap] * v[index + tap];
+		}
+		float oscillator_re = self->oscillator_re[index + centre];
+		float oscillator_im = self->oscillator_im[index + centre];
+		float chroma = filtered_u * (remodulate[0] * oscillator_re + remodulate[1] * oscillator_im) + filtered_v * (remodulate[2] * oscillator_re + remodulate[3] * oscillator_im);
+		luma[index] = lrintf(self->level[index + centre] - chroma);
+		cb[index] = lrintf(filtered_u);
+		cr[index] = lrintf(filtered_v);
+	}
+}
+
+/*
+ * Weights of the real and imaginary parts of a line's demodulated chroma in
+ * Cb, then in Cr, given its burst and V-switch.  The burst sits at 135 degrees
+ * from U on lines where V is sent as is, at 225 degrees where V is inverted.
+ */
+static void chroma_decoder_weights(float burst_re, float burst_im, float amplitude, int v_switch, float *weights)
+{
+	/* e^-j(phase), the burst's angle less its nominal angle, for demodulating against */
+	double angle = atan2(burst_im, burst_re) - M_PI / 2 + v_switch * M_PI / 4;
+	double rotate_re = cos(angle);
+	double rotate_im = -sin(angle);
+	/* Scale to the luma range given by the burst, then to Cb and Cr */
+	double scale = 2 * chroma_decoder_burst_level / amplitude * (1 << chroma_decoder_fraction_bits);
+	double u_scale = scale * chroma_decoder_cb_per_u;
+	double v_scale = scale * chroma_decoder_cr_per_v * v_switch;
+	weights[0] = -u_scale * rotate_im;
+	weights[1] = -u_scale * rotate_re;
+	weights[2] = v_scale * rotate_re;
+	weights[3] = -v_scale * rotate_im;
+}
+
+/******************************************************************************/
+
+bool chroma_decoder_supported(const struct chroma_decoder_config *config)
+{
+	double sample_rate_hz = 1e12 / config->sample_period_ps;
+	return config->subcarrier_millihertz && sample_rate_hz * 1000 >= (double) chroma_decoder_min_oversampling * config->subcarrier_millihertz;
+}
+
+void chroma_decoder_init(struct chroma_decoder *self, const struct chroma_decoder_config *config, size_t capacity)
+{
+	if (!chroma_decoder_supported(config)) {
+		fatal_error("Sample rate too low for the colour subcarrier");
+	}
+	const double sample_ns = config->sample_period_ps / 1000.0;
+	const double cycles_per_sample = config->subcarrier_millihertz * 1e-15 * config->sample_period_ps;
+	self->phase_step = ldexp(cycles_per_sample, 64);
+	self->line_samples = lround(config->line_duration_ns / sample_ns);
+	/* Leave out the first and last eighth of the burst, where its envelope rises and falls */
+	self->burst_lead = lround((config->burst_lead_ns - config->burst_ns / 8.0) / sample_ns);
+	self->burst_length = lround(config->burst_ns * 3 / 4.0 / sample_ns);
+	self->half_taps = lround(chroma_decoder_filter_reach_ns / sample_ns);
+	/* Windowed sinc, with unity gain at DC */
+	const size_t taps = 2 * self->half_taps + 1;
+	self->taps = malloc(taps * sizeof(*self->taps));
+	const double cutoff = chroma_decoder_bandwidth_hz * config->sample_period_ps * 1e-12;
+	double sum = 0;
+	for (size_t tap = 0; tap < taps; tap++) {
+		double t = (double) tap - self->half_taps;
+		double sinc = t == 0 ? 2 * cutoff : sin(2 * M_PI * cutoff * t) / (M_PI * t);
+		double window = 0.42 + 0.5 * cos(M_PI * t / (self->half_taps + 1)) + 0.08 * cos(2 * M_PI * t / (self->half_taps + 1));
+		self->taps[tap] = sinc * window;
+		sum += self->taps[tap];
+	}
+	for (size_t tap = 0; tap < taps; tap++) {
+		self->taps[tap] /= sum;
+	}
+	self->history = self->line_samples + (self->burst_lead > self->half_taps ? self->burst_lead : self->half_taps);
+	self->lookahead = self->half_taps;
+	self->capacity = capacity;
+	const size_t span = capacity + 2 * self->half_taps > self->burst_length ? capacity + 2 * self->half_taps : self->burst_length;
+	self->carrier_re = malloc(span * sizeof(*self->carrier_re));
+	self->carrier_im = malloc(span * sizeof(*self->carrier_im));
+	for (size_t index = 0; index < span; index++) {
+		double angle = 2 * M_PI * chroma_decoder_turns(index * self->phase_step);
+		self->carrier_re[index] = cos(angle);
+		self->carrier_im[index] = -sin(angle);
+	}
+	self->level = malloc(span * sizeof(*self->level));
+	self->oscillator_re = malloc(span * sizeof(*self->oscillator_re));
+	self->oscillator_im = malloc(span * sizeof(*self->oscillator_im));
+	for (int row = 0; row < 2; row++) {
+		self->mixed[row] = malloc(span * sizeof(*self->mixed[row]));
+	}
+	self->min_burst = chroma_decoder_burst_level * (config->white_level - config->black_level) / 4;
+}
+
+/*
+ * Separate (count) outputs, at most (capacity), from (first) past data[0],
+ * which is at absolute offset (origin), into luma in mV and Cb and Cr relative
+ * to 128 in 1/2^chroma_decoder_fraction_bits.  Reads (history) samples before
+ * the first output and (lookahead) after the last.  Lines without a burst, or
+ * whose burst does not swing as PAL's does, come out without colour.
+ */
+void chroma_decoder_separate(struct chroma_decoder *self, const sample_t *data, offset_t origin, ptrdiff_t first, size_t count, sample_t *luma, sample_t *cb, sample_t *cr)
+{
+	const ptrdiff_t line = self->line_samples;
+	const ptrdiff_t burst = -(ptrdiff_t) self->burst_lead;
+	float burst_re[2];
+	float burst_im[2];
+	float amplitude[2];
+	for (int previous = 0; previous < 2; previous++) {
+		ptrdiff_t at = burst - previous * line;
+		chroma_decoder_burst(self, &data[at], origin + at, &burst_re[previous], &burst_im[previous]);
+		amplitude[previous] = 2 * hypotf(burst_re[previous], burst_im[previous]) / self->burst_length;
+	}
+	/* This burst leads the one before by 90 degrees where V is inverted, lags it where not */
+	float swing = burst_im[0] * burst_re[1] - burst_re[0] * burst_im[1];
+	float product = amplitude[0] * amplitude[1] * self->burst_length * self->burst_length / 4;
+	if (amplitude[0] < self->min_burst || amplitude[1] < self->min_burst || fabsf(swing) < product / 2) {
+		for (size_t index = 0; index < count; index++) {
+			luma[index] = data[first + index];
+			cb[index] = 0;
+			cr[index] = 0;
+		}
+		return;
+	}
+	int v_switch = swing < 0 ? 1 : -1;
+	float current[4];
+	float before[4];
+	chroma_decoder_weights(burst_re[0], burst_im[0], amplitude[0], v_switch, current);
+	chroma_decoder_weights(burst_re[1], burst_im[1], amplitude[1], -v_switch, before);
+	/*
+	 * Luma loses the chroma that the averaged U and V make on this line's
+	 * subcarrier, found by inverting this line's weights, times the 2 that
+	 * demodulation halves the chroma by.
+	 */
+	const float determinant = current[0] * current[3] - current[1] * current[2];
+	const float remodulate[4] = {
+		2 * current[3] / determinant,
+		-2 * current[2] / determinant,
+		-2 * current[1] / determinant,
+		2 * current[0] / determinant,
+	};
+	/* Each line gives half of U and V, as a delay line would */
+	for (int weight = 0; weight < 4; weight++) {
+		current[weight] /= 2;
+		before[weight] /= 2;
+	}
+	const ptrdiff_t start = first - (ptrdiff_t) self->half_taps;
+	const size_t span = count + 2 * self->half_taps;
+	chroma_decoder_mix(self, &data[start], origin + start, span, current, true);
+	chroma_decoder_mix(self, &data[start - line], origin + start - line, span, before, false);
+	chroma_decoder_filter(self, count, remodulate, luma, cb, cr);
+}
+
+void chroma_decoder_destroy(struct chroma_decoder *self)
+{
+	free(self->taps);
+	free(self->carrier_re);
+	free(self->carrier_im);
+	free(self->level);
+	free(self->oscillator_re);
+	free(self->oscillator_im);
+	for (int row = 0; row < 2; row++) {
+		free(self->mixed[row]);
+	}
+}
@@ -0,0 +1,65 @@
+#pragma once
+#include "stdinc.h"
+#include "buffer.h"
+
+enum
+{
+	/* Fractional bits of the Cb and Cr levels output, which are relative to 128 */
+	chroma_decoder_fraction_bits = 8,
+	/* Sample rate needed, in multiples of the subcarrier, so that demodulation images clear the chroma band */
+	chroma_decoder_min_oversampling = 3,
+};
+
+/* Where to find the subcarrier and burst of a PAL signal */
+struct chroma_decoder_config
+{
+	uint64_t sample_period_ps;
+	uint64_t subcarrier_millihertz;
+	/* Nominal line period, for finding the line before */
+	uint32_t line_duration_ns;
+	/* Burst, starting this long before the active part of the line */
+	uint32_t burst_lead_ns;
+	uint32_t burst_ns;
+	sample_t black_level;
+	sample_t white_level;
+};
+
+/*
+ * Separates a line of PAL into luma and Cb/Cr.  The burst gives the phase of
+ * the subcarrier and the line's V-switch, by comparison with the burst of the
+ * line before, whose chroma is also demodulated and averaged with this line's
+ * as a delay line would.  The subcarrier is tracked by absolute sample offset,
+ * so lines need no state from each other and may be rendered in any order.
+ */
+struct chroma_decoder
+{
+	/* Samples read before the first and after the last output */
+	size_t history;
+	size_t lookahead;
+	/* Most outputs per call */
+	size_t capacity;
+	size_t line_samples;
+	/* Burst window, starting burst_lead samples before the active line */
+	size_t burst_lead;
+	size_t burst_length;
+	/* Subcarrier cycles per sample, in 2^-64 */
+	uint64_t phase_step;
+	/* Symmetric lowpass taking the demodulated chroma down to its bandwidth */
+	size_t half_taps;
+	float *taps;
+	/* Subcarrier e^-jwk for k samples from the start of a span */
+	float *carrier_re;
+	float *carrier_im;
+	/* Working rows: levels and subcarrier over this line, and U and V demodulated from it and the one before */
+	float *level;
+	float *oscillator_re;
+	float *oscillator_im;
+	float *mixed[2];
+	/* Bursts weaker than this, in mV, turn the colour off */
+	float min_burst;
+};
+
+bool chroma_decoder_supported(const struct chroma_decoder_config *config);
+void chroma_decoder_init(struct chroma_decoder *self, const struct chroma_decoder_config *config, size_t capacity);
+void chroma_decoder_separate(struct chroma_decoder *self, const sample_t *data, offset_t origin, ptrdiff_t first, size_t count, sample_t *luma, sample_t *cb, sample_t *cr);
+void chroma_decoder_destroy(struct chroma_decoder *self);
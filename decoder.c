@@ -1,181 +1,404 @@
 #include "decoder.h"
 #include "buffer.h"
 #include "errors.h"
-#include "pattern_buffer.h"
+#include "image_scaler.h"
+#include "low_run.h"
 #include "pulse_width.h"
+#include "pulse_classifier.h"
+#include "sync_pattern.h"
+#include "video_standard.h"
+
+#include <time.h>
 
 enum
 {
-	longest_sync_pattern_length = 15,
+	/* The capture rate without colour, which has its own specialised code along with four times each subcarrier */
+	decoder_grey_sample_period_ps = 1000000000000ull / 9600000,
+	decoder_pulse_prototype_count = 5,
 };
 
-enum pulse_type
+/*
+ * Hot paths, instantiated once with the run-time configuration and once per
+ * video standard and sample rate with both known at compile time.
+ */
+struct decoder_ops
 {
-	pulse_type_none = 0,
-	pulse_type_equaliser = 'e',
-	pulse_type_vertical = 'v',
-	pulse_type_horizontal = 'h',
-	pulse_type_field = 'f',
+	const struct video_standard *standard;
+	uint32_t sample_period_ps;
+	void (*classify_pulses)(struct decoder *self, const struct pulse_info *pulses, char *types, size_t count);
+	void (*process_line)(struct decoder *self, uint64_t high_begin_fine, uint64_t high_end_fine);
 };
 
-enum pattern_type
+static inline uint64_t decoder_period_ns_to_fine(uint32_t sample_period_ps, uint32_t ns)
 {
-	pattern_type_none,
-	pattern_type_next_frame,
-	pattern_type_next_field,
-};
-
-/* REVERSED, i.e. first char is last pulse of pattern */
-static const char pattern_next_frame[longest_sync_pattern_length] = "eeeeevvvvveeeee";
-static const char pattern_next_field[longest_sync_pattern_length] = "feeeevvvvveeeee";
+	return ((uint64_t) ns * 1000 << pulse_fraction_bits) / sample_period_ps;
+}
 
-static uint8_t *decoder_next_line(struct decoder *self)
+static inline __attribute__((always_inline)) uint8_t *decoder_next_line(struct decoder *self, const struct video_timing *timing)
 {
 	uint32_t this_line = self->next_line;
-	if (this_line >= self->config.frame_height) {
+	if (this_line >= self->frame_height) {
 		return NULL;
 	}
-	self->next_line += self->config.interlaced ? 2 : 1;
-	return &self->frame[this_line * self->config.frame_width];
+	self->next_line += timing->interlaced ? 2 : 1;
+	int32_t row = self->frame_rows[this_line];
+	return row < 0 ? NULL : &self->frame[row * self->row_bytes];
 }
 
 static void decoder_select_field(struct decoder *self, int field)
 {
-	if (self->config.interlaced && field == 1) {
+	/* An image made in place with rows handed out would be drawn over from the top, so it ends here as it stands */
+	if (!self->field_frame && self->image_rows_published && !self->frame_ready) {
+		self->image_cut = true;
+		self->frame_ready = true;
+	}
+	if (self->config.timing.interlaced && field == 1) {
 		self->next_line = 1;
 	} else {
 		self->next_line = 0;
 	}
+	self->blanking_lines = self->config.active_area.height ? self->config.active_area.first_line : 0;
+}
+
+/* Lines of the frame held: those of the active area, or all of them */
+static uint32_t decoder_frame_height(const struct decoder_config *config)
+{
+	const uint32_t height = config->active_area.height;
+	return height && height < config->timing.frame_height ? height : config->timing.frame_height;
+}
+
+/* Whether an image is emitted after every field rather than every frame */
+static bool decoder_field_rate(const struct decoder_config *config)
+{
+	return config->timing.interlaced && config->output != decoder_output_frame && config->output != decoder_output_single_field;
+}
+
+/* Whether images are made from the lines of one field */
+static bool decoder_one_field(const struct decoder_config *config)
+{
+	const enum decoder_output output = config->output;
+	return config->timing.interlaced && (output == decoder_output_bob || output == decoder_output_field || output == decoder_output_single_field);
+}
+
+/* Line of the frame that (row) of the image that the output mode makes comes from, in (field) */
+static uint32_t decoder_source_line(const struct decoder_config *config, uint32_t row, int field)
+{
+	if (!decoder_one_field(config)) {
+		return row;
+	}
+	uint32_t source = (config->output == decoder_output_bob ? row & ~1u : 2 * row) + field;
+	/* The last line of a field with fewer lines is repeated */
+	if (source >= decoder_frame_height(config)) {
+		source -= 2;
+	}
+	return source;
+}
+
+/* Leading rows of the image being made that are complete, going by next_line */
+static uint32_t decoder_image_rows_complete(const struct decoder *self)
+{
+	const struct video_timing *timing = &self->config.timing;
+	uint32_t rows = self->next_line;
+	if (timing->interlaced) {
+		/* Rows of the other field are already in, or in frame mode still to come */
+		uint32_t field = rows & 1;
+		switch (self->config.output) {
+		case decoder_output_frame:
+			rows = field ? rows : 0;
+			break;
+		case decoder_output_weave:
+			break;
+		case decoder_output_bob:
+			rows -= field;
+			break;
+		case decoder_output_field:
+			rows = (rows - field) / 2;
+			break;
+		case decoder_output_single_field:
+			/* The image went out when the second field started */
+			rows = field ? 0 : rows / 2;
+			break;
+		}
+	}
+	/* Of those, the rows emitted */
+	const struct decoder_crop *crop = &self->config.crop;
+	const uint32_t step = self->config.vertical_decimation;
+	rows = rows > crop->top ? (rows - crop->top + step - 1) / step : 0;
+	return rows < self->image_height ? rows : self->image_height;
+}
+
+/* Publish a slice once another config.slice_rows rows of the image are complete */
+static void decoder_publish_rows(struct decoder *self)
+{
+	const uint32_t slice_rows = self->config.slice_rows;
+	uint32_t complete = decoder_image_rows_complete(self);
+	/* The last row waits for the image to complete, so that the last slice is never empty */
+	if (complete == self->image_height) {
+		complete--;
+	}
+	if (complete < self->image_rows_published + slice_rows) {
+		return;
+	}
+	self->slice_ready = true;
+	self->slice_rows_ready = (complete - self->image_rows_published) / slice_rows * slice_rows;
+	self->image_field = self->config.timing.interlaced ? self->next_line & 1 : 0;
+}
+
+static bool decoder_line_is_valid(const struct decoder *self, uint32_t line)
+{
+	return self->line_valid[line / 64] >> (line % 64) & 1;
+}
+
+static void decoder_clear_line_valid(struct decoder *self)
+{
+	memset(self->line_valid, 0, self->line_valid_words * sizeof(*self->line_valid));
 }
 
 static void decoder_reset_frame(struct decoder *self)
 {
-	memset(self->frame, 0, self->config.frame_width * self->config.frame_height);
-	self->next_line = 0;
-	self->frame_ready = false;
+	line_renderer_flush(&self->line_renderer);
+	decoder_select_field(self, 0);
+	/* Unless that ended an image, which is composed from the rows valid when it is handed out */
+	if (!self->image_cut) {
+		decoder_clear_line_valid(self);
+	}
 }
 
-static struct buffer_chunk *decoder_seek(struct decoder *self, struct buffer_chunk *initial, offset_t offset)
+/*
+ * Samples (first) to (last) inclusive, contiguous (copied to (copy) if need
+ * be), or NULL if they are not all buffered.
+ */
+static const sample_t *decoder_line_samples(struct decoder *self, offset_t first, offset_t last, sample_t *copy)
 {
-	struct buffer_chunk *chunk = initial;
-	if (chunk == NULL) {
+	struct buffer_chunk *chunk = self->current;
+	if (!chunk) {
 		return NULL;
 	}
-	while (chunk->next && chunk->offset + chunk->length <= offset) {
+	while (chunk->prev && chunk->offset > first) {
+		chunk = chunk->prev;
+	}
+	while (chunk->next && chunk->offset + chunk->length <= first) {
 		chunk = chunk->next;
 	}
-	while (chunk->prev && chunk->offset > offset) {
-		chunk = chunk->prev;
+	if (first < chunk->offset || first >= chunk->offset + chunk->length) {
+		return NULL;
+	}
+	if (last < chunk->offset + chunk->length) {
+		return &chunk->data[first - chunk->offset];
 	}
-	assert_equal(true, offset >= chunk->offset);
-	assert_equal(true, offset < chunk->offset + chunk->length);
-	return chunk;
+	/* Straddles chunks, so copy */
+	size_t count = last + 1 - first;
+	if (count > self->line_samples_capacity) {
+		return NULL;
+	}
+	for (size_t index = 0; index < count; chunk = chunk->next) {
+		if (!chunk || chunk->offset > first + index) {
+			return NULL;
+		}
+		size_t from = first + index - chunk->offset;
+		size_t length = chunk->length - from < count - index ? chunk->length - from : count - index;
+		memcpy(&copy[index], &chunk->data[from], length * sizeof(*chunk->data));
+		index += length;
+	}
+	return copy;
 }
 
-static inline uint8_t decoder_convert_brightness(struct decoder *self, sample_t value)
+/* Describe the line of (duration_fine) from (begin_fine) to the renderer */
+static bool decoder_line_job(struct decoder *self, struct line_job *job, uint64_t begin_fine, uint64_t duration_fine)
 {
-	sample_t black = self->config.black_level;
-	sample_t white = self->config.white_level;
-	if (value < black) {
-		return 0;
-	} else if (value > white) {
-		return 255;
-	} else {
-		return 255 * (value - black) / (white - black);
+	const struct line_renderer *renderer = &self->line_renderer;
+	offset_t origin = begin_fine >> pulse_fraction_bits;
+	offset_t first = origin - line_resampler_margin_before - renderer->history;
+	offset_t last = ((begin_fine + duration_fine) >> pulse_fraction_bits) + line_resampler_margin_after + renderer->lookahead;
+	/* Colour separation takes no more than a copy's worth, even where the line need not be copied */
+	if (renderer->chroma_decoders && last + 1 - first > self->line_samples_capacity) {
+		return false;
 	}
+	const sample_t *data = decoder_line_samples(self, first, last, job->copy);
+	if (!data) {
+		return false;
+	}
+	job->data = data + (origin - first);
+	job->first = first;
+	job->origin = origin;
+	job->begin_fraction = begin_fine & (pulse_fraction_one - 1);
+	job->duration_fine = duration_fine;
+	return true;
 }
 
-static void decoder_process_line(struct decoder *self, offset_t high_begin, offset_t high_end)
+static inline __attribute__((always_inline)) void decoder_render_line(struct decoder *self, const struct video_timing *timing, uint64_t back_porch_fine, uint64_t front_porch_fine, uint64_t high_begin_fine, uint64_t high_end_fine)
 {
-	uint8_t *line = decoder_next_line(self);
-	if (line == NULL) {
+	/* Vertical blanking, before the picture */
+	if (self->blanking_lines) {
+		self->blanking_lines--;
 		return;
 	}
-	size_t width = self->config.frame_width;
-	offset_t back_porch = (uint64_t) self->config.back_porch_ns * 1000 / self->config.sample_period_ps;
-	offset_t front_porch = (uint64_t) self->config.front_porch_ns * 1000 / self->config.sample_period_ps;
-	offset_t data_begin = high_begin + back_porch;
-	offset_t data_end = high_end - front_porch;
-	offset_t data_duration = data_end - data_begin;
-	struct buffer_chunk *chunk = self->current;
-	for (uint32_t col = 0; col < width; col++) {
-		offset_t offset = data_begin + (data_duration * col / width);
-		chunk = decoder_seek(self, chunk, offset);
-		if (!chunk) {
-			return;
+	uint32_t row = self->next_line;
+	if (row >= self->frame_height) {
+		return;
+	}
+	/* Lines not emitted are passed over, but may still complete rows before them */
+	uint8_t *line = decoder_next_line(self, timing);
+	/* Until an image made in place is handed out, lines of the next one have nowhere to go */
+	if (self->frame_ready && !self->field_frame) {
+		line = NULL;
+	}
+	uint64_t data_begin = high_begin_fine + back_porch_fine;
+	uint64_t data_end = high_end_fine - front_porch_fine;
+	if (line && data_end > data_begin) {
+		/* Only the columns emitted */
+		uint64_t duration = data_end - data_begin;
+		uint64_t begin = data_begin + (duration * self->crop_begin_ratio >> 32);
+		struct line_job *job = line_renderer_job(&self->line_renderer);
+		if (decoder_line_job(self, job, begin, duration * self->crop_span_ratio >> 32)) {
+			job->row = line;
+			line_renderer_submit(&self->line_renderer);
+			self->line_valid[row / 64] |= (uint64_t) 1 << (row % 64);
 		}
-		line[col] = decoder_convert_brightness(self, chunk->data[offset - chunk->offset]);
+	}
+	if (self->config.slice_rows && !self->frame_ready) {
+		decoder_publish_rows(self);
 	}
 }
 
-static enum pattern_type decoder_get_sync_pattern(struct decoder *self)
+/*
+ * Look for edges only around the predicted line syncs of the field starting
+ * with a sync at (sync_fine), and of the field after it.
+ */
+static void decoder_arm_gate(struct decoder *self, int field, uint64_t sync_fine)
 {
-	struct pattern_buffer *pattern_buffer = &self->pattern_buffer;
-	if (pattern_buffer_match(pattern_buffer, pattern_next_frame)) {
-		return pattern_type_next_frame;
-	} else if (pattern_buffer_match(pattern_buffer, pattern_next_field)) {
-		return pattern_type_next_field;
-	} else {
-		return pattern_type_none;
+	const struct sync_flywheel *flywheel = &self->sync_flywheel;
+	const uint64_t period = flywheel->period_fine;
+	const uint64_t margin = decoder_gate_margin_lines * period;
+	int next_field = self->config.timing.interlaced ? !field : field;
+	uint64_t duration = flywheel->field_duration_fine[field];
+	uint64_t active = flywheel->field_active_fine[field];
+	uint64_t next_active = flywheel->field_active_fine[next_field];
+	if (!flywheel->locked || active <= 2 * margin || next_active <= 2 * margin) {
+		return;
 	}
+	const struct pulse_gate gate = {
+		.predicted_fine = sync_fine + period,
+		.period_fine = period,
+		.hold_fine = self->horizontal_sync_fine,
+		.window_fine = flywheel->tolerance_fine * decoder_gate_window_tolerances,
+		.end_fine = sync_fine + active - margin,
+		.resume_fine = sync_fine + duration + period,
+		.resume_end_fine = sync_fine + duration + next_active - margin,
+	};
+	pulse_stream_reader_gate(&self->pulse_stream_reader, &gate);
 }
 
-static void decoder_process_pulse_pattern(struct decoder *self)
+static void decoder_black_row(const struct decoder *self, uint8_t *row)
 {
-	enum pattern_type type = decoder_get_sync_pattern(self);
-	if (type == pattern_type_none) {
+	if (self->image_components == 1) {
+		memset(row, 0, self->row_bytes);
 		return;
 	}
-	if (type == pattern_type_next_frame) {
-		self->frame_ready = true;
-		decoder_select_field(self, 0);
-	} else if (type == pattern_type_next_field) {
-		decoder_select_field(self, 1);
+	/* Y, Cb, Cr with no colour */
+	for (uint32_t column = 0; column < self->row_bytes / 3; column++) {
+		row[3 * column] = 0;
+		row[3 * column + 1] = 128;
+		row[3 * column + 2] = 128;
 	}
-	pattern_buffer_clear(&self->pattern_buffer);
 }
 
-static bool is_similar(uint32_t measurement, uint32_t reference, uint32_t tolerance)
+/*
+ * Halve the full image's rows up to (rows), all of them if (complete), into
+ * the rows of each smaller image that they finish, while they are in cache.
+ */
+static void decoder_make_pyramid(struct decoder *self, uint32_t rows, bool complete)
 {
-	int32_t difference = measurement;
-	difference -= reference;
-	return abs(difference) <= tolerance;
+	const uint8_t *source = self->image;
+	uint32_t source_width = self->row_bytes / self->image_components;
+	uint32_t source_height = self->image_height;
+	size_t source_row_bytes = self->row_bytes;
+	for (uint32_t index = 0; index < self->config.pyramid_levels; index++) {
+		struct decoder_pyramid_level *level = &self->pyramid[index];
+		uint8_t *image = image_exchange_buffer(&level->images);
+		const uint32_t end = complete ? level->height : rows / 2;
+		for (uint32_t row = level->rows_made; row < end; row++) {
+			const uint8_t *top = &source[2 * row * source_row_bytes];
+			/* The last row of an odd height is averaged with itself */
+			const uint8_t *bottom = 2 * row + 1 < source_height ? &top[source_row_bytes] : top;
+			image_scaler_halve_row(top, bottom, &image[row * level->row_bytes], source_width, self->image_components);
+		}
+		level->rows_made = end;
+		level->image = image;
+		source = image;
+		source_width = level->width;
+		source_height = level->height;
+		source_row_bytes = level->row_bytes;
+		rows = end;
+	}
 }
 
-enum pulse_type decoder_characterise_pulse(struct decoder *self, uint32_t duration_ns, uint32_t high_ns)
+/*
+ * Make rows (first) to (end) of the image to emit in (image), once they are
+ * complete in the field in image_field.  At frame rate the image is the frame,
+ * so only rows never rendered need clearing.
+ */
+static void decoder_compose_rows(struct decoder *self, uint8_t *image, uint32_t first, uint32_t end)
 {
-	struct decoder_config *config = &self->config;
-	uint32_t low_ns = duration_ns - high_ns;
-	uint32_t line_duration_ns = self->config.line_duration_ns;
-	uint32_t sync_duration_ns = self->config.sync_duration_ns;
-	uint32_t horizontal_sync_low_ns = self->config.horizontal_sync_low_ns;
-	uint32_t equaliser_low_ns = self->config.equaliser_low_ns;
-	uint32_t vertical_sync_low_ns = self->config.vertical_sync_low_ns;
-	uint32_t tolerance_ns = self->config.tolerance_ns;
-	if (is_similar(duration_ns, line_duration_ns, tolerance_ns) && is_similar(low_ns, horizontal_sync_low_ns, tolerance_ns)) {
-		return pulse_type_horizontal;
+	const struct decoder_crop *crop = &self->config.crop;
+	const size_t row_bytes = self->row_bytes;
+	for (uint32_t line = first; line < end; line++) {
+		uint32_t source = decoder_source_line(&self->config, crop->top + line * self->config.vertical_decimation, self->image_field);
+		uint8_t *row = &image[line * row_bytes];
+		if (!decoder_line_is_valid(self, source)) {
+			decoder_black_row(self, row);
+		} else if (image != self->frame) {
+			memcpy(row, &self->frame[self->frame_rows[source] * row_bytes], row_bytes);
+		}
 	}
-	if (is_similar(duration_ns, line_duration_ns, tolerance_ns) && is_similar(low_ns, equaliser_low_ns, tolerance_ns)) {
-		return pulse_type_field;
+}
+
+/* Vertical sync recognised, (sync_fine) being where the field's first line starts */
+static void decoder_process_pulse_pattern(struct decoder *self, enum pattern_type type, uint64_t sync_fine)
+{
+	if (type == pattern_type_none) {
+		return;
 	}
-	if (is_similar(duration_ns, sync_duration_ns, tolerance_ns) && is_similar(low_ns, horizontal_sync_low_ns, tolerance_ns)) {
-		return pulse_type_field;
+	int field = type == pattern_type_next_field;
+	/* A single field goes out once the second starts, as nothing of that is rendered */
+	const bool single_field = self->config.timing.interlaced && self->config.output == decoder_output_single_field;
+	if (single_field ? type == pattern_type_next_field : type == pattern_type_next_frame || decoder_field_rate(&self->config)) {
+		self->frame_ready = true;
+		/* The field just finished */
+		self->image_field = self->config.timing.interlaced ? !field : 0;
 	}
-	if (is_similar(duration_ns, sync_duration_ns, tolerance_ns) && is_similar(low_ns, vertical_sync_low_ns, tolerance_ns)) {
-		return pulse_type_vertical;
+	if (type == pattern_type_next_frame) {
+		decoder_select_field(self, 0);
+	} else if (type == pattern_type_next_field) {
+		decoder_select_field(self, 1);
 	}
-	if (is_similar(duration_ns, sync_duration_ns, tolerance_ns) && is_similar(low_ns, equaliser_low_ns, tolerance_ns)) {
-		return pulse_type_equaliser;
+	sync_recogniser_reset(&self->sync_recogniser);
+	self->vertical_pending = false;
+	if (self->config.flywheel) {
+		sync_flywheel_field(&self->sync_flywheel, field, sync_fine);
+		decoder_arm_gate(self, field, sync_fine);
 	}
-	return pulse_type_none;
 }
 
-static void decoder_debug_log_pulse(enum pulse_type type, uint32_t pulse_ns, uint32_t pulse_high_ns, bool force)
+static void decoder_measure_pulse(struct decoder *self, const struct pulse_info *pulse_info, uint32_t *pulse_ns, uint32_t *pulse_high_ns)
+{
+	const uint32_t sample_period_ps = self->config.sample_period_ps;
+	/* We trust that the input is valid, such that these won't go negative */
+	uint64_t pulse_fine = pulse_info->end_fine - pulse_info->start_fine;
+	uint64_t pulse_high_fine = pulse_info->end_fine - pulse_info->transition_fine;
+	*pulse_ns = (pulse_fine * sample_period_ps / 1000) >> pulse_fraction_bits;
+	*pulse_high_ns = (pulse_high_fine * sample_period_ps / 1000) >> pulse_fraction_bits;
+}
+
+static void decoder_debug_log_pulse(struct decoder *self, enum pulse_type type, const struct pulse_info *pulse_info, bool force)
 {
 	static enum pulse_type prev_type;
 	static uint32_t prev_count;
 	static uint32_t prev_ns;
 	static uint32_t prev_high_ns;
+	uint32_t pulse_ns;
+	uint32_t pulse_high_ns;
+	decoder_measure_pulse(self, pulse_info, &pulse_ns, &pulse_high_ns);
 	if (type == prev_type) {
 		prev_count++;
 	}
@@ -200,40 +423,303 @@ static void decoder_debug_log_pulse(enum pulse_type type, uint32_t pulse_ns, uin
 	}
 }
 
-static void decoder_process_pulse(struct decoder *self, struct pulse_info *pulse_info)
+/* Reference shapes in the order in which they take precedence */
+static inline __attribute__((always_inline)) void decoder_pulse_prototypes(const struct video_timing *timing, struct pulse_prototype *prototypes)
 {
-	const uint32_t sample_period_ps = self->config.sample_period_ps;
-	/* We trust that the input is valid, such that these won't go negative */
-	uint64_t pulse_samples = pulse_info->end - pulse_info->start;
-	uint64_t pulse_high_samples = pulse_info->end - pulse_info->transition;
-	uint32_t pulse_ns = pulse_samples * sample_period_ps / 1000;
-	uint32_t pulse_high_ns = pulse_high_samples * sample_period_ps / 1000;
-	enum pulse_type type = decoder_characterise_pulse(self, pulse_ns, pulse_high_ns);
+	const uint32_t tolerance = timing->tolerance_ns;
+	prototypes[0] = (struct pulse_prototype) { pulse_type_horizontal, timing->line_duration_ns, timing->horizontal_sync_low_ns, tolerance };
+	prototypes[1] = (struct pulse_prototype) { pulse_type_field, timing->line_duration_ns, timing->equaliser_low_ns, tolerance };
+	prototypes[2] = (struct pulse_prototype) { pulse_type_field, timing->sync_duration_ns, timing->horizontal_sync_low_ns, tolerance };
+	prototypes[3] = (struct pulse_prototype) { pulse_type_vertical, timing->sync_duration_ns, timing->vertical_sync_low_ns, tolerance };
+	prototypes[4] = (struct pulse_prototype) { pulse_type_equaliser, timing->sync_duration_ns, timing->equaliser_low_ns, tolerance };
+}
+
+static void decoder_classify_pulses_generic(struct decoder *self, const struct pulse_info *pulses, char *types, size_t count)
+{
+	const struct pulse_classifier *classifier = &self->pulse_classifier;
+	for (size_t index = 0; index < count; index++) {
+		const struct pulse_info *pulse = &pulses[index];
+		/* We trust that the input is valid, such that these won't go negative */
+		types[index] = pulse_classifier_classify(classifier, pulse->end_fine - pulse->start_fine, pulse->transition_fine - pulse->start_fine);
+	}
+}
+
+/* With the timing and sample period constant, each prototype's bounds in fine units are too, so no table is needed */
+static inline __attribute__((always_inline)) void decoder_classify_pulses_with(const struct video_timing *timing, uint32_t sample_period_ps, const struct pulse_info *pulses, char *types, size_t count)
+{
+	struct pulse_prototype prototypes[decoder_pulse_prototype_count];
+	decoder_pulse_prototypes(timing, prototypes);
+	for (size_t index = 0; index < count; index++) {
+		const struct pulse_info *pulse = &pulses[index];
+		types[index] = pulse_classifier_match_fine(prototypes, decoder_pulse_prototype_count, sample_period_ps, pulse->end_fine - pulse->start_fine, pulse->transition_fine - pulse->start_fine);
+	}
+}
+
+static void decoder_process_line_generic(struct decoder *self, uint64_t high_begin_fine, uint64_t high_end_fine)
+{
+	decoder_render_line(self, &self->config.timing, self->back_porch_fine, self->front_porch_fine, high_begin_fine, high_end_fine);
+}
+
+static const struct decoder_ops decoder_ops_generic = {
+	.standard = NULL,
+	.sample_period_ps = 0,
+	.classify_pulses = decoder_classify_pulses_generic,
+	.process_line = decoder_process_line_generic,
+};
+
+#define DECODER_SPECIALISE(id, video_standard, period_ps) \
+	static void decoder_classify_pulses_##id(struct decoder *self, const struct pulse_info *pulses, char *types, size_t count) \
+	{ \
+		decoder_classify_pulses_with(&(video_standard).timing, (period_ps), pulses, types, count); \
+	} \
+	static void decoder_process_line_##id(struct decoder *self, uint64_t high_begin_fine, uint64_t high_end_fine) \
+	{ \
+		const struct video_timing *timing = &(video_standard).timing; \
+		decoder_render_line(self, timing, decoder_period_ns_to_fine((period_ps), timing->back_porch_ns), decoder_period_ns_to_fine((period_ps), timing->front_porch_ns), high_begin_fine, high_end_fine); \
+	} \
+	static const struct decoder_ops decoder_ops_##id = { \
+		.standard = &(video_standard), \
+		.sample_period_ps = (period_ps), \
+		.classify_pulses = decoder_classify_pulses_##id, \
+		.process_line = decoder_process_line_##id, \
+	};
+
+/* As the capture program works it out from the subcarrier */
+#define DECODER_COLOUR_SAMPLE_PERIOD_PS(video_standard) (1000000000000ull / (4 * (video_standard).timing.colour_subcarrier_millihertz / 1000))
+
+DECODER_SPECIALISE(pal_bg, video_standard_pal_bg, decoder_grey_sample_period_ps)
+DECODER_SPECIALISE(pal_bg_colour, video_standard_pal_bg, DECODER_COLOUR_SAMPLE_PERIOD_PS(video_standard_pal_bg))
+DECODER_SPECIALISE(ntsc_m, video_standard_ntsc_m, decoder_grey_sample_period_ps)
+DECODER_SPECIALISE(pal_m, video_standard_pal_m, decoder_grey_sample_period_ps)
+DECODER_SPECIALISE(pal_m_colour, video_standard_pal_m, DECODER_COLOUR_SAMPLE_PERIOD_PS(video_standard_pal_m))
+
+static const struct decoder_ops *const decoder_specialisations[] = {
+	&decoder_ops_pal_bg,
+	&decoder_ops_pal_bg_colour,
+	&decoder_ops_ntsc_m,
+	&decoder_ops_pal_m,
+	&decoder_ops_pal_m_colour,
+};
+
+static const struct decoder_ops *decoder_select_ops(const struct decoder_config *config)
+{
+	if (!config->specialise) {
+		return &decoder_ops_generic;
+	}
+	for (size_t index = 0; index < sizeof(decoder_specialisations) / sizeof(decoder_specialisations[0]); index++) {
+		const struct decoder_ops *ops = decoder_specialisations[index];
+		if (ops->sample_period_ps == config->sample_period_ps && video_timing_equal(&ops->standard->timing, &config->timing)) {
+			return ops;
+		}
+	}
+	return &decoder_ops_generic;
+}
+
+/*
+ * Lines resumed after a vertical interval that was not recognised: if the
+ * field cadence says one was due, carry on as though it had been.
+ */
+static void decoder_end_vertical_interval(struct decoder *self, uint64_t sync_fine)
+{
+	const struct sync_flywheel *flywheel = &self->sync_flywheel;
+	self->vertical_pending = false;
+	if (!sync_flywheel_field_due(flywheel, sync_fine, decoder_gate_margin_lines)) {
+		return;
+	}
+	self->errors.missing_vertical_sync++;
+	bool next_field = self->config.timing.interlaced && flywheel->field == 0;
+	decoder_process_pulse_pattern(self, next_field ? pattern_type_next_field : pattern_type_next_frame, sync_fine);
+}
+
+/*
+ * A corrupted line sync, or one followed by missing ones: render the lines,
+ * taking sync positions the flywheel predicts for those not detected.
+ */
+static bool decoder_coast(struct decoder *self, const struct pulse_info *pulse_info)
+{
+	int64_t low_error = (int64_t) (pulse_info->transition_fine - pulse_info->start_fine) - (int64_t) self->horizontal_sync_fine;
+	bool sync_intact = (uint64_t) llabs(low_error) <= self->sync_flywheel.tolerance_fine;
+	if (self->vertical_pending && sync_intact) {
+		decoder_end_vertical_interval(self, pulse_info->start_fine);
+	}
+	uint32_t lines = sync_flywheel_coast(&self->sync_flywheel, pulse_info->start_fine, pulse_info->end_fine);
+	if (!lines) {
+		return false;
+	}
+	self->errors.missing_horizontal_sync += sync_intact ? lines - 1 : lines;
+	const uint64_t period = self->sync_flywheel.period_fine;
+	uint64_t begin = sync_intact ? pulse_info->transition_fine : pulse_info->start_fine + self->horizontal_sync_fine;
+	for (uint32_t line = 1; line < lines; line++) {
+		uint64_t sync = pulse_info->start_fine + line * period;
+		self->ops->process_line(self, begin, sync);
+		begin = sync + self->horizontal_sync_fine;
+	}
+	self->ops->process_line(self, begin, pulse_info->end_fine);
+	return true;
+}
+
+static void decoder_begin_acquisition(struct decoder *self)
+{
+	if (self->acquiring) {
+		return;
+	}
+	self->acquiring = true;
+	self->acquire_started = false;
+}
+
+/* Signal time spent acquiring is measured from the first sample looked at */
+static void decoder_acquire_mark(struct decoder *self, uint64_t fine_offset)
+{
+	if (!self->acquire_started) {
+		self->acquire_started = true;
+		self->acquire_start_fine = fine_offset;
+	}
+}
+
+static void decoder_acquired(struct decoder *self, enum pattern_type pattern, uint64_t sync_fine)
+{
+	struct decoder_stats *stats = &self->stats;
+	uint64_t fine = sync_fine > self->acquire_start_fine ? sync_fine - self->acquire_start_fine : 0;
+	uint64_t ns = (fine * self->config.sample_period_ps / 1000) >> pulse_fraction_bits;
+	stats->acquisitions++;
+	stats->acquisition_ns_total += ns;
+	stats->acquisition_ns_max = ns > stats->acquisition_ns_max ? ns : stats->acquisition_ns_max;
+	self->acquiring = false;
+	decoder_process_pulse_pattern(self, pattern, sync_fine);
+	/* Nothing was rendered while acquiring, so there is no frame to emit yet */
+	self->frame_ready = false;
+}
+
+/* While acquiring, pulses only feed the sync recogniser (and flywheel) */
+static void decoder_acquire_pulse(struct decoder *self, const struct pulse_info *pulse_info, enum pulse_type type)
+{
+	decoder_acquire_mark(self, pulse_info->start_fine);
+	if (type == pulse_type_horizontal) {
+		if (self->config.flywheel) {
+			sync_flywheel_line(&self->sync_flywheel, pulse_info->start_fine);
+		}
+		self->vertical_pending = false;
+	} else if (type != pulse_type_none) {
+		enum pattern_type pattern = sync_recogniser_next(&self->sync_recogniser, type);
+		self->vertical_pending = true;
+		if (pattern != pattern_type_none) {
+			decoder_acquired(self, pattern, pulse_info->end_fine);
+		}
+	} else {
+		sync_recogniser_reset(&self->sync_recogniser);
+	}
+}
+
+/*
+ * Skip over samples of the current chunk up to the next run long enough to
+ * be a broad pulse, then decode from a few lines before it so that the whole
+ * vertical sync sequence is seen.  Without one, the last few lines of the
+ * chunk are still decoded, in case the sequence starts there.
+ */
+static void decoder_acquire(struct decoder *self)
+{
+	struct pulse_stream_reader *reader = &self->pulse_stream_reader;
+	struct buffer_chunk *chunk = self->current;
+	size_t begin = pulse_stream_reader_index(reader);
+	size_t end = chunk->length;
+	decoder_acquire_mark(self, (uint64_t) (chunk->offset + begin) << pulse_fraction_bits);
+	struct low_run run;
+	if (low_run_find(chunk->data, begin, chunk->length, self->config.sync_threshold, self->acquire_min_run, &run)) {
+		end = run.begin;
+	}
+	size_t resume = end > begin + self->acquire_rewind ? end - self->acquire_rewind : begin;
+	self->stats.acquisition_samples_skipped += resume - begin;
+	pulse_stream_reader_skip(reader, chunk->offset + resume);
+}
+
+static void decoder_process_pulse(struct decoder *self, const struct pulse_info *pulse_info, enum pulse_type type)
+{
+	if (self->acquiring) {
+		decoder_acquire_pulse(self, pulse_info, type);
+		return;
+	}
 	if (type == pulse_type_horizontal) {
-		decoder_process_line(self, pulse_info->transition, pulse_info->end);
+		if (self->config.flywheel) {
+			if (self->vertical_pending) {
+				decoder_end_vertical_interval(self, pulse_info->start_fine);
+			}
+			sync_flywheel_line(&self->sync_flywheel, pulse_info->start_fine);
+		}
+		self->ops->process_line(self, pulse_info->transition_fine, pulse_info->end_fine);
 	} else if (type != pulse_type_none) {
-		if (!pattern_buffer_next(&self->pattern_buffer, type)) {
+		enum pattern_type pattern = sync_recogniser_next(&self->sync_recogniser, type);
+		if (sync_recogniser_overlong(&self->sync_recogniser)) {
 			self->errors.long_sync_pattern++;
 		}
-		decoder_process_pulse_pattern(self);
+		self->vertical_pending = true;
+		decoder_process_pulse_pattern(self, pattern, pulse_info->end_fine);
+	} else if (self->config.flywheel && decoder_coast(self, pulse_info)) {
+		return;
 	} else {
 		self->errors.unrecognised_pulse_type++;
-		pattern_buffer_clear(&self->pattern_buffer);
-		decoder_debug_log_pulse(type, pulse_ns, pulse_high_ns, true);
+		sync_recogniser_reset(&self->sync_recogniser);
+		decoder_debug_log_pulse(self, type, pulse_info, true);
 	}
-	/* decoder_debug_log_pulse(type, pulse_ns, pulse_high_ns, false); */
+	/* decoder_debug_log_pulse(self, type, pulse_info, false); */
+}
+
+/* Extract and classify the next batch of pulses from the current chunk */
+static size_t decoder_read_pulse_batch(struct decoder *self)
+{
+	struct pulse_info *batch = self->pulse_batch;
+	char *types = self->pulse_batch_types;
+	size_t length = pulse_stream_reader_read(&self->pulse_stream_reader, batch, decoder_pulse_batch_capacity);
+	self->ops->classify_pulses(self, batch, types, length);
+	self->pulse_batch_length = length;
+	self->pulse_batch_index = 0;
+	return length;
 }
 
 static void decoder_handle_desync(struct decoder *self)
 {
 	pulse_stream_reader_reset(&self->pulse_stream_reader);
-	pattern_buffer_clear(&self->pattern_buffer);
+	sync_recogniser_reset(&self->sync_recogniser);
+	sync_flywheel_reset(&self->sync_flywheel);
+	self->vertical_pending = false;
+	decoder_begin_acquisition(self);
 	decoder_reset_frame(self);
 }
 
+static void decoder_discard_prescan(struct decoder *self)
+{
+	self->prescan_count = 0;
+	self->prescan_index = 0;
+}
+
+/* Edges of (chunk) from a parallel scan, scanning ahead first if a backlog has built up */
+static const struct edge_list *decoder_prescanned_edges(struct decoder *self, struct buffer_chunk *chunk)
+{
+	struct edge_extractor *edge_extractor = &self->edge_extractor;
+	if (edge_extractor->thread_count <= 1) {
+		return NULL;
+	}
+	if (self->prescan_index < self->prescan_count && edge_extractor->lists[self->prescan_index].chunk == chunk) {
+		return &edge_extractor->lists[self->prescan_index++];
+	}
+	decoder_discard_prescan(self);
+	size_t backlog = 0;
+	for (struct buffer_chunk *it = chunk; it && backlog < decoder_prescan_min_chunks; it = it->next) {
+		backlog++;
+	}
+	if (backlog < decoder_prescan_min_chunks) {
+		return NULL;
+	}
+	self->prescan_count = edge_extractor_scan(edge_extractor, chunk);
+	self->prescan_index = 1;
+	return &edge_extractor->lists[0];
+}
+
 static void decoder_bind_chunk(struct decoder *self, struct buffer_chunk *chunk)
 {
 	self->current = chunk;
+	/* Any pulses still batched belong to the previous chunk */
+	self->pulse_batch_length = 0;
+	self->pulse_batch_index = 0;
 	if (!chunk) {
 		return;
 	}
@@ -241,7 +727,123 @@ static void decoder_bind_chunk(struct decoder *self, struct buffer_chunk *chunk)
 		decoder_handle_desync(self);
 	}
 	self->next_chunk_expected_offset = chunk->offset + chunk->length;
-	pulse_stream_reader_bind(&self->pulse_stream_reader, chunk);
+	const struct edge_list *edges = decoder_prescanned_edges(self, chunk);
+	if (edges) {
+		pulse_stream_reader_bind_edges(&self->pulse_stream_reader, edges);
+	} else {
+		pulse_stream_reader_bind(&self->pulse_stream_reader, chunk);
+	}
+}
+
+static uint64_t decoder_ns_to_fine(const struct decoder_config *config, uint32_t ns)
+{
+	return decoder_period_ns_to_fine(config->sample_period_ps, ns);
+}
+
+static void decoder_init_pulse_classifier(struct decoder *self)
+{
+	struct pulse_prototype prototypes[decoder_pulse_prototype_count];
+	decoder_pulse_prototypes(&self->config.timing, prototypes);
+	pulse_classifier_init(&self->pulse_classifier, prototypes, decoder_pulse_prototype_count, self->config.sample_period_ps);
+}
+
+static void decoder_tone_curve(const struct decoder_config *config, struct tone_curve *curve)
+{
+	curve->black_level = config->black_level;
+	curve->white_level = config->white_level;
+	curve->gamma = config->gamma;
+	curve->contrast = config->contrast;
+}
+
+static uint32_t decoder_decimation(uint32_t factor)
+{
+	return factor ? factor : 1;
+}
+
+/* The crop rectangle within the image that the output mode makes, clamped to it */
+static void decoder_clamp_crop(const struct decoder_config *config, struct decoder_crop *crop)
+{
+	const uint32_t width = config->timing.frame_width;
+	const uint32_t frame_height = decoder_frame_height(config);
+	const uint32_t height = decoder_one_field(config) && config->output != decoder_output_bob ? (frame_height + 1) / 2 : frame_height;
+	crop->left = config->crop.left < width ? config->crop.left : width - 1;
+	crop->top = config->crop.top < height ? config->crop.top : height - 1;
+	crop->width = config->crop.width && config->crop.width < width - crop->left ? config->crop.width : width - crop->left;
+	crop->height = config->crop.height && config->crop.height < height - crop->top ? config->crop.height : height - crop->top;
+}
+
+/* Where to find the colour burst, or false if colour is off or cannot be decoded */
+static bool decoder_chroma_config(const struct decoder_config *config, struct chroma_decoder_config *chroma)
+{
+	const struct video_timing *timing = &config->timing;
+	/* Lines start at the crop's left edge, so the burst is further before them by as much */
+	struct decoder_crop crop;
+	decoder_clamp_crop(config, &crop);
+	const uint32_t active_ns = timing->line_duration_ns - timing->horizontal_sync_low_ns - timing->back_porch_ns - timing->front_porch_ns;
+	const uint32_t crop_ns = (uint64_t) crop.left * active_ns / timing->frame_width;
+	*chroma = (struct chroma_decoder_config) {
+		.sample_period_ps = config->sample_period_ps,
+		.subcarrier_millihertz = timing->colour_subcarrier_millihertz,
+		.line_duration_ns = timing->line_duration_ns,
+		.burst_lead_ns = timing->horizontal_sync_low_ns + timing->back_porch_ns - timing->colour_burst_start_ns + crop_ns,
+		.burst_ns = timing->colour_burst_ns,
+		.black_level = config->black_level,
+		.white_level = config->white_level,
+	};
+	return config->colour && chroma_decoder_supported(chroma);
+}
+
+/* Free chunks before the current one, except those that lines still rendering, or the next, read from */
+static void decoder_release_chunks(struct decoder *self)
+{
+	struct buffer_chunk *keep = self->current;
+	/* The next line starts at the last pulse, which ended in this chunk, and may need the line before it */
+	offset_t next_first = keep->offset > self->line_samples_capacity ? keep->offset - self->line_samples_capacity : 0;
+	offset_t watermark = line_renderer_watermark(&self->line_renderer, next_first);
+	watermark = watermark < next_first ? watermark : next_first;
+	while (keep->prev && keep->prev->offset + keep->prev->length > watermark) {
+		keep = keep->prev;
+	}
+	buffer_delete_before(&self->buffer, keep);
+}
+
+/* Each smaller image half the size of the one before, from the full one of (width) columns */
+static void decoder_init_pyramid(struct decoder *self, uint32_t width)
+{
+	uint32_t *levels = &self->config.pyramid_levels;
+	*levels = *levels < decoder_max_pyramid_levels ? *levels : decoder_max_pyramid_levels;
+	uint32_t height = self->image_height;
+	for (uint32_t index = 0; index < *levels; index++) {
+		struct decoder_pyramid_level *level = &self->pyramid[index];
+		width = image_scaler_half(width);
+		height = image_scaler_half(height);
+		level->width = width;
+		level->height = height;
+		level->row_bytes = (size_t) width * self->image_components;
+		image_exchange_init(&level->images, level->row_bytes, height);
+		level->image = image_exchange_buffer(&level->images);
+		level->rows_made = 0;
+	}
+}
+
+/* Where each line of the frame goes: its own row of the field frame, a row of the image, or nowhere (-1) */
+static void decoder_map_rows(struct decoder *self)
+{
+	const struct decoder_config *config = &self->config;
+	const uint32_t frame_height = self->frame_height;
+	const int fields = config->output == decoder_output_bob || config->output == decoder_output_field ? 2 : 1;
+	self->frame_rows = malloc(frame_height * sizeof(*self->frame_rows));
+	for (uint32_t line = 0; line < frame_height; line++) {
+		self->frame_rows[line] = -1;
+	}
+	for (uint32_t row = 0; row < self->image_height; row++) {
+		for (int field = 0; field < fields; field++) {
+			uint32_t source = decoder_source_line(config, config->crop.top + row * config->vertical_decimation, field);
+			if (self->frame_rows[source] < 0) {
+				self->frame_rows[source] = self->field_frame ? (int32_t) source : (int32_t) row;
+			}
+		}
+	}
 }
 
 static bool decoder_overrun(struct decoder *self)
@@ -251,21 +853,129 @@ static bool decoder_overrun(struct decoder *self)
 	return buffered > limit;
 }
 
+/* Keep only the newest samples of a full push window, at its front */
+static void decoder_slide_push_window(struct decoder *self)
+{
+	struct buffer_chunk *window = self->push_window;
+	const size_t drop = window->length - self->push_history;
+	/* Lines may still be rendering from the samples about to move */
+	line_renderer_flush(&self->line_renderer);
+	memmove(window->data, &window->data[drop], self->push_history * sizeof(*window->data));
+	window->offset += drop;
+	window->length = self->push_history;
+	pulse_stream_reader_drop(&self->pulse_stream_reader, drop);
+}
+
 /******************************************************************************/
 
+void decoder_config_set_standard(struct decoder_config *config, const struct video_standard *standard)
+{
+	config->timing = standard->timing;
+	config->sync_patterns = standard->sync_patterns;
+	config->sync_pattern_count = standard->sync_pattern_count;
+	config->active_area = standard->active_area;
+}
+
+void decoder_image_size(const struct decoder_config *config, uint32_t *width, uint32_t *height)
+{
+	struct decoder_crop crop;
+	decoder_clamp_crop(config, &crop);
+	const uint32_t columns = decoder_decimation(config->horizontal_decimation);
+	const uint32_t rows = decoder_decimation(config->vertical_decimation);
+	*width = (crop.width + columns - 1) / columns;
+	*height = (crop.height + rows - 1) / rows;
+}
+
+uint32_t decoder_image_components(const struct decoder_config *config)
+{
+	struct chroma_decoder_config chroma;
+	return decoder_chroma_config(config, &chroma) ? 3 : 1;
+}
+
 void decoder_init(struct decoder *self, const struct decoder_config *config)
 {
 	log("Initialising decoder @ sample-rate = %.2fMHz", 1e6 / config->sample_period_ps);
 	self->config = *config;
+	if (!self->config.sync_patterns) {
+		self->config.sync_patterns = video_standard_pal_bg.sync_patterns;
+		self->config.sync_pattern_count = video_standard_pal_bg.sync_pattern_count;
+	}
+	if (!self->config.max_backlog_samples) {
+		const uint64_t frame_ps = 1000ull * config->timing.line_duration_ns * config->timing.frame_height;
+		self->config.max_backlog_samples = decoder_default_backlog_frames * frame_ps / config->sample_period_ps;
+	}
+	self->ops = decoder_select_ops(config);
+	log("Decoder implementation: %s", decoder_implementation(self));
+	self->back_porch_fine = decoder_ns_to_fine(config, config->timing.back_porch_ns);
+	self->front_porch_fine = decoder_ns_to_fine(config, config->timing.front_porch_ns);
+	self->horizontal_sync_fine = decoder_ns_to_fine(config, config->timing.horizontal_sync_low_ns);
+	sync_flywheel_init(&self->sync_flywheel, decoder_ns_to_fine(config, config->timing.line_duration_ns), decoder_ns_to_fine(config, config->timing.tolerance_ns));
+	decoder_init_pulse_classifier(self);
+	self->vertical_pending = false;
+	self->acquiring = false;
+	decoder_begin_acquisition(self);
+	self->acquire_min_run = decoder_ns_to_fine(config, config->timing.vertical_sync_low_ns - config->timing.tolerance_ns) >> pulse_fraction_bits;
+	self->acquire_rewind = decoder_ns_to_fine(config, decoder_acquire_rewind_lines * config->timing.line_duration_ns) >> pulse_fraction_bits;
 	pulse_analyser_init(&self->pulse_analyser, 0, pulse_right_aligned);
 	pulse_stream_reader_init(&self->pulse_stream_reader, &self->pulse_analyser, config->sync_threshold, false, 0);
-	self->frame = malloc(config->frame_width * config->frame_height);
+	struct chroma_decoder_config chroma;
+	bool colour = decoder_chroma_config(config, &chroma);
+	if (config->colour && !colour) {
+		log("Colour needs a PAL standard sampled at %dx its subcarrier or more, decoding grey", chroma_decoder_min_oversampling);
+	}
+	self->image_components = colour ? 3 : 1;
+	self->frame_height = decoder_frame_height(config);
+	uint32_t image_width;
+	decoder_image_size(config, &image_width, &self->image_height);
+	decoder_clamp_crop(config, &self->config.crop);
+	self->config.horizontal_decimation = decoder_decimation(config->horizontal_decimation);
+	self->config.vertical_decimation = decoder_decimation(config->vertical_decimation);
+	/* The columns emitted, as fractions of the active line, so that lines render no more than those */
+	self->crop_begin_ratio = ((uint64_t) self->config.crop.left << 32) / config->timing.frame_width;
+	self->crop_span_ratio = ((uint64_t) image_width * self->config.horizontal_decimation << 32) / config->timing.frame_width;
+	self->row_bytes = (size_t) image_width * self->image_components;
+	image_exchange_init(&self->images, self->row_bytes, self->image_height);
+	self->field_frame = decoder_field_rate(config) ? malloc(self->row_bytes * self->frame_height) : NULL;
+	self->frame = self->field_frame ? self->field_frame : image_exchange_buffer(&self->images);
+	decoder_map_rows(self);
+	decoder_init_pyramid(self, image_width);
+	self->line_valid_words = (self->frame_height + 63) / 64;
+	self->line_valid = calloc(self->line_valid_words, sizeof(*self->line_valid));
+	self->image = image_exchange_buffer(&self->images);
+	self->image_field = 0;
+	self->image_rows_published = 0;
+	self->slice_ready = false;
+	struct tone_curve tone_curve;
+	decoder_tone_curve(config, &tone_curve);
+	tone_map_init(&self->tone_map, &tone_curve);
+	/* Room for any line the flywheel would accept, with the resampler's margins, and for colour the line before */
+	self->line_samples_capacity = (colour ? 3 : 2) * (decoder_ns_to_fine(config, config->timing.line_duration_ns) >> pulse_fraction_bits);
+	line_renderer_init(&self->line_renderer, config->render_threads, config->pin_render_threads, image_width, config->resampler_kernel, &self->tone_map, colour ? &chroma : NULL, self->line_samples_capacity);
 	self->current = NULL;
 	self->next_chunk_expected_offset = 0;
+	/* A line with its margins (and the line before, for colour), and as much again for one coasted across a missing sync */
+	self->push_history = 2 * self->line_samples_capacity;
+	self->push_window = malloc(sizeof(*self->push_window) + (self->push_history + decoder_push_chunk_samples) * sizeof(*self->push_window->data));
+	self->push_window->prev = NULL;
+	self->push_window->next = NULL;
+	self->push_window->offset = 0;
+	self->push_window->length = 0;
+	self->pulse_batch_length = 0;
+	self->pulse_batch_index = 0;
+	edge_extractor_init(&self->edge_extractor, config->pulse_extraction_threads, config->sync_threshold, decoder_prescan_max_chunks);
+	decoder_discard_prescan(self);
+	self->frame_ready = false;
+	self->image_cut = false;
 	decoder_reset_frame(self);
 	buffer_init(&self->buffer);
-	pattern_buffer_init(&self->pattern_buffer, longest_sync_pattern_length);
+	sync_recogniser_init(&self->sync_recogniser, self->config.sync_patterns, self->config.sync_pattern_count);
 	decoder_reset_error_counters(self, NULL);
+	decoder_reset_stats(self, NULL);
+}
+
+const char *decoder_implementation(const struct decoder *self)
+{
+	return self->ops->standard ? self->ops->standard->description : "generic";
 }
 
 void decoder_bind_and_steal(struct decoder *self, struct buffer *new_data)
@@ -280,6 +990,9 @@ void decoder_bind_and_steal(struct decoder *self, struct buffer *new_data)
 	}
 	if (decoder_overrun(self)) {
 		self->errors.no_signal_or_overrun++;
+		/* Scanned chunks may be about to be freed, and lines may still be rendering from them */
+		decoder_discard_prescan(self);
+		line_renderer_flush(&self->line_renderer);
 		while (decoder_overrun(self)) {
 			buffer_delete_before_and_including(&self->buffer, self->buffer.tail);
 		}
@@ -289,10 +1002,22 @@ void decoder_bind_and_steal(struct decoder *self, struct buffer *new_data)
 
 void decoder_destroy(struct decoder *self)
 {
-	pattern_buffer_destroy(&self->pattern_buffer);
+	edge_extractor_destroy(&self->edge_extractor);
+	sync_recogniser_destroy(&self->sync_recogniser);
+	sync_flywheel_destroy(&self->sync_flywheel);
+	line_renderer_destroy(&self->line_renderer);
 	buffer_destroy(&self->buffer);
-	free(self->frame);
+	free(self->push_window);
+	image_exchange_destroy(&self->images);
+	for (uint32_t index = 0; index < self->config.pyramid_levels; index++) {
+		image_exchange_destroy(&self->pyramid[index].images);
+	}
+	free(self->field_frame);
+	free(self->frame_rows);
+	free(self->line_valid);
+	tone_map_destroy(&self->tone_map);
 	pulse_stream_reader_destroy(&self->pulse_stream_reader);
+	pulse_classifier_destroy(&self->pulse_classifier);
 	pulse_analyser_destroy(&self->pulse_analyser);
 }
 
@@ -304,27 +1029,225 @@ void decoder_reset_error_counters(struct decoder *self, struct decoder_errors *o
 		out->unrecognised_pulse_type += errors->unrecognised_pulse_type;
 		out->long_sync_pattern += errors->long_sync_pattern;
 		out->unrecognised_sync_pattern += errors->unrecognised_sync_pattern;
+		out->missing_horizontal_sync += errors->missing_horizontal_sync;
+		out->missing_vertical_sync += errors->missing_vertical_sync;
 	}
 	errors->no_signal_or_overrun = 0;
 	errors->unrecognised_pulse_type = 0;
 	errors->long_sync_pattern = 0;
 	errors->unrecognised_sync_pattern = 0;
+	errors->missing_horizontal_sync = 0;
+	errors->missing_vertical_sync = 0;
 }
 
-bool decoder_read_frame(struct decoder *self)
+void decoder_reset_stats(struct decoder *self, struct decoder_stats *out)
+{
+	struct decoder_stats *stats = &self->stats;
+	if (out) {
+		out->acquisitions += stats->acquisitions;
+		out->acquisition_ns_total += stats->acquisition_ns_total;
+		out->acquisition_ns_max = stats->acquisition_ns_max > out->acquisition_ns_max ? stats->acquisition_ns_max : out->acquisition_ns_max;
+		out->acquisition_samples_skipped += stats->acquisition_samples_skipped;
+		out->sync_cpu_ns += stats->sync_cpu_ns;
+		out->render_cpu_ns += stats->render_cpu_ns + line_renderer_take_cpu_ns(&self->line_renderer);
+	}
+	memset(stats, 0, sizeof(*stats));
+}
+
+/* Change the levels, contrast and gamma of lines rendered from now on */
+void decoder_set_tone_curve(struct decoder *self, const struct tone_curve *curve)
+{
+	self->config.black_level = curve->black_level;
+	self->config.white_level = curve->white_level;
+	self->config.gamma = curve->gamma;
+	self->config.contrast = curve->contrast;
+	line_renderer_flush(&self->line_renderer);
+	tone_map_set(&self->tone_map, curve);
+}
+
+void decoder_record_edges(struct decoder *self, struct edge_stream_writer *recorder)
+{
+	pulse_stream_reader_record(&self->pulse_stream_reader, recorder);
+}
+
+/*
+ * Process one pulse from a recorded edge stream rather than from the sample
+ * buffer.  Lines are not rendered (there are no samples), but sync
+ * classification and pattern matching run exactly as when decoding live.
+ * Returns true when the pulse completed a frame.
+ */
+bool decoder_replay_pulse(struct decoder *self, const struct pulse_info *pulse_info)
 {
+	char type;
 	self->frame_ready = false;
-	while (self->current) {
-		struct pulse_info pulse_info;
-		while (pulse_stream_reader_next(&self->pulse_stream_reader, &pulse_info)) {
-			decoder_process_pulse(self, &pulse_info);
-			buffer_delete_before(&self->buffer, self->current);
-			if (self->frame_ready) {
+	self->ops->classify_pulses(self, pulse_info, &type, 1);
+	decoder_process_pulse(self, pulse_info, type);
+	return self->frame_ready;
+}
+
+/* Types of (count) pulses, as decoding would find them, with no other effect */
+void decoder_classify_pulses(struct decoder *self, const struct pulse_info *pulses, char *types, size_t count)
+{
+	self->ops->classify_pulses(self, pulses, types, count);
+}
+
+void decoder_replay_desync(struct decoder *self)
+{
+	decoder_handle_desync(self);
+}
+
+static uint64_t decoder_thread_cpu_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * (uint64_t) 1000000000 + now.tv_nsec;
+}
+
+static bool decoder_decode_slice(struct decoder *self, struct decoder_slice *slice)
+{
+	/* A loss of sync on binding a chunk may have ended an image already */
+	self->frame_ready = self->image_cut;
+	self->slice_ready = false;
+	while (self->current && !self->frame_ready) {
+		if (self->pulse_batch_index == self->pulse_batch_length) {
+			/* Every pulse of the batch ended in the current chunk, so older chunks are no longer needed */
+			if (self->pulse_batch_length) {
+				decoder_release_chunks(self);
+			}
+			/* Search again unless part way through a vertical sync sequence */
+			if (self->acquiring && !self->vertical_pending) {
+				decoder_acquire(self);
+			}
+			if (!decoder_read_pulse_batch(self)) {
+				decoder_bind_chunk(self, self->current->next);
+				continue;
+			}
+		}
+		const struct pulse_info *batch = self->pulse_batch;
+		const char *types = self->pulse_batch_types;
+		size_t length = self->pulse_batch_length;
+		while (self->pulse_batch_index < length) {
+			size_t index = self->pulse_batch_index++;
+			decoder_process_pulse(self, &batch[index], types[index]);
+			if (self->frame_ready || self->slice_ready) {
 				goto done;
 			}
 		}
-		decoder_bind_chunk(self, self->current->next);
 	}
 done:
-	return self->frame_ready;
+	/* Lines still rendering write to the frame, and read from chunks that may go once we return */
+	line_renderer_flush(&self->line_renderer);
+	if (!self->frame_ready && !self->slice_ready) {
+		return false;
+	}
+	uint32_t first = self->image_rows_published;
+	uint32_t end = self->frame_ready ? self->image_height : first + self->slice_rows_ready;
+	uint8_t *image = image_exchange_buffer(&self->images);
+	decoder_compose_rows(self, image, first, end);
+	self->image = image;
+	decoder_make_pyramid(self, end, self->frame_ready);
+	slice->rows = &image[first * self->row_bytes];
+	slice->first_row = first;
+	slice->row_count = end - first;
+	slice->last = self->frame_ready;
+	if (self->frame_ready) {
+		/* The next image starts from its first row, whatever happened to this one */
+		self->image_cut = false;
+		uint8_t *next = image_exchange_complete(&self->images);
+		if (!self->field_frame) {
+			self->frame = next;
+			decoder_clear_line_valid(self);
+		}
+		self->image_rows_published = 0;
+		for (uint32_t index = 0; index < self->config.pyramid_levels; index++) {
+			image_exchange_complete(&self->pyramid[index].images);
+			self->pyramid[index].rows_made = 0;
+		}
+	} else {
+		image_exchange_publish(&self->images, end);
+		self->image_rows_published = end;
+		for (uint32_t index = 0; index < self->config.pyramid_levels; index++) {
+			image_exchange_publish(&self->pyramid[index].images, self->pyramid[index].rows_made);
+		}
+	}
+	return true;
+}
+
+/* Hand the rows of (slice) to the callbacks, and the image if it is complete */
+static void decoder_call_back(struct decoder *self, const struct decoder_slice *slice)
+{
+	const struct decoder_callbacks *callbacks = &self->config.callbacks;
+	if (callbacks->line) {
+		for (uint32_t row = 0; row < slice->row_count; row++) {
+			callbacks->line(callbacks->context, slice->first_row + row, &slice->rows[row * self->row_bytes]);
+		}
+	}
+	if (!slice->last) {
+		return;
+	}
+	if (decoder_one_field(&self->config)) {
+		if (callbacks->field) {
+			callbacks->field(callbacks->context, self->image, self->image_field);
+		}
+	} else if (callbacks->frame) {
+		callbacks->frame(callbacks->context, self->image);
+	}
+}
+
+bool decoder_read_slice(struct decoder *self, struct decoder_slice *slice)
+{
+	uint64_t start_ns = decoder_thread_cpu_ns();
+	bool ready = decoder_decode_slice(self, slice);
+	self->stats.sync_cpu_ns += decoder_thread_cpu_ns() - start_ns;
+	return ready;
+}
+
+bool decoder_read_frame(struct decoder *self)
+{
+	struct decoder_slice slice;
+	while (decoder_read_slice(self, &slice)) {
+		if (slice.last) {
+			return true;
+		}
+	}
+	return false;
+}
+
+void decoder_push(struct decoder *self, const sample_t *samples, size_t count)
+{
+	struct buffer_chunk *window = self->push_window;
+	const size_t capacity = self->push_history + decoder_push_chunk_samples;
+	while (count) {
+		if (window->length == capacity) {
+			decoder_slide_push_window(self);
+		}
+		const size_t room = capacity - window->length;
+		const size_t length = count < room ? count : room;
+		memcpy(&window->data[window->length], samples, length * sizeof(*samples));
+		samples += length;
+		count -= length;
+		/* Every sample before was read, so the reader carries on from where it stopped */
+		if (!window->length) {
+			window->offset = self->next_chunk_expected_offset;
+			window->length = length;
+			decoder_bind_chunk(self, window);
+		} else {
+			window->length += length;
+			self->next_chunk_expected_offset += length;
+			self->current = window;
+		}
+		struct decoder_slice slice;
+		while (decoder_read_slice(self, &slice)) {
+			decoder_call_back(self, &slice);
+		}
+	}
+}
+
+/* No more images will come, in full or smaller, so their consumers can finish */
+void decoder_close_images(struct decoder *self)
+{
+	image_exchange_close(&self->images);
+	for (uint32_t index = 0; index < self->config.pyramid_levels; index++) {
+		image_exchange_close(&self->pyramid[index].images);
+	}
 }
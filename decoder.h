@@ -2,59 +2,273 @@
 #include "stdinc.h"
 #include "buffer.h"
 #include "pulse_width.h"
-#include "pattern_buffer.h"
+#include "pulse_classifier.h"
+#include "sync_pattern.h"
+#include "sync_flywheel.h"
+#include "edge_extractor.h"
+#include "image_exchange.h"
+#include "line_renderer.h"
+#include "tone_map.h"
+#include "video_standard.h"
+
+enum
+{
+	/* Comfortably more than the pulses in one scope chunk */
+	decoder_pulse_batch_capacity = 256,
+	/* Backlog (in chunks) at which edge extraction is spread over threads */
+	decoder_prescan_min_chunks = 4,
+	decoder_prescan_max_chunks = 64,
+	/* Lines before the expected vertical sync at which edge gating stops */
+	decoder_gate_margin_lines = 4,
+	/* Gate window either side of each predicted horizontal sync, in multiples of the timing tolerance */
+	decoder_gate_window_tolerances = 4,
+	/* Smaller images that can be made alongside the full one, at 1/2 and 1/4 of its size */
+	decoder_max_pyramid_levels = 2,
+	/* Lines before a broad pulse found while acquiring sync at which decoding resumes */
+	decoder_acquire_rewind_lines = 4,
+	/* Room in decoder_push's window for new samples past the history it keeps, and so most copied in before decoding them */
+	decoder_push_chunk_samples = 16384,
+	/* Frames of samples left waiting to be decoded before an overrun, when the config leaves it to the decoder */
+	decoder_default_backlog_frames = 3,
+};
+
+/* What decoder_read_frame emits for interlaced video, and when */
+enum decoder_output
+{
+	/* Whole frames, once both fields are in */
+	decoder_output_frame = 0,
+	/* Whole frames after every field, the newest woven with the one before */
+	decoder_output_weave,
+	/* Every field, line-doubled to full height */
+	decoder_output_bob,
+	/* Every field alone, at half height */
+	decoder_output_field,
+	/* The first field of each frame alone, at half height, leaving the other unrendered */
+	decoder_output_single_field,
+};
+
+/* Part of the image that the output mode makes, in its columns and rows */
+struct decoder_crop
+{
+	uint32_t left;
+	uint32_t top;
+	/* Zero for the rest of the image */
+	uint32_t width;
+	uint32_t height;
+};
+
+/* Called by decoder_push as the image is made, with (context); any may be NULL */
+struct decoder_callbacks
+{
+	void *context;
+	/* Each row of the image once complete, in order, as slice_rows of them are ready (or the image is) */
+	void (*line)(void *context, uint32_t row, const uint8_t *pixels);
+	/* Each image complete, made of one (field) in the modes that make those, or else of a whole frame */
+	void (*field)(void *context, const uint8_t *image, int field);
+	void (*frame)(void *context, const uint8_t *image);
+};
 
 struct decoder_config
 {
 	uint32_t sample_period_ps;
-	bool interlaced;
-	uint32_t frame_width;
-	uint32_t frame_height;
 	sample_t sync_threshold;
 	sample_t black_level;
 	sample_t white_level;
+	/* Tone curve applied between the black and white levels, zero for linear */
+	float gamma;
+	float contrast;
+	/* Samples waiting to be decoded beyond which the oldest are dropped as an overrun, over two frames' worth; zero for decoder_default_backlog_frames */
 	size_t max_backlog_samples;
-	uint32_t sync_duration_ns;
-	uint32_t line_duration_ns;
-	uint32_t equaliser_low_ns;
-	uint32_t vertical_sync_low_ns;
-	uint32_t horizontal_sync_low_ns;
-	uint32_t front_porch_ns;
-	uint32_t back_porch_ns;
-	uint32_t tolerance_ns;
+	/* Timing, geometry and sync sequences, usually from a video_standard */
+	struct video_timing timing;
+	const struct sync_pattern *sync_patterns;
+	size_t sync_pattern_count;
+	/* Lines rendered, leaving out vertical blanking, zero height for every line */
+	struct video_active_area active_area;
+	/* Use code specialised for the standard and sample rate, if both match one that has it */
+	bool specialise;
+	/* Threads for scanning backlogged chunks in parallel, <= 1 to disable */
+	uint32_t pulse_extraction_threads;
+	/* Track line and field timing to coast through missing syncs and gate edge detection */
+	bool flywheel;
+	/* Interpolation between samples when resampling lines to the frame width */
+	enum line_resampler_kernel resampler_kernel;
+	/* Threads decoding, one finding syncs and the rest rendering lines, <= 1 to render inline */
+	uint32_t render_threads;
+	/* Keep each render thread to a core of its own, of those the process may use */
+	bool pin_render_threads;
+	enum decoder_output output;
+	/* Rows per slice that decoder_read_slice publishes before an image is complete, zero for whole images */
+	uint32_t slice_rows;
+	/* Decode PAL colour into images of interleaved Y, Cb and Cr, where the standard and sample rate allow */
+	bool colour;
+	/* Emit only this part of the image, with 1/n of its columns and every nth row (0 or 1 for all) */
+	struct decoder_crop crop;
+	uint32_t horizontal_decimation;
+	uint32_t vertical_decimation;
+	/* Also make this many images, each half the width and height of the one before (up to decoder_max_pyramid_levels) */
+	uint32_t pyramid_levels;
+	struct decoder_callbacks callbacks;
+};
+
+/* Rows of the image being made, complete and in order from its first row */
+struct decoder_slice
+{
+	const uint8_t *rows;
+	uint32_t first_row;
+	uint32_t row_count;
+	/* The image is complete with these rows */
+	bool last;
+};
+
+/* An image at a fraction of the full size, halved from the one above it as that one's rows are composed */
+struct decoder_pyramid_level
+{
+	/* Handed out in place, as the full images are; image is the one emitted when frame_ready */
+	struct image_exchange images;
+	const uint8_t *image;
+	uint32_t width;
+	uint32_t height;
+	size_t row_bytes;
+	/* Rows of the image being made that are done */
+	uint32_t rows_made;
 };
 
+struct decoder_ops;
+
 struct decoder_errors
 {
 	uint64_t no_signal_or_overrun;
 	uint64_t unrecognised_pulse_type;
 	uint64_t long_sync_pattern;
 	uint64_t unrecognised_sync_pattern;
+	/* Syncs that the flywheel stood in for */
+	uint64_t missing_horizontal_sync;
+	uint64_t missing_vertical_sync;
+};
+
+struct decoder_stats
+{
+	/* Vertical sync acquisitions completed, at start-up or after losing sync */
+	uint64_t acquisitions;
+	/* Signal time from losing sync until a vertical sync was recognised */
+	uint64_t acquisition_ns_total;
+	uint64_t acquisition_ns_max;
+	/* Samples passed over by the search without being decoded */
+	uint64_t acquisition_samples_skipped;
+	/* CPU time of the thread decoding, and of the threads rendering lines apart from it */
+	uint64_t sync_cpu_ns;
+	uint64_t render_cpu_ns;
 };
 
 struct decoder
 {
 	/* Configuration */
 	struct decoder_config config;
+	const struct decoder_ops *ops;
+	uint64_t back_porch_fine;
+	uint64_t front_porch_fine;
+	uint64_t horizontal_sync_fine;
 	/* Sample buffer */
 	struct buffer buffer;
 	struct buffer_chunk *current;
 	offset_t next_chunk_expected_offset;
+	/* Samples given to decoder_push, allocated once; the newest (push_history) move to the front when it fills */
+	struct buffer_chunk *push_window;
+	size_t push_history;
 	/* Pulse decoder state */
 	struct pulse_analyser pulse_analyser;
 	struct pulse_stream_reader pulse_stream_reader;
+	struct pulse_classifier pulse_classifier;
+	struct pulse_info pulse_batch[decoder_pulse_batch_capacity];
+	char pulse_batch_types[decoder_pulse_batch_capacity];
+	size_t pulse_batch_length;
+	size_t pulse_batch_index;
+	/* Parallel edge extraction of backlogged chunks */
+	struct edge_extractor edge_extractor;
+	size_t prescan_count;
+	size_t prescan_index;
 	/* PAL decoder state */
-	struct pattern_buffer pattern_buffer;
-	/* Image buffer */
+	struct sync_recogniser sync_recogniser;
+	struct sync_flywheel sync_flywheel;
+	/* Non-horizontal pulses seen since the last line, without a recognised vertical sync */
+	bool vertical_pending;
+	/* Searching for a vertical sync, rendering nothing until one is found */
+	bool acquiring;
+	bool acquire_started;
+	uint64_t acquire_start_fine;
+	size_t acquire_min_run;
+	size_t acquire_rewind;
+	/* Line rendering */
+	struct line_renderer line_renderer;
+	struct tone_map tone_map;
+	size_t line_samples_capacity;
+	/* Bytes per pixel of the frame and images: 1 for grey, 3 for colour */
+	uint32_t image_components;
+	/* Bytes per row of the frame and images, which hold only the columns emitted */
+	size_t row_bytes;
+	/* Emitted columns' start and span within the active line, in 2^-32 of it */
+	uint64_t crop_begin_ratio;
+	uint64_t crop_span_ratio;
+	/* Row of the frame buffer that each line of the frame renders to, or -1 where it is not emitted */
+	int32_t *frame_rows;
+	/* Lines of the frame, those of the active area, and those of this field still to pass over before it */
+	uint32_t frame_height;
+	uint32_t blanking_lines;
+	/* Image buffer: in frame rate modes the image being written, else the frame woven from fields in field_frame */
 	uint32_t next_line;
 	uint8_t *frame;
+	uint8_t *field_frame;
+	/* Rows of the frame rendered since it was started afresh, a bit each, instead of clearing it */
+	uint64_t *line_valid;
+	size_t line_valid_words;
 	bool frame_ready;
-	/* Error counters */
+	/* The image being made in place was ended early by a loss of sync, to be handed out next */
+	bool image_cut;
+	/* Images handed out in place; image is the one emitted when frame_ready */
+	struct image_exchange images;
+	const uint8_t *image;
+	uint32_t image_height;
+	int image_field;
+	/* Rows of the image handed out so far, and how many more are ready when slice_ready */
+	uint32_t image_rows_published;
+	bool slice_ready;
+	uint32_t slice_rows_ready;
+	/* Smaller images, made in the same pass */
+	struct decoder_pyramid_level pyramid[decoder_max_pyramid_levels];
+	/* Error counters and statistics */
 	struct decoder_errors errors;
+	struct decoder_stats stats;
 };
 
+void decoder_config_set_standard(struct decoder_config *config, const struct video_standard *standard);
+void decoder_image_size(const struct decoder_config *config, uint32_t *width, uint32_t *height);
+uint32_t decoder_image_components(const struct decoder_config *config);
 void decoder_init(struct decoder *self, const struct decoder_config *config);
+const char *decoder_implementation(const struct decoder *self);
 void decoder_bind_and_steal(struct decoder *self, struct buffer *new_data);
+/*
+ * Decode until config.slice_rows more rows of the image are complete, or the
+ * image is.  An image's slices run from its first row to its last, and rows
+ * handed out are not written again.  If sync is lost part way through, an
+ * image made in place (at frame rate) ends there, the rows not yet rendered
+ * black; in the other modes the rows after come from a later frame.
+ */
+bool decoder_read_slice(struct decoder *self, struct decoder_slice *slice);
 bool decoder_read_frame(struct decoder *self);
+/*
+ * Decode (count) more samples, following on from those pushed before, and
+ * call back with the rows and images they complete.  The samples are copied
+ * into a window of fixed size, so nothing is allocated; pushing does not mix
+ * with decoder_bind_and_steal.
+ */
+void decoder_push(struct decoder *self, const sample_t *samples, size_t count);
+void decoder_close_images(struct decoder *self);
 void decoder_reset_error_counters(struct decoder *self, struct decoder_errors *out);
+void decoder_reset_stats(struct decoder *self, struct decoder_stats *out);
+void decoder_set_tone_curve(struct decoder *self, const struct tone_curve *curve);
+void decoder_record_edges(struct decoder *self, struct edge_stream_writer *recorder);
+bool decoder_replay_pulse(struct decoder *self, const struct pulse_info *pulse_info);
+void decoder_replay_desync(struct decoder *self);
+void decoder_classify_pulses(struct decoder *self, const struct pulse_info *pulses, char *types, size_t count);
 void decoder_destroy(struct decoder *self);
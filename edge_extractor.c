@@ -0,0 +1,127 @@
+#include "edge_extractor.h"
+#include "errors.h"
+#include "pulse_width.h"
+
+static void edge_list_push(struct edge_list *self, uint64_t fine_offset, bool state)
+{
+	if (self->length == self->capacity) {
+		self->capacity = self->capacity ? self->capacity * 2 : 256;
+		self->edges = realloc(self->edges, self->capacity * sizeof(*self->edges));
+	}
+	struct edge *edge = &self->edges[self->length++];
+	edge->fine_offset = fine_offset;
+	edge->state = state;
+}
+
+static void edge_list_scan(struct edge_list *self, sample_t threshold)
+{
+	struct buffer_chunk *chunk = self->chunk;
+	const sample_t *data = chunk->data;
+	size_t length = chunk->length;
+	self->length = 0;
+	if (!length) {
+		return;
+	}
+	self->first_sample = data[0];
+	self->last_sample = data[length - 1];
+	bool previous_state = data[0] >= threshold;
+	for (size_t index = 1; index < length; index++) {
+		bool state = data[index] >= threshold;
+		if (state == previous_state) {
+			continue;
+		}
+		previous_state = state;
+		edge_list_push(self, pulse_interpolate_crossing(threshold, data[index - 1], data[index], chunk->offset + index), state);
+	}
+}
+
+/* Call with mutex held, returns with mutex held */
+static void edge_extractor_work(struct edge_extractor *self)
+{
+	while (self->next_list < self->list_count) {
+		struct edge_list *list = &self->lists[self->next_list++];
+		pthread_mutex_unlock(&self->mutex);
+		edge_list_scan(list, self->threshold);
+		pthread_mutex_lock(&self->mutex);
+		if (++self->lists_done == self->list_count) {
+			pthread_cond_signal(&self->done_cond);
+		}
+	}
+}
+
+static void *edge_extractor_worker(void *arg)
+{
+	struct edge_extractor *self = arg;
+	pthread_setname_np(pthread_self(), "Edge extractor");
+	pthread_mutex_lock(&self->mutex);
+	while (!self->ending) {
+		edge_extractor_work(self);
+		pthread_cond_wait(&self->work_cond, &self->mutex);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	return NULL;
+}
+
+/******************************************************************************/
+
+void edge_extractor_init(struct edge_extractor *self, uint32_t thread_count, sample_t threshold, size_t list_capacity)
+{
+	self->threshold = threshold;
+	self->thread_count = thread_count ? thread_count : 1;
+	self->ending = false;
+	self->lists = calloc(list_capacity, sizeof(*self->lists));
+	self->list_capacity = list_capacity;
+	self->list_count = 0;
+	self->next_list = 0;
+	self->lists_done = 0;
+	pthread_mutex_init(&self->mutex, NULL);
+	pthread_cond_init(&self->work_cond, NULL);
+	pthread_cond_init(&self->done_cond, NULL);
+	self->threads = calloc(self->thread_count - 1, sizeof(*self->threads));
+	for (uint32_t index = 0; index + 1 < self->thread_count; index++) {
+		assert_equal(0, pthread_create(&self->threads[index], NULL, edge_extractor_worker, self));
+	}
+}
+
+/*
+ * Scan up to list_capacity consecutive chunks starting at (first), fanning
+ * the chunks out over the worker threads.  Returns the number of chunks
+ * scanned, whose edge lists are then in self->lists, in order.
+ */
+size_t edge_extractor_scan(struct edge_extractor *self, struct buffer_chunk *first)
+{
+	pthread_mutex_lock(&self->mutex);
+	size_t count = 0;
+	for (struct buffer_chunk *chunk = first; chunk && count < self->list_capacity; chunk = chunk->next) {
+		self->lists[count++].chunk = chunk;
+	}
+	self->list_count = count;
+	self->next_list = 0;
+	self->lists_done = 0;
+	pthread_cond_broadcast(&self->work_cond);
+	edge_extractor_work(self);
+	while (self->lists_done < self->list_count) {
+		pthread_cond_wait(&self->done_cond, &self->mutex);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	return count;
+}
+
+void edge_extractor_destroy(struct edge_extractor *self)
+{
+	pthread_mutex_lock(&self->mutex);
+	self->ending = true;
+	pthread_cond_broadcast(&self->work_cond);
+	pthread_mutex_unlock(&self->mutex);
+	for (uint32_t index = 0; index + 1 < self->thread_count; index++) {
+		pthread_join(self->threads[index], NULL);
+	}
+	free(self->threads);
+	for (size_t index = 0; index < self->list_capacity; index++) {
+		free(self->lists[index].edges);
+	}
+	free(self->lists);
+	pthread_cond_destroy(&self->done_cond);
+	pthread_cond_destroy(&self->work_cond);
+	pthread_mutex_destroy(&self->mutex);
+}
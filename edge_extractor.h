@@ -0,0 +1,48 @@
+#pragma once
+#include "stdinc.h"
+#include "buffer.h"
+
+#include <pthread.h>
+
+struct edge
+{
+	uint64_t fine_offset;
+	bool state;
+};
+
+/*
+ * Threshold crossings between samples of one chunk.  The crossing between a
+ * chunk and its predecessor is not included, it is recovered when stitching
+ * from the boundary samples.
+ */
+struct edge_list
+{
+	struct buffer_chunk *chunk;
+	sample_t first_sample;
+	sample_t last_sample;
+	struct edge *edges;
+	size_t length;
+	size_t capacity;
+};
+
+struct edge_extractor
+{
+	sample_t threshold;
+	/* Including the calling thread */
+	uint32_t thread_count;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t done_cond;
+	bool ending;
+	/* Current scan */
+	struct edge_list *lists;
+	size_t list_capacity;
+	size_t list_count;
+	size_t next_list;
+	size_t lists_done;
+};
+
+void edge_extractor_init(struct edge_extractor *self, uint32_t thread_count, sample_t threshold, size_t list_capacity);
+size_t edge_extractor_scan(struct edge_extractor *self, struct buffer_chunk *first);
+void edge_extractor_destroy(struct edge_extractor *self);
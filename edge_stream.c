@@ -0,0 +1,172 @@
+#include "edge_stream.h"
+#include "pulse_width.h"
+
+static const char edge_stream_magic[4] = { 'E', 'D', 'G', 'S' };
+
+enum
+{
+	/* Longest LEB128 encoding of a 64-bit value */
+	varint_max_length = 10,
+};
+
+static uint8_t *edge_stream_put(uint8_t *out, uint64_t value, size_t bytes)
+{
+	for (size_t index = 0; index < bytes; index++) {
+		*out++ = value >> (8 * index);
+	}
+	return out;
+}
+
+static const uint8_t *edge_stream_get(const uint8_t *in, uint64_t *value, size_t bytes)
+{
+	*value = 0;
+	for (size_t index = 0; index < bytes; index++) {
+		*value |= (uint64_t) *in++ << (8 * index);
+	}
+	return in;
+}
+
+/* Where deltas count from after a reset to sample (offset) */
+static uint64_t edge_stream_reset_base(uint64_t offset)
+{
+	return (offset - 1) << pulse_fraction_bits;
+}
+
+static inline void edge_stream_writer_varint(struct edge_stream_writer *self, uint64_t value)
+{
+	if (self->length + varint_max_length > sizeof(self->buffer)) {
+		edge_stream_writer_flush(self);
+	}
+	uint8_t *out = &self->buffer[self->length];
+	while (value >= 0x80) {
+		*out++ = (value & 0x7f) | 0x80;
+		value >>= 7;
+	}
+	*out++ = value;
+	self->length = out - self->buffer;
+}
+
+static bool edge_stream_reader_varint(struct edge_stream_reader *self, uint64_t *value, bool *eof)
+{
+	uint64_t result = 0;
+	for (unsigned shift = 0; shift < 64; shift += 7) {
+		int byte = getc_unlocked(self->source);
+		if (byte == EOF) {
+			*eof = shift == 0;
+			return false;
+		}
+		result |= (uint64_t) (byte & 0x7f) << shift;
+		if (!(byte & 0x80)) {
+			*value = result;
+			return true;
+		}
+	}
+	*eof = false;
+	return false;
+}
+
+/******************************************************************************/
+
+void edge_stream_writer_init(struct edge_stream_writer *self, FILE *sink, uint32_t sample_period_ps, int32_t threshold)
+{
+	self->sink = sink;
+	self->previous_fine_offset = 0;
+	self->length = 0;
+	struct edge_stream_header header = {
+		.version = edge_stream_version,
+		.fraction_bits = pulse_fraction_bits,
+		.sample_period_ps = sample_period_ps,
+		.threshold = threshold,
+	};
+	memcpy(header.magic, edge_stream_magic, sizeof(header.magic));
+	uint8_t *out = self->buffer;
+	memcpy(out, header.magic, sizeof(header.magic));
+	out += sizeof(header.magic);
+	out = edge_stream_put(out, header.version, sizeof(header.version));
+	out = edge_stream_put(out, header.fraction_bits, sizeof(header.fraction_bits));
+	out = edge_stream_put(out, header.reserved, sizeof(header.reserved));
+	out = edge_stream_put(out, header.sample_period_ps, sizeof(header.sample_period_ps));
+	out = edge_stream_put(out, (uint32_t) header.threshold, sizeof(header.threshold));
+	self->length = out - self->buffer;
+}
+
+void edge_stream_writer_edge(struct edge_stream_writer *self, uint64_t fine_offset, bool state)
+{
+	uint64_t delta = fine_offset - self->previous_fine_offset;
+	self->previous_fine_offset = fine_offset;
+	edge_stream_writer_varint(self, delta << 1 | state);
+}
+
+void edge_stream_writer_reset(struct edge_stream_writer *self, uint64_t offset)
+{
+	self->previous_fine_offset = edge_stream_reset_base(offset);
+	edge_stream_writer_varint(self, 0);
+	edge_stream_writer_varint(self, offset);
+}
+
+bool edge_stream_writer_flush(struct edge_stream_writer *self)
+{
+	bool result = fwrite(self->buffer, 1, self->length, self->sink) == self->length;
+	self->length = 0;
+	return result;
+}
+
+void edge_stream_writer_destroy(struct edge_stream_writer *self)
+{
+	edge_stream_writer_flush(self);
+	fflush(self->sink);
+}
+
+bool edge_stream_reader_init(struct edge_stream_reader *self, FILE *source)
+{
+	self->source = source;
+	self->previous_fine_offset = 0;
+	uint8_t header[edge_stream_header_size];
+	if (fread(header, sizeof(header), 1, source) != 1) {
+		return false;
+	}
+	const uint8_t *in = header;
+	uint64_t value;
+	memcpy(self->header.magic, in, sizeof(self->header.magic));
+	in += sizeof(self->header.magic);
+	in = edge_stream_get(in, &value, sizeof(self->header.version));
+	self->header.version = value;
+	in = edge_stream_get(in, &value, sizeof(self->header.fraction_bits));
+	self->header.fraction_bits = value;
+	in = edge_stream_get(in, &value, sizeof(self->header.reserved));
+	self->header.reserved = value;
+	in = edge_stream_get(in, &value, sizeof(self->header.sample_period_ps));
+	self->header.sample_period_ps = value;
+	edge_stream_get(in, &value, sizeof(self->header.threshold));
+	self->header.threshold = (int32_t) (uint32_t) value;
+	return memcmp(self->header.magic, edge_stream_magic, sizeof(edge_stream_magic)) == 0 &&
+		self->header.version == edge_stream_version &&
+		self->header.fraction_bits == pulse_fraction_bits;
+}
+
+/* For edges, (offset) is the fixed-point edge time; for resets, the new sample offset */
+enum edge_stream_record edge_stream_reader_next(struct edge_stream_reader *self, uint64_t *offset, bool *state)
+{
+	uint64_t value;
+	bool eof;
+	if (!edge_stream_reader_varint(self, &value, &eof)) {
+		return eof ? edge_stream_record_end : edge_stream_record_error;
+	}
+	if (value == 0) {
+		if (!edge_stream_reader_varint(self, &value, &eof)) {
+			return edge_stream_record_error;
+		}
+		self->previous_fine_offset = edge_stream_reset_base(value);
+		*offset = value;
+		return edge_stream_record_reset;
+	}
+	self->previous_fine_offset += value >> 1;
+	*offset = self->previous_fine_offset;
+	*state = value & 1;
+	return edge_stream_record_edge;
+}
+
+void edge_stream_reader_destroy(struct edge_stream_reader *self)
+{
+	(void) self;
+}
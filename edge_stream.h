@@ -0,0 +1,65 @@
+#pragma once
+#include "stdinc.h"
+
+/*
+ * Compact binary record of sync edges.  After a fixed header, each record is
+ * an unsigned LEB128 varint holding (delta << 1 | state), where delta is the
+ * fixed-point distance from the previous edge.  Edges are strictly increasing
+ * so a zero delta never occurs for real edges: a zero varint instead marks a
+ * reset of the edge stream, and is followed by a varint of the new absolute
+ * sample offset.  The first crossing after a reset can be interpolated to
+ * just before its sample, so deltas from a reset count from the sample
+ * before.
+ *
+ * The header is stored as its fields in order, little-endian and unpadded.
+ */
+
+enum
+{
+	edge_stream_version = 2,
+	edge_stream_header_size = 16,
+	edge_stream_buffer_size = 65536,
+};
+
+struct edge_stream_header
+{
+	char magic[4];
+	uint8_t version;
+	uint8_t fraction_bits;
+	uint16_t reserved;
+	uint32_t sample_period_ps;
+	int32_t threshold;
+};
+
+enum edge_stream_record
+{
+	edge_stream_record_end,
+	edge_stream_record_edge,
+	edge_stream_record_reset,
+	edge_stream_record_error,
+};
+
+struct edge_stream_writer
+{
+	FILE *sink;
+	uint64_t previous_fine_offset;
+	size_t length;
+	uint8_t buffer[edge_stream_buffer_size];
+};
+
+struct edge_stream_reader
+{
+	FILE *source;
+	struct edge_stream_header header;
+	uint64_t previous_fine_offset;
+};
+
+void edge_stream_writer_init(struct edge_stream_writer *self, FILE *sink, uint32_t sample_period_ps, int32_t threshold);
+void edge_stream_writer_edge(struct edge_stream_writer *self, uint64_t fine_offset, bool state);
+void edge_stream_writer_reset(struct edge_stream_writer *self, uint64_t offset);
+bool edge_stream_writer_flush(struct edge_stream_writer *self);
+void edge_stream_writer_destroy(struct edge_stream_writer *self);
+
+bool edge_stream_reader_init(struct edge_stream_reader *self, FILE *source);
+enum edge_stream_record edge_stream_reader_next(struct edge_stream_reader *self, uint64_t *offset, bool *state);
+void edge_stream_reader_destroy(struct edge_stream_reader *self);
@@ -1,6 +1,6 @@
 #pragma once
 
-__attribute__((__format__(__printf__, 4, 5)))
+__attribute__((__format__(__printf__, 4, 5), __noreturn__))
 void _fatal_error(const char *file, int line, const char *func, const char *format, ...);
 #define fatal_error(format, ...) \
 	_fatal_error(__FILE__, __LINE__, __func__, format, ##__VA_ARGS__)
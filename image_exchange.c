@@ -0,0 +1,148 @@
+#include "image_exchange.h"
+#include <time.h>
+
+static uint64_t image_exchange_now_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_MONOTONIC, &now);
+	return now.tv_sec * (uint64_t) 1000000000 + now.tv_nsec;
+}
+
+/* Take the newest image not yet read, complete or being written, if there is one */
+static bool image_exchange_start_reading(struct image_exchange *self)
+{
+	if (self->complete >= 0 && self->complete_image >= self->next_image) {
+		self->reading = self->complete;
+		self->reading_image = self->complete_image;
+	} else if (self->writing_image >= self->next_image && self->writing_rows) {
+		self->reading = self->writing;
+		self->reading_image = self->writing_image;
+	} else {
+		return false;
+	}
+	self->reading_rows = 0;
+	return true;
+}
+
+/******************************************************************************/
+
+void image_exchange_init(struct image_exchange *self, size_t row_bytes, uint32_t height)
+{
+	for (size_t index = 0; index < image_exchange_buffers; index++) {
+		self->buffers[index] = calloc(height, row_bytes);
+		self->completed_ns[index] = 0;
+	}
+	self->row_bytes = row_bytes;
+	self->height = height;
+	pthread_mutex_init(&self->mutex, NULL);
+	pthread_cond_init(&self->cond, NULL);
+	self->closed = false;
+	self->writing = 0;
+	self->writing_image = 0;
+	self->writing_rows = 0;
+	self->complete = -1;
+	self->complete_image = 0;
+	self->reading = -1;
+	self->reading_image = 0;
+	self->reading_rows = 0;
+	self->next_image = 0;
+	self->dropped = 0;
+}
+
+/* Buffer to write the current image to, which only the producer may call for */
+uint8_t *image_exchange_buffer(struct image_exchange *self)
+{
+	return self->buffers[self->writing];
+}
+
+/* The first (rows) rows of the current image are written */
+void image_exchange_publish(struct image_exchange *self, uint32_t rows)
+{
+	pthread_mutex_lock(&self->mutex);
+	self->writing_rows = rows;
+	pthread_cond_signal(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+}
+
+/* The current image is written, returns the buffer to write the next to */
+uint8_t *image_exchange_complete(struct image_exchange *self)
+{
+	uint64_t now = image_exchange_now_ns();
+	pthread_mutex_lock(&self->mutex);
+	if (self->complete >= 0 && self->complete_image >= self->next_image && self->complete != self->reading) {
+		self->dropped++;
+	}
+	self->complete = self->writing;
+	self->complete_image = self->writing_image;
+	self->completed_ns[self->writing] = now;
+	/* Of three buffers, at least one is neither just completed nor being read */
+	int next = 0;
+	while (next == self->complete || next == self->reading) {
+		next++;
+	}
+	self->writing = next;
+	self->writing_image++;
+	self->writing_rows = 0;
+	pthread_cond_signal(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+	return self->buffers[next];
+}
+
+/*
+ * Wait for rows of an image after those last read, moving on to the newest
+ * image once the last is read in full.  Returns false once closed.
+ */
+bool image_exchange_read(struct image_exchange *self, struct image_exchange_slice *slice)
+{
+	pthread_mutex_lock(&self->mutex);
+	if (self->reading >= 0 && self->reading_rows == self->height) {
+		self->next_image = self->reading_image + 1;
+		self->reading = -1;
+	}
+	while (!self->closed) {
+		if (self->reading >= 0 || image_exchange_start_reading(self)) {
+			uint32_t available = self->reading_image == self->writing_image ? self->writing_rows : self->height;
+			if (available > self->reading_rows) {
+				slice->image = self->reading_image;
+				slice->rows = &self->buffers[self->reading][self->reading_rows * self->row_bytes];
+				slice->first_row = self->reading_rows;
+				slice->row_count = available - self->reading_rows;
+				slice->last = available == self->height;
+				slice->completed_ns = self->completed_ns[self->reading];
+				self->reading_rows = available;
+				pthread_mutex_unlock(&self->mutex);
+				return true;
+			}
+		}
+		pthread_cond_wait(&self->cond, &self->mutex);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	return false;
+}
+
+/* Images completed but never read, as the consumer was busy */
+uint64_t image_exchange_dropped(struct image_exchange *self)
+{
+	pthread_mutex_lock(&self->mutex);
+	uint64_t dropped = self->dropped;
+	pthread_mutex_unlock(&self->mutex);
+	return dropped;
+}
+
+/* Wake the consumer and have it read no more */
+void image_exchange_close(struct image_exchange *self)
+{
+	pthread_mutex_lock(&self->mutex);
+	self->closed = true;
+	pthread_cond_broadcast(&self->cond);
+	pthread_mutex_unlock(&self->mutex);
+}
+
+void image_exchange_destroy(struct image_exchange *self)
+{
+	for (size_t index = 0; index < image_exchange_buffers; index++) {
+		free(self->buffers[index]);
+	}
+	pthread_cond_destroy(&self->cond);
+	pthread_mutex_destroy(&self->mutex);
+}
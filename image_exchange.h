@@ -0,0 +1,63 @@
+#pragma once
+#include "stdinc.h"
+
+#include <pthread.h>
+
+enum
+{
+	/* One being written, the newest complete, and one being read */
+	image_exchange_buffers = 3,
+};
+
+/* Rows of an image, in order from its first row, valid with those before them until the read after its last */
+struct image_exchange_slice
+{
+	/* Images are numbered from zero in the order completed */
+	uint64_t image;
+	const uint8_t *rows;
+	uint32_t first_row;
+	uint32_t row_count;
+	/* The image is complete with these rows, at (completed_ns) on the monotonic clock */
+	bool last;
+	uint64_t completed_ns;
+};
+
+/*
+ * Hands images from one producing thread to one consuming thread without
+ * copying them.  The producer never waits: an image the consumer has not
+ * started on when a newer one completes is dropped.  Rows of the image being
+ * written can be read as soon as the producer publishes them.
+ */
+struct image_exchange
+{
+	uint8_t *buffers[image_exchange_buffers];
+	size_t row_bytes;
+	uint32_t height;
+	pthread_mutex_t mutex;
+	pthread_cond_t cond;
+	bool closed;
+	/* Producer's buffer, the image being written to it and its rows published so far */
+	int writing;
+	uint64_t writing_image;
+	uint32_t writing_rows;
+	/* Buffer of the newest complete image, or -1 */
+	int complete;
+	uint64_t complete_image;
+	uint64_t completed_ns[image_exchange_buffers];
+	/* Consumer's buffer or -1, the image in it and its rows read so far */
+	int reading;
+	uint64_t reading_image;
+	uint32_t reading_rows;
+	/* Images before this have been read or dropped */
+	uint64_t next_image;
+	uint64_t dropped;
+};
+
+void image_exchange_init(struct image_exchange *self, size_t row_bytes, uint32_t height);
+uint8_t *image_exchange_buffer(struct image_exchange *self);
+void image_exchange_publish(struct image_exchange *self, uint32_t rows);
+uint8_t *image_exchange_complete(struct image_exchange *self);
+bool image_exchange_read(struct image_exchange *self, struct image_exchange_slice *slice);
+uint64_t image_exchange_dropped(struct image_exchange *self);
+void image_exchange_close(struct image_exchange *self);
+void image_exchange_destroy(struct image_exchange *self);
@@ -0,0 +1,93 @@
+#include "image_scaler.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+#ifdef __AVX2__
+/* Sums of horizontally adjacent bytes of 32 from each row, rounded to a quarter */
+static inline __m256i image_scaler_average_pairs(__m256i top, __m256i bottom)
+{
+	const __m256i ones = _mm256_set1_epi8(1);
+	const __m256i two = _mm256_set1_epi16(2);
+	__m256i sum = _mm256_add_epi16(_mm256_maddubs_epi16(top, ones), _mm256_maddubs_epi16(bottom, ones));
+	return _mm256_srli_epi16(_mm256_add_epi16(sum, two), 2);
+}
+
+/* 32 grey pixels at a time from 64 of each row, returns the columns made */
+static uint32_t image_scaler_halve_grey_avx2(const uint8_t *top, const uint8_t *bottom, uint8_t *out, uint32_t width)
+{
+	const uint32_t columns = width / 64 * 32;
+	for (uint32_t column = 0; column < columns; column += 32) {
+		const __m256i *top_pixels = (const __m256i *) &top[2 * column];
+		const __m256i *bottom_pixels = (const __m256i *) &bottom[2 * column];
+		__m256i low = image_scaler_average_pairs(_mm256_loadu_si256(&top_pixels[0]), _mm256_loadu_si256(&bottom_pixels[0]));
+		__m256i high = image_scaler_average_pairs(_mm256_loadu_si256(&top_pixels[1]), _mm256_loadu_si256(&bottom_pixels[1]));
+		/* Packing works within lanes, so put the quarters back in order */
+		__m256i packed = _mm256_permute4x64_epi64(_mm256_packus_epi16(low, high), 0xd8);
+		_mm256_storeu_si256((__m256i *) &out[column], packed);
+	}
+	return columns;
+}
+
+static inline __m256i image_scaler_load_lanes(const uint8_t *pixels, size_t second)
+{
+	return _mm256_inserti128_si256(_mm256_castsi128_si256(_mm_loadu_si128((const __m128i *) pixels)), _mm_loadu_si128((const __m128i *) &pixels[second]), 1);
+}
+
+/*
+ * 8 pixels of three components at a time from 16 of each row, each lane
+ * making 4 from 8.  Components of pixels to average are shuffled next to
+ * each other, from bytes 0-15 for the first two and 8-23 for the others.
+ */
+static uint32_t image_scaler_halve_colour_avx2(const uint8_t *top, const uint8_t *bottom, uint8_t *out, uint32_t width)
+{
+	const __m256i first_pairs = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 3, 1, 4, 2, 5, 6, 9, 7, 10, 8, 11, -1, -1, -1, -1));
+	const __m256i second_pairs = _mm256_broadcastsi128_si256(_mm_setr_epi8(4, 7, 5, 8, 6, 9, 10, 13, 11, 14, 12, 15, -1, -1, -1, -1));
+	const __m256i gather = _mm256_broadcastsi128_si256(_mm_setr_epi8(0, 1, 2, 3, 4, 5, 8, 9, 10, 11, 12, 13, -1, -1, -1, -1));
+	const __m256i lanes = _mm256_setr_epi32(0, 1, 2, 4, 5, 6, 3, 7);
+	const uint32_t columns = width / 2 / 8 * 8;
+	for (uint32_t column = 0; column < columns; column += 8) {
+		const uint8_t *top_pixels = &top[6 * column];
+		const uint8_t *bottom_pixels = &bottom[6 * column];
+		__m256i first = image_scaler_average_pairs(
+			_mm256_shuffle_epi8(image_scaler_load_lanes(top_pixels, 24), first_pairs),
+			_mm256_shuffle_epi8(image_scaler_load_lanes(bottom_pixels, 24), first_pairs)
+		);
+		__m256i second = image_scaler_average_pairs(
+			_mm256_shuffle_epi8(image_scaler_load_lanes(&top_pixels[8], 24), second_pairs),
+			_mm256_shuffle_epi8(image_scaler_load_lanes(&bottom_pixels[8], 24), second_pairs)
+		);
+		/* 12 bytes in each lane, then 24 together */
+		__m256i packed = _mm256_shuffle_epi8(_mm256_packus_epi16(first, second), gather);
+		packed = _mm256_permutevar8x32_epi32(packed, lanes);
+		uint8_t *pixels = &out[3 * column];
+		_mm_storeu_si128((__m128i *) pixels, _mm256_castsi256_si128(packed));
+		_mm_storel_epi64((__m128i *) &pixels[16], _mm256_extracti128_si256(packed, 1));
+	}
+	return columns;
+}
+#endif
+
+/******************************************************************************/
+
+/* Row (out) of the image at half size, from two rows of (width) pixels */
+void image_scaler_halve_row(const uint8_t *top, const uint8_t *bottom, uint8_t *out, uint32_t width, uint32_t components)
+{
+	const uint32_t half = image_scaler_half(width);
+	uint32_t column = 0;
+#ifdef __AVX2__
+	if (components == 1) {
+		column = image_scaler_halve_grey_avx2(top, bottom, out, width);
+	} else if (components == 3) {
+		column = image_scaler_halve_colour_avx2(top, bottom, out, width);
+	}
+#endif
+	for (; column < half; column++) {
+		const uint32_t left = 2 * column * components;
+		const uint32_t right = 2 * column + 1 < width ? left + components : left;
+		for (uint32_t component = 0; component < components; component++) {
+			uint32_t sum = top[left + component] + top[right + component] + bottom[left + component] + bottom[right + component];
+			out[column * components + component] = (sum + 2) >> 2;
+		}
+	}
+}
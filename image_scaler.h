@@ -0,0 +1,15 @@
+#pragma once
+#include "stdinc.h"
+
+/*
+ * Halves 8-bit images of interleaved components, a row at a time, averaging
+ * each 2x2 block with rounding.  Where the width is odd the last column is
+ * averaged with itself, and callers repeat the last row where the height is.
+ */
+
+static inline uint32_t image_scaler_half(uint32_t size)
+{
+	return (size + 1) / 2;
+}
+
+void image_scaler_halve_row(const uint8_t *top, const uint8_t *bottom, uint8_t *out, uint32_t width, uint32_t components);
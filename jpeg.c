@@ -3,6 +3,17 @@
 #include <jpeglib.h>
 #include <jerror.h>
 
+enum
+{
+	/* Markers, after 0xff */
+	jpeg_marker_sof0 = 0xc0,
+	jpeg_marker_rst0 = 0xd0,
+	jpeg_marker_soi = 0xd8,
+	jpeg_marker_eoi = 0xd9,
+	jpeg_marker_sos = 0xda,
+	jpeg_marker_dri = 0xdd,
+};
+
 struct jpeg_error_handler
 {
 	struct jpeg_error_mgr err;
@@ -17,33 +28,251 @@ static void jpeg_on_error_exit(struct jpeg_common_struct *jpeg)
     longjmp(eh->error_handler, 1);
 }
 
-bool jpeg_write_image(FILE *sink, unsigned width, unsigned height, bool rgb, void *data, unsigned quality)
+/* Output buffer that grows when an image does not fit, and stays that size for the next */
+struct jpeg_memory_destination
+{
+	struct jpeg_destination_mgr dest;
+	uint8_t *data;
+	size_t capacity;
+	size_t length;
+};
+
+struct jpeg_encoder
 {
-	bool result = false;
 	struct jpeg_error_handler eh;
 	struct jpeg_compress_struct info;
-	info.err = jpeg_std_error(&eh.err);
-	eh.err.error_exit = jpeg_on_error_exit;
-	if (setjmp(eh.error_handler)) {
-		goto done;
-	}
-	jpeg_create_compress(&info);
-	jpeg_stdio_dest(&info, sink);
-	info.image_width = width;
-	info.image_height = height;
-	info.input_components = rgb ? 3 : 1;
-	info.in_color_space = rgb ? JCS_RGB : JCS_GRAYSCALE;
-	jpeg_set_defaults(&info);
-	jpeg_set_quality(&info, quality, TRUE);
-	jpeg_start_compress(&info, TRUE);
-	uint8_t *scanline = data;
-	for (unsigned row = 0; row < height; row++) {
-		jpeg_write_scanlines(&info, &scanline, 1);
-		scanline += (rgb ? 3 : 1) * width;
-	}
-	jpeg_finish_compress(&info);
-	result = true;
-done:
-	jpeg_destroy_compress(&info);
-	return result;
+	struct jpeg_memory_destination destination;
+	unsigned row_bytes;
+	bool compressing;
+};
+
+static void jpeg_memory_init_destination(struct jpeg_compress_struct *info)
+{
+	struct jpeg_memory_destination *self = (void *) info->dest;
+	self->dest.next_output_byte = self->data;
+	self->dest.free_in_buffer = self->capacity;
+	self->length = 0;
+}
+
+static boolean jpeg_memory_empty_output_buffer(struct jpeg_compress_struct *info)
+{
+	struct jpeg_memory_destination *self = (void *) info->dest;
+	/* Called only once the whole buffer is used */
+	uint8_t *data = realloc(self->data, 2 * self->capacity);
+	if (!data) {
+		ERREXIT1(info, JERR_OUT_OF_MEMORY, 0);
+	}
+	self->dest.next_output_byte = &data[self->capacity];
+	self->dest.free_in_buffer = self->capacity;
+	self->data = data;
+	self->capacity *= 2;
+	return TRUE;
+}
+
+static void jpeg_memory_term_destination(struct jpeg_compress_struct *info)
+{
+	struct jpeg_memory_destination *self = (void *) info->dest;
+	self->length = self->capacity - self->dest.free_in_buffer;
+}
+
+/* Where a strip's SOF0 and SOS segments are, and its entropy-coded data after them up to EOI */
+struct jpeg_strip_layout
+{
+	size_t frame;
+	size_t scan;
+	size_t data;
+	size_t data_end;
+};
+
+static bool jpeg_strip_parse(const uint8_t *jpeg, size_t length, struct jpeg_strip_layout *layout)
+{
+	if (length < 4 || jpeg[0] != 0xff || jpeg[1] != jpeg_marker_soi || jpeg[length - 2] != 0xff || jpeg[length - 1] != jpeg_marker_eoi) {
+		return false;
+	}
+	layout->frame = 0;
+	for (size_t offset = 2; offset + 4 <= length; ) {
+		if (jpeg[offset] != 0xff) {
+			return false;
+		}
+		const uint8_t marker = jpeg[offset + 1];
+		const size_t segment = 2 + (jpeg[offset + 2] << 8 | jpeg[offset + 3]);
+		if (marker == jpeg_marker_sof0) {
+			layout->frame = offset;
+		} else if (marker == jpeg_marker_sos) {
+			layout->scan = offset;
+			layout->data = offset + segment;
+			layout->data_end = length - 2;
+			return layout->frame && layout->data <= layout->data_end;
+		}
+		offset += segment;
+	}
+	return false;
+}
+
+/* Append (count) bytes to (*out), growing it as need be */
+static void jpeg_append(uint8_t **out, size_t *capacity, size_t *length, const void *data, size_t count)
+{
+	if (*length + count > *capacity) {
+		*capacity = 2 * (*length + count);
+		*out = realloc(*out, *capacity);
+	}
+	memcpy(&(*out)[*length], data, count);
+	*length += count;
+}
+
+/* Make the compressor, with the tables written into every image; on failure there is nothing of it to destroy */
+static bool jpeg_encoder_setup(struct jpeg_encoder *self, unsigned width, unsigned height, enum jpeg_format format, unsigned quality)
+{
+	self->info.err = jpeg_std_error(&self->eh.err);
+	self->eh.err.error_exit = jpeg_on_error_exit;
+	if (setjmp(self->eh.error_handler)) {
+		jpeg_destroy_compress(&self->info);
+		return false;
+	}
+	jpeg_create_compress(&self->info);
+	self->info.dest = &self->destination.dest;
+	self->info.image_width = width;
+	self->info.image_height = height;
+	self->info.input_components = format == jpeg_format_grey ? 1 : 3;
+	self->info.in_color_space = format == jpeg_format_grey ? JCS_GRAYSCALE : format == jpeg_format_rgb ? JCS_RGB : JCS_YCbCr;
+	jpeg_set_defaults(&self->info);
+	jpeg_set_quality(&self->info, quality, TRUE);
+	return true;
+}
+
+/******************************************************************************/
+
+struct jpeg_encoder *jpeg_encoder_create(unsigned width, unsigned height, enum jpeg_format format, unsigned quality)
+{
+	struct jpeg_encoder *self = malloc(sizeof(*self));
+	if (!self) {
+		return NULL;
+	}
+	const unsigned components = format == jpeg_format_grey ? 1 : 3;
+	/* Room for most images at usual qualities without growing, which compress to well under a byte per sample */
+	self->destination = (struct jpeg_memory_destination) {
+		.dest = {
+			.init_destination = jpeg_memory_init_destination,
+			.empty_output_buffer = jpeg_memory_empty_output_buffer,
+			.term_destination = jpeg_memory_term_destination,
+		},
+		.capacity = (size_t) width * height * components / 2 + 4096,
+	};
+	self->destination.data = malloc(self->destination.capacity);
+	self->compressing = false;
+	self->row_bytes = components * width;
+	if (!self->destination.data || !jpeg_encoder_setup(self, width, height, format, quality)) {
+		free(self->destination.data);
+		free(self);
+		return NULL;
+	}
+	return self;
+}
+
+bool jpeg_encoder_begin(struct jpeg_encoder *self)
+{
+	if (setjmp(self->eh.error_handler)) {
+		jpeg_abort_compress(&self->info);
+		self->compressing = false;
+		return false;
+	}
+	if (self->compressing) {
+		jpeg_abort_compress(&self->info);
+	}
+	jpeg_start_compress(&self->info, TRUE);
+	self->compressing = true;
+	return true;
+}
+
+bool jpeg_encoder_write(struct jpeg_encoder *self, const void *rows, unsigned count)
+{
+	if (!self->compressing) {
+		return false;
+	}
+	if (setjmp(self->eh.error_handler)) {
+		jpeg_abort_compress(&self->info);
+		self->compressing = false;
+		return false;
+	}
+	/* Compression happens as each MCU row fills, so rows passed now are mostly encoded on return */
+	JSAMPROW scanline = (JSAMPROW) rows;
+	for (unsigned row = 0; row < count; row++) {
+		jpeg_write_scanlines(&self->info, &scanline, 1);
+		scanline += self->row_bytes;
+	}
+	return true;
+}
+
+bool jpeg_encoder_end(struct jpeg_encoder *self, const uint8_t **data, size_t *length)
+{
+	if (!self->compressing) {
+		return false;
+	}
+	self->compressing = false;
+	if (setjmp(self->eh.error_handler)) {
+		jpeg_abort_compress(&self->info);
+		return false;
+	}
+	jpeg_finish_compress(&self->info);
+	*data = self->destination.data;
+	*length = self->destination.length;
+	return true;
+}
+
+void jpeg_encoder_destroy(struct jpeg_encoder *self)
+{
+	jpeg_destroy_compress(&self->info);
+	free(self->destination.data);
+	free(self);
+}
+
+bool jpeg_write_image(FILE *sink, unsigned width, unsigned height, enum jpeg_format format, void *data, unsigned quality)
+{
+	struct jpeg_encoder *encoder = jpeg_encoder_create(width, height, format, quality);
+	if (!encoder) {
+		return false;
+	}
+	const uint8_t *jpeg;
+	size_t length;
+	bool written = jpeg_encoder_begin(encoder) && jpeg_encoder_write(encoder, data, height) && jpeg_encoder_end(encoder, &jpeg, &length) && fwrite(jpeg, 1, length, sink) == length;
+	jpeg_encoder_destroy(encoder);
+	return written;
+}
+
+/* With jpeg_set_defaults, colour is subsampled 2x2 and so is encoded in 16x16 MCUs, grey in 8x8 */
+unsigned jpeg_mcu_height(enum jpeg_format format)
+{
+	return format == jpeg_format_grey ? DCTSIZE : 2 * DCTSIZE;
+}
+
+bool jpeg_join_strips(const uint8_t *const *strips, const size_t *lengths, unsigned count, unsigned width, unsigned height, enum jpeg_format format, unsigned strip_rows, uint8_t **out, size_t *capacity, size_t *length)
+{
+	const unsigned mcu_size = jpeg_mcu_height(format);
+	const unsigned restart_interval = (width + mcu_size - 1) / mcu_size * (strip_rows / mcu_size);
+	if (!count || strip_rows % mcu_size || restart_interval > 0xffff) {
+		return false;
+	}
+	struct jpeg_strip_layout first;
+	if (!jpeg_strip_parse(strips[0], lengths[0], &first)) {
+		return false;
+	}
+	*length = 0;
+	/* The first strip's headers and tables, for the whole image, with a restart interval of a strip */
+	jpeg_append(out, capacity, length, strips[0], first.scan);
+	(*out)[first.frame + 5] = height >> 8;
+	(*out)[first.frame + 6] = height;
+	const uint8_t restart[] = { 0xff, jpeg_marker_dri, 0, 4, restart_interval >> 8, restart_interval };
+	jpeg_append(out, capacity, length, restart, sizeof(restart));
+	jpeg_append(out, capacity, length, &strips[0][first.scan], first.data - first.scan);
+	/* Each strip's data starts its DC prediction afresh and ends padded to a byte, as at a restart */
+	for (unsigned strip = 0; strip < count; strip++) {
+		struct jpeg_strip_layout layout;
+		if (!jpeg_strip_parse(strips[strip], lengths[strip], &layout)) {
+			return false;
+		}
+		jpeg_append(out, capacity, length, &strips[strip][layout.data], layout.data_end - layout.data);
+		const uint8_t marker[] = { 0xff, strip + 1 < count ? jpeg_marker_rst0 + strip % 8 : jpeg_marker_eoi };
+		jpeg_append(out, capacity, length, marker, sizeof(marker));
+	}
+	return true;
 }
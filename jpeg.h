@@ -1,4 +1,37 @@
 #pragma once
 #include "stdinc.h"
 
-bool jpeg_write_image(FILE *sink, unsigned width, unsigned height, bool rgb, void *data, unsigned quality);
+struct jpeg_encoder;
+
+/* Layout of the pixels given */
+enum jpeg_format
+{
+	jpeg_format_grey = 0,
+	jpeg_format_rgb,
+	/* Interleaved Y, Cb and Cr, as JPEG stores them */
+	jpeg_format_ycbcr,
+};
+
+/*
+ * Compresses images of one size, format and quality into memory, keeping
+ * its tables and output buffer from one image to the next.  NULL on failure.
+ */
+struct jpeg_encoder *jpeg_encoder_create(unsigned width, unsigned height, enum jpeg_format format, unsigned quality);
+/* Start an image, then give it a few rows at a time, in order */
+bool jpeg_encoder_begin(struct jpeg_encoder *self);
+bool jpeg_encoder_write(struct jpeg_encoder *self, const void *rows, unsigned count);
+/* Finish the image once all rows are written, its JPEG data valid until the next begins */
+bool jpeg_encoder_end(struct jpeg_encoder *self, const uint8_t **data, size_t *length);
+void jpeg_encoder_destroy(struct jpeg_encoder *self);
+
+/* Rows in each row of MCUs, of which strips for jpeg_join_strips must be whole numbers */
+unsigned jpeg_mcu_height(enum jpeg_format format);
+/*
+ * Join JPEGs of consecutive horizontal strips of one image, made by encoders
+ * alike but for their heights, into one JPEG of (width) by (height) with a
+ * restart marker between each strip and the next.  Every strip but the last
+ * is (strip_rows) high.  The result goes to (*out), grown to fit.
+ */
+bool jpeg_join_strips(const uint8_t *const *strips, const size_t *lengths, unsigned count, unsigned width, unsigned height, enum jpeg_format format, unsigned strip_rows, uint8_t **out, size_t *capacity, size_t *length);
+
+bool jpeg_write_image(FILE *sink, unsigned width, unsigned height, enum jpeg_format format, void *data, unsigned quality);
@@ -0,0 +1,244 @@
+#include "jpeg_pool.h"
+#include "errors.h"
+
+/* Emit images in order for as long as the next due is encoded, unless another thread is; call with mutex held */
+static void jpeg_pool_emit_ready(struct jpeg_pool *self)
+{
+	if (self->emitting) {
+		return;
+	}
+	self->emitting = true;
+	while (self->next_emit < self->next_image) {
+		struct jpeg_pool_slot *slot = &self->slots[self->next_emit % self->slot_count];
+		if (!slot->encoded) {
+			break;
+		}
+		pthread_mutex_unlock(&self->mutex);
+		self->emit(self->context, slot->data, slot->length, slot->completed_ns);
+		pthread_mutex_lock(&self->mutex);
+		slot->in_use = false;
+		self->next_emit++;
+		pthread_cond_broadcast(&self->slot_cond);
+	}
+	self->emitting = false;
+}
+
+/* The image in (slot) once its last strip is encoded, joining the strips if there are several; call with mutex held */
+static void jpeg_pool_finish_image(struct jpeg_pool *self, struct jpeg_pool_slot *slot)
+{
+	if (self->strip_count == 1) {
+		slot->data = slot->strips[0];
+		slot->length = slot->strip_lengths[0];
+	} else if (!slot->failed) {
+		/* No other thread touches the slot until it is marked encoded */
+		pthread_mutex_unlock(&self->mutex);
+		slot->failed = !jpeg_join_strips(slot->strips, slot->strip_lengths, self->strip_count, self->width, self->height, self->format, self->strip_rows, &slot->joined, &slot->joined_capacity, &slot->length);
+		pthread_mutex_lock(&self->mutex);
+		slot->data = slot->joined;
+	}
+	if (slot->failed) {
+		slot->data = NULL;
+		slot->length = 0;
+	}
+	slot->encoded = true;
+	jpeg_pool_emit_ready(self);
+}
+
+/* Encode the rows of a strip of (slot) as they are copied in; call with mutex held, returns with it held */
+static void jpeg_pool_encode(struct jpeg_pool *self, struct jpeg_pool_slot *slot, uint32_t strip)
+{
+	struct jpeg_encoder *encoder = slot->encoders[strip];
+	const uint32_t end = (strip + 1) * self->strip_rows < self->height ? (strip + 1) * self->strip_rows : self->height;
+	bool encoded = jpeg_encoder_begin(encoder);
+	uint32_t rows = strip * self->strip_rows;
+	while (rows < end) {
+		while (slot->rows <= rows && !self->ending) {
+			pthread_cond_wait(&self->work_cond, &self->mutex);
+		}
+		if (slot->rows <= rows) {
+			/* Ending with the image unfinished, so it is never emitted */
+			return;
+		}
+		uint32_t first = rows;
+		rows = slot->rows < end ? slot->rows : end;
+		pthread_mutex_unlock(&self->mutex);
+		encoded = encoded && jpeg_encoder_write(encoder, &slot->image[first * self->row_bytes], rows - first);
+		pthread_mutex_lock(&self->mutex);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	encoded = encoded && jpeg_encoder_end(encoder, &slot->strips[strip], &slot->strip_lengths[strip]);
+	pthread_mutex_lock(&self->mutex);
+	slot->failed = slot->failed || !encoded;
+	if (++slot->strips_encoded == self->strip_count) {
+		jpeg_pool_finish_image(self, slot);
+	}
+}
+
+/* Without threads, encode the rows in place as they are given, and emit the image with its last */
+static void jpeg_pool_encode_inline(struct jpeg_pool *self, const uint8_t *rows, uint32_t first_row, uint32_t count, uint64_t completed_ns)
+{
+	struct jpeg_pool_slot *slot = &self->slots[0];
+	struct jpeg_encoder *encoder = slot->encoders[0];
+	if (first_row == 0) {
+		slot->encoded = jpeg_encoder_begin(encoder);
+	}
+	slot->encoded = slot->encoded && jpeg_encoder_write(encoder, rows, count);
+	if (first_row + count < self->height) {
+		return;
+	}
+	if (!slot->encoded || !jpeg_encoder_end(encoder, &slot->data, &slot->length)) {
+		slot->data = NULL;
+		slot->length = 0;
+	}
+	self->emit(self->context, slot->data, slot->length, completed_ns);
+}
+
+static void *jpeg_pool_worker(void *arg)
+{
+	struct jpeg_pool *self = arg;
+	pthread_setname_np(pthread_self(), "JPEG encoder");
+	pthread_mutex_lock(&self->mutex);
+	while (!self->ending) {
+		if (self->next_claim < self->next_image) {
+			struct jpeg_pool_slot *slot = &self->slots[self->next_claim % self->slot_count];
+			uint32_t strip = self->next_strip++;
+			if (self->next_strip == self->strip_count) {
+				self->next_strip = 0;
+				self->next_claim++;
+			}
+			jpeg_pool_encode(self, slot, strip);
+			continue;
+		}
+		pthread_cond_wait(&self->work_cond, &self->mutex);
+	}
+	pthread_mutex_unlock(&self->mutex);
+	return NULL;
+}
+
+/******************************************************************************/
+
+void jpeg_pool_init(struct jpeg_pool *self, uint32_t thread_count, uint32_t strip_count, unsigned width, unsigned height, enum jpeg_format format, unsigned quality, void (*emit)(void *context, const uint8_t *data, size_t length, uint64_t completed_ns), void *context)
+{
+	/* Strips are encoded on the pool even by one thread, which still takes them off the caller's */
+	self->thread_count = thread_count > 1 || strip_count > 1 ? thread_count : 0;
+	self->ending = false;
+	self->width = width;
+	self->height = height;
+	self->format = format;
+	self->row_bytes = (size_t) width * (format == jpeg_format_grey ? 1 : 3);
+	/* Strips of whole MCU rows, as near equal as that allows */
+	const uint32_t mcu_height = jpeg_mcu_height(format);
+	const uint32_t strips = strip_count > 1 ? strip_count : 1;
+	const uint32_t mcu_rows = (height + mcu_height - 1) / mcu_height;
+	self->strip_rows = (mcu_rows + strips - 1) / strips * mcu_height;
+	self->strip_count = (height + self->strip_rows - 1) / self->strip_rows;
+	self->next_strip = 0;
+	/* One more than the threads, to copy an image into while they all encode */
+	self->slot_count = self->thread_count + 1;
+	self->slots = calloc(self->slot_count, sizeof(*self->slots));
+	for (size_t index = 0; index < self->slot_count; index++) {
+		struct jpeg_pool_slot *slot = &self->slots[index];
+		slot->encoders = calloc(self->strip_count, sizeof(*slot->encoders));
+		for (uint32_t strip = 0; strip < self->strip_count; strip++) {
+			const uint32_t first = strip * self->strip_rows;
+			const uint32_t rows = height - first < self->strip_rows ? height - first : self->strip_rows;
+			slot->encoders[strip] = jpeg_encoder_create(width, rows, format, quality);
+			if (!slot->encoders[strip]) {
+				fatal_error("Failed to create JPEG encoder");
+			}
+		}
+		slot->strips = calloc(self->strip_count, sizeof(*slot->strips));
+		slot->strip_lengths = calloc(self->strip_count, sizeof(*slot->strip_lengths));
+		slot->image = self->thread_count ? malloc(self->row_bytes * height) : NULL;
+	}
+	self->filling = NULL;
+	self->next_image = 0;
+	self->next_claim = 0;
+	self->next_emit = 0;
+	self->emitting = false;
+	self->emit = emit;
+	self->context = context;
+	pthread_mutex_init(&self->mutex, NULL);
+	pthread_cond_init(&self->work_cond, NULL);
+	pthread_cond_init(&self->slot_cond, NULL);
+	self->threads = calloc(self->thread_count, sizeof(*self->threads));
+	for (uint32_t index = 0; index < self->thread_count; index++) {
+		assert_equal(0, pthread_create(&self->threads[index], NULL, jpeg_pool_worker, self));
+	}
+}
+
+/*
+ * Copy in the next (count) rows of an image, which starts a new one when
+ * (first_row) is zero, and is complete at (completed_ns) with its last.
+ */
+void jpeg_pool_add_rows(struct jpeg_pool *self, const uint8_t *rows, uint32_t first_row, uint32_t count, uint64_t completed_ns)
+{
+	if (!self->thread_count) {
+		jpeg_pool_encode_inline(self, rows, first_row, count, completed_ns);
+		return;
+	}
+	pthread_mutex_lock(&self->mutex);
+	if (first_row == 0) {
+		struct jpeg_pool_slot *slot = &self->slots[self->next_image % self->slot_count];
+		while (slot->in_use) {
+			pthread_cond_wait(&self->slot_cond, &self->mutex);
+		}
+		slot->in_use = true;
+		slot->strips_encoded = 0;
+		slot->failed = false;
+		slot->encoded = false;
+		self->next_image++;
+		slot->rows = 0;
+		self->filling = slot;
+	}
+	struct jpeg_pool_slot *slot = self->filling;
+	pthread_mutex_unlock(&self->mutex);
+	/* Encoding threads read only the rows before slot->rows */
+	memcpy(&slot->image[first_row * self->row_bytes], rows, count * self->row_bytes);
+	pthread_mutex_lock(&self->mutex);
+	slot->rows = first_row + count;
+	slot->completed_ns = completed_ns;
+	pthread_cond_broadcast(&self->work_cond);
+	pthread_mutex_unlock(&self->mutex);
+}
+
+/* Wait until every image given, which must all be complete, is emitted */
+void jpeg_pool_flush(struct jpeg_pool *self)
+{
+	if (!self->thread_count) {
+		return;
+	}
+	pthread_mutex_lock(&self->mutex);
+	while (self->next_emit < self->next_image) {
+		pthread_cond_wait(&self->slot_cond, &self->mutex);
+	}
+	pthread_mutex_unlock(&self->mutex);
+}
+
+/* Stop, leaving any image not yet encoded unemitted */
+void jpeg_pool_destroy(struct jpeg_pool *self)
+{
+	pthread_mutex_lock(&self->mutex);
+	self->ending = true;
+	pthread_cond_broadcast(&self->work_cond);
+	pthread_mutex_unlock(&self->mutex);
+	for (uint32_t index = 0; index < self->thread_count; index++) {
+		pthread_join(self->threads[index], NULL);
+	}
+	free(self->threads);
+	for (size_t index = 0; index < self->slot_count; index++) {
+		struct jpeg_pool_slot *slot = &self->slots[index];
+		for (uint32_t strip = 0; strip < self->strip_count; strip++) {
+			jpeg_encoder_destroy(slot->encoders[strip]);
+		}
+		free(slot->encoders);
+		free(slot->strips);
+		free(slot->strip_lengths);
+		free(slot->joined);
+		free(slot->image);
+	}
+	free(self->slots);
+	pthread_cond_destroy(&self->slot_cond);
+	pthread_cond_destroy(&self->work_cond);
+	pthread_mutex_destroy(&self->mutex);
+}
@@ -0,0 +1,74 @@
+#pragma once
+#include "stdinc.h"
+#include "jpeg.h"
+
+#include <pthread.h>
+
+/* An image given to the pool, from the rows copied in to the JPEG made of them */
+struct jpeg_pool_slot
+{
+	/* An encoder for each strip of the image, and what each made */
+	struct jpeg_encoder **encoders;
+	const uint8_t **strips;
+	size_t *strip_lengths;
+	uint8_t *image;
+	/* Rows copied in so far */
+	uint32_t rows;
+	uint64_t completed_ns;
+	bool in_use;
+	/* Strips encoded so far, and whether any failed */
+	uint32_t strips_encoded;
+	bool failed;
+	/* Encoded, or without threads encoding so far without error */
+	bool encoded;
+	/* The JPEG once encoded, NULL if encoding failed, the strips joined into (joined) if more than one */
+	const uint8_t *data;
+	size_t length;
+	uint8_t *joined;
+	size_t joined_capacity;
+};
+
+/*
+ * Encodes images on several threads at once, each image on one of them as
+ * its rows are copied in, and emits the JPEGs in the order the images were
+ * given.  For less latency, each image can be split into strips instead,
+ * encoded by different threads at once and joined by restart markers.
+ * Whichever thread finishes the next image due emits it, and any finished
+ * after it.  Giving an image waits while every slot holds one not yet
+ * emitted.
+ */
+struct jpeg_pool
+{
+	/* Zero when asked for one or fewer without strips, for the caller to encode each image in place as its rows are given */
+	uint32_t thread_count;
+	pthread_t *threads;
+	pthread_mutex_t mutex;
+	pthread_cond_t work_cond;
+	pthread_cond_t slot_cond;
+	bool ending;
+	unsigned width;
+	uint32_t height;
+	enum jpeg_format format;
+	size_t row_bytes;
+	/* Strips of each image, all but the last of strip_rows, one for whole images */
+	uint32_t strip_count;
+	uint32_t strip_rows;
+	/* Images are numbered in the order given, image n going in slot n % slot_count */
+	struct jpeg_pool_slot *slots;
+	size_t slot_count;
+	struct jpeg_pool_slot *filling;
+	uint64_t next_image;
+	/* Next strip for a thread to take, of the image next_claim */
+	uint64_t next_claim;
+	uint32_t next_strip;
+	uint64_t next_emit;
+	bool emitting;
+	/* Called with each JPEG in turn, from the encoding threads */
+	void (*emit)(void *context, const uint8_t *data, size_t length, uint64_t completed_ns);
+	void *context;
+};
+
+void jpeg_pool_init(struct jpeg_pool *self, uint32_t thread_count, uint32_t strip_count, unsigned width, unsigned height, enum jpeg_format format, unsigned quality, void (*emit)(void *context, const uint8_t *data, size_t length, uint64_t completed_ns), void *context);
+void jpeg_pool_add_rows(struct jpeg_pool *self, const uint8_t *rows, uint32_t first_row, uint32_t count, uint64_t completed_ns);
+void jpeg_pool_flush(struct jpeg_pool *self);
+void jpeg_pool_destroy(struct jpeg_pool *self);
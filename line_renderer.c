@@ -0,0 +1,324 @@
+#include "line_renderer.h"
+#include "errors.h"
+#include "pulse_width.h"
+
+#include <errno.h>
+#include <sched.h>
+#include <time.h>
+#include <unistd.h>
+#include <limits.h>
+#include <linux/futex.h>
+#include <sys/syscall.h>
+
+/* Cb or Cr level relative to 128, in 1/2^chroma_decoder_fraction_bits, as a byte */
+static uint8_t line_renderer_chroma_level(int32_t value)
+{
+	int32_t level = 128 + ((value + (1 << (chroma_decoder_fraction_bits - 1))) >> chroma_decoder_fraction_bits);
+	return level < 0 ? 0 : level > 255 ? 255 : level;
+}
+
+/* Separate the line into luma and chroma, resample each, and interleave them */
+static void line_renderer_render_colour(struct line_renderer *self, uint32_t thread, const struct line_job *job)
+{
+	struct line_resampler *resampler = &self->resamplers[thread];
+	struct chroma_decoder *chroma_decoder = &self->chroma_decoders[thread];
+	const uint32_t width = self->width;
+	const ptrdiff_t first = -line_resampler_margin_before;
+	const size_t count = ((job->begin_fraction + job->duration_fine) >> pulse_fraction_bits) + line_resampler_margin_after + 1 - first;
+	sample_t *luma = self->components[thread];
+	sample_t *cb = &luma[chroma_decoder->capacity];
+	sample_t *cr = &cb[chroma_decoder->capacity];
+	chroma_decoder_separate(chroma_decoder, job->data, job->origin, first, count, luma, cb, cr);
+	int32_t *values = self->values[thread];
+	uint8_t *row = job->row;
+	line_resampler_render(resampler, &luma[-first], job->begin_fraction, job->duration_fine, values);
+	tone_map_apply(self->tone_map, values, self->luma[thread], width);
+	for (uint32_t column = 0; column < width; column++) {
+		row[3 * column] = self->luma[thread][column];
+	}
+	sample_t *const chroma[2] = { cb, cr };
+	for (int component = 0; component < 2; component++) {
+		line_resampler_render(resampler, &chroma[component][-first], job->begin_fraction, job->duration_fine, values);
+		for (uint32_t column = 0; column < width; column++) {
+			row[3 * column + 1 + component] = line_renderer_chroma_level(values[column]);
+		}
+	}
+}
+
+static void line_renderer_render(struct line_renderer *self, uint32_t thread, const struct line_job *job)
+{
+	if (self->chroma_decoders) {
+		line_renderer_render_colour(self, thread, job);
+		return;
+	}
+	int32_t *values = self->values[thread];
+	line_resampler_render(&self->resamplers[thread], job->data, job->begin_fraction, job->duration_fine, values);
+	tone_map_apply(self->tone_map, values, job->row, self->width);
+}
+
+static uint64_t line_renderer_thread_cpu_ns()
+{
+	struct timespec now;
+	clock_gettime(CLOCK_THREAD_CPUTIME_ID, &now);
+	return now.tv_sec * (uint64_t) 1000000000 + now.tv_nsec;
+}
+
+/*
+ * Sleep until (events) moves on from (seen), unless it already has.  Whoever
+ * changes what a waiter is waiting for counts an event afterwards, if there
+ * are waiters, so a waiter that announced itself before checking is woken.
+ */
+static void line_renderer_sleep(atomic_uint *events, unsigned seen)
+{
+	syscall(SYS_futex, events, FUTEX_WAIT_PRIVATE, seen, NULL, NULL, 0);
+}
+
+static void line_renderer_wake(atomic_uint *events, atomic_uint *waiters, int count)
+{
+	if (atomic_load(waiters)) {
+		atomic_fetch_add(events, 1);
+		syscall(SYS_futex, events, FUTEX_WAKE_PRIVATE, count, NULL, NULL, 0);
+	}
+}
+
+/* Take the next job submitted, if there is one not yet started */
+static bool line_renderer_claim(struct line_renderer *self, uint64_t *number)
+{
+	uint64_t started = atomic_load(&self->started);
+	while (started < atomic_load(&self->submitted)) {
+		if (atomic_compare_exchange_weak(&self->started, &started, started + 1)) {
+			*number = started;
+			return true;
+		}
+	}
+	return false;
+}
+
+/* Move retired past every job finished in order, waking the caller if it waits for that */
+static void line_renderer_retire(struct line_renderer *self)
+{
+	uint64_t retired = atomic_load(&self->retired);
+	while (retired < atomic_load(&self->started) && atomic_load(&self->finished[retired % line_renderer_queue_length]) == retired + 1) {
+		if (atomic_compare_exchange_weak(&self->retired, &retired, retired + 1)) {
+			retired++;
+		}
+	}
+	line_renderer_wake(&self->done_events, &self->done_waiters, INT_MAX);
+}
+
+/* Wait for the jobs before (number) to finish */
+static void line_renderer_wait_retired(struct line_renderer *self, uint64_t number)
+{
+	while (atomic_load(&self->retired) < number) {
+		unsigned seen = atomic_load(&self->done_events);
+		atomic_fetch_add(&self->done_waiters, 1);
+		if (atomic_load(&self->retired) < number) {
+			line_renderer_sleep(&self->done_events, seen);
+		}
+		atomic_fetch_sub(&self->done_waiters, 1);
+	}
+}
+
+/* Keep each worker on a core of its own of those the process may use, away from the calling thread where there are enough */
+static void line_renderer_pin(uint32_t thread)
+{
+	cpu_set_t allowed;
+	if (sched_getaffinity(0, sizeof(allowed), &allowed) != 0) {
+		log("Not pinning line renderer %u, no CPU affinity: %s", thread, strerror(errno));
+		return;
+	}
+	const int cpus = CPU_COUNT(&allowed);
+	if (cpus <= 1) {
+		return;
+	}
+	int skip = thread % cpus;
+	int cpu = 0;
+	while (!CPU_ISSET(cpu, &allowed) || skip-- > 0) {
+		cpu++;
+	}
+	cpu_set_t set;
+	CPU_ZERO(&set);
+	CPU_SET(cpu, &set);
+	int error = pthread_setaffinity_np(pthread_self(), sizeof(set), &set);
+	if (error) {
+		log("Failed to pin line renderer %u to CPU %d: %s", thread, cpu, strerror(error));
+	}
+}
+
+/* Render jobs as they come, sleeping while there are none, and account for the CPU time */
+static void *line_renderer_worker(void *arg)
+{
+	struct line_renderer *self = arg;
+	pthread_setname_np(pthread_self(), "Line renderer");
+	uint32_t thread = atomic_fetch_add(&self->workers_started, 1) + 1;
+	if (self->pin) {
+		line_renderer_pin(thread);
+	}
+	uint64_t cpu_ns = line_renderer_thread_cpu_ns();
+	uint32_t jobs = 0;
+	while (!atomic_load(&self->ending)) {
+		uint64_t number;
+		if (line_renderer_claim(self, &number)) {
+			size_t slot = number % line_renderer_queue_length;
+			line_renderer_render(self, thread, &self->jobs[slot]);
+			atomic_store(&self->finished[slot], number + 1);
+			line_renderer_retire(self);
+			if (++jobs < line_renderer_cpu_time_jobs) {
+				continue;
+			}
+		}
+		/* Before sleeping, or every so many jobs while busy */
+		uint64_t now = line_renderer_thread_cpu_ns();
+		atomic_fetch_add(&self->cpu_ns, now - cpu_ns);
+		cpu_ns = now;
+		if (jobs) {
+			jobs = 0;
+			continue;
+		}
+		unsigned seen = atomic_load(&self->work_events);
+		atomic_fetch_add(&self->work_waiters, 1);
+		if (atomic_load(&self->started) == atomic_load(&self->submitted) && !atomic_load(&self->ending)) {
+			line_renderer_sleep(&self->work_events, seen);
+		}
+		atomic_fetch_sub(&self->work_waiters, 1);
+		cpu_ns = line_renderer_thread_cpu_ns();
+	}
+	return NULL;
+}
+
+/******************************************************************************/
+
+void line_renderer_init(struct line_renderer *self, uint32_t thread_count, bool pin, uint32_t width, enum line_resampler_kernel kernel, const struct tone_map *tone_map, const struct chroma_decoder_config *chroma, size_t copy_capacity)
+{
+	self->thread_count = thread_count ? thread_count : 1;
+	self->pin = pin;
+	atomic_init(&self->ending, false);
+	self->width = width;
+	self->tone_map = tone_map;
+	self->resamplers = calloc(self->thread_count, sizeof(*self->resamplers));
+	self->values = calloc(self->thread_count, sizeof(*self->values));
+	for (uint32_t index = 0; index < self->thread_count; index++) {
+		line_resampler_init(&self->resamplers[index], width, kernel);
+		self->values[index] = malloc(width * sizeof(*self->values[index]));
+	}
+	self->chroma_decoders = NULL;
+	self->components = NULL;
+	self->luma = NULL;
+	self->history = 0;
+	self->lookahead = 0;
+	if (chroma) {
+		self->chroma_decoders = calloc(self->thread_count, sizeof(*self->chroma_decoders));
+		self->components = calloc(self->thread_count, sizeof(*self->components));
+		self->luma = calloc(self->thread_count, sizeof(*self->luma));
+		for (uint32_t index = 0; index < self->thread_count; index++) {
+			chroma_decoder_init(&self->chroma_decoders[index], chroma, copy_capacity);
+			self->components[index] = malloc(3 * copy_capacity * sizeof(*self->components[index]));
+			self->luma[index] = malloc(width);
+		}
+		self->history = self->chroma_decoders[0].history;
+		self->lookahead = self->chroma_decoders[0].lookahead;
+	}
+	for (size_t index = 0; index < line_renderer_queue_length; index++) {
+		self->jobs[index].copy = malloc(copy_capacity * sizeof(*self->jobs[index].copy));
+		atomic_init(&self->finished[index], 0);
+	}
+	atomic_init(&self->submitted, 0);
+	atomic_init(&self->started, 0);
+	atomic_init(&self->retired, 0);
+	atomic_init(&self->work_events, 0);
+	atomic_init(&self->work_waiters, 0);
+	atomic_init(&self->done_events, 0);
+	atomic_init(&self->done_waiters, 0);
+	atomic_init(&self->workers_started, 0);
+	atomic_init(&self->cpu_ns, 0);
+	self->threads = calloc(self->thread_count - 1, sizeof(*self->threads));
+	for (uint32_t index = 0; index + 1 < self->thread_count; index++) {
+		assert_equal(0, pthread_create(&self->threads[index], NULL, line_renderer_worker, self));
+	}
+}
+
+/*
+ * Slot for the next job, to fill in and then submit.  If the queue is full,
+ * the calling thread waits until a slot is free.
+ */
+struct line_job *line_renderer_job(struct line_renderer *self)
+{
+	if (self->thread_count == 1) {
+		return &self->jobs[0];
+	}
+	const uint64_t submitted = atomic_load_explicit(&self->submitted, memory_order_relaxed);
+	if (submitted - atomic_load(&self->retired) == line_renderer_queue_length) {
+		line_renderer_wait_retired(self, submitted + 1 - line_renderer_queue_length);
+	}
+	return &self->jobs[submitted % line_renderer_queue_length];
+}
+
+void line_renderer_submit(struct line_renderer *self)
+{
+	if (self->thread_count == 1) {
+		line_renderer_render(self, 0, &self->jobs[0]);
+		return;
+	}
+	atomic_fetch_add(&self->submitted, 1);
+	line_renderer_wake(&self->work_events, &self->work_waiters, 1);
+}
+
+/* Wait for every job submitted so far to finish */
+void line_renderer_flush(struct line_renderer *self)
+{
+	if (self->thread_count == 1) {
+		return;
+	}
+	line_renderer_wait_retired(self, atomic_load_explicit(&self->submitted, memory_order_relaxed));
+}
+
+/* First sample offset still needed by a job, or (idle) if none is pending */
+offset_t line_renderer_watermark(struct line_renderer *self, offset_t idle)
+{
+	if (self->thread_count == 1) {
+		return idle;
+	}
+	/* Slots are only reused by the calling thread, which this is */
+	uint64_t retired = atomic_load(&self->retired);
+	if (retired == atomic_load_explicit(&self->submitted, memory_order_relaxed)) {
+		return idle;
+	}
+	return self->jobs[retired % line_renderer_queue_length].first;
+}
+
+/* CPU time spent rendering by the workers since last taken, excluding the calling thread's */
+uint64_t line_renderer_take_cpu_ns(struct line_renderer *self)
+{
+	return atomic_exchange(&self->cpu_ns, 0);
+}
+
+void line_renderer_destroy(struct line_renderer *self)
+{
+	line_renderer_flush(self);
+	atomic_store(&self->ending, true);
+	atomic_fetch_add(&self->work_events, 1);
+	syscall(SYS_futex, &self->work_events, FUTEX_WAKE_PRIVATE, INT_MAX, NULL, NULL, 0);
+	for (uint32_t index = 0; index + 1 < self->thread_count; index++) {
+		pthread_join(self->threads[index], NULL);
+	}
+	free(self->threads);
+	for (uint32_t index = 0; index < self->thread_count; index++) {
+		line_resampler_destroy(&self->resamplers[index]);
+		free(self->values[index]);
+	}
+	free(self->resamplers);
+	free(self->values);
+	if (self->chroma_decoders) {
+		for (uint32_t index = 0; index < self->thread_count; index++) {
+			chroma_decoder_destroy(&self->chroma_decoders[index]);
+			free(self->components[index]);
+			free(self->luma[index]);
+		}
+		free(self->chroma_decoders);
+		free(self->components);
+		free(self->luma);
+	}
+	for (size_t index = 0; index < line_renderer_queue_length; index++) {
+		free(self->jobs[index].copy);
+	}
+}
@@ -0,0 +1,90 @@
+#pragma once
+#include "stdinc.h"
+#include "buffer.h"
+#include "chroma_decoder.h"
+#include "line_resampler.h"
+#include "tone_map.h"
+
+#include <pthread.h>
+#include <stdatomic.h>
+
+enum
+{
+	/* Lines in flight at once */
+	line_renderer_queue_length = 64,
+	/* Jobs a worker renders between readings of its CPU time */
+	line_renderer_cpu_time_jobs = 64,
+};
+
+/* One line to resample into a row of the frame */
+struct line_job
+{
+	/* Samples from data[-line_resampler_margin_before - history], the first at offset (first) */
+	const sample_t *data;
+	offset_t first;
+	/* Offset of data[0], which the colour subcarrier's phase follows */
+	offset_t origin;
+	uint32_t begin_fraction;
+	uint64_t duration_fine;
+	uint8_t *row;
+	/* Room to copy the samples of a line that straddles chunks */
+	sample_t *copy;
+};
+
+/*
+ * Renders lines into grey rows or, given a chroma decoder config, rows of
+ * interleaved Y, Cb and Cr, each thread with its own resampler.  With one
+ * thread the caller renders each line as it is submitted.  With more, it
+ * only submits, and the others render: a stage of its own, fed through a
+ * lock-free queue, that the caller waits on only when the queue is full or
+ * it flushes.  Jobs are handed out in the order submitted, but may finish in
+ * any order; the sample data of a job must stay alive until the watermark
+ * passes it.
+ */
+struct line_renderer
+{
+	/* Including the calling thread */
+	uint32_t thread_count;
+	/* Whether each worker keeps to one core, which several decoders in a process would share */
+	bool pin;
+	pthread_t *threads;
+	atomic_bool ending;
+	uint32_t width;
+	const struct tone_map *tone_map;
+	struct line_resampler *resamplers;
+	int32_t **values;
+	/* Colour: a decoder per thread, with rows for its luma, Cb and Cr, or NULL for grey */
+	struct chroma_decoder *chroma_decoders;
+	sample_t **components;
+	uint8_t **luma;
+	/* Samples jobs need before data[-line_resampler_margin_before] and after their last, for colour */
+	size_t history;
+	size_t lookahead;
+	/* Jobs are numbered in order of submission, slot = number % queue length */
+	struct line_job jobs[line_renderer_queue_length];
+	/* Number of the job last finished in each slot, plus one */
+	_Atomic uint64_t finished[line_renderer_queue_length];
+	/* Written by the calling thread alone */
+	_Atomic uint64_t submitted;
+	/* Claimed by workers */
+	_Atomic uint64_t started;
+	/* Oldest job not finished yet */
+	_Atomic uint64_t retired;
+	/* Counted on each submission and each retirement, for threads waiting for either to sleep on */
+	atomic_uint work_events;
+	atomic_uint work_waiters;
+	atomic_uint done_events;
+	atomic_uint done_waiters;
+	/* Workers started, for handing out resamplers */
+	atomic_uint workers_started;
+	/* CPU time of the workers since last taken */
+	_Atomic uint64_t cpu_ns;
+};
+
+void line_renderer_init(struct line_renderer *self, uint32_t thread_count, bool pin, uint32_t width, enum line_resampler_kernel kernel, const struct tone_map *tone_map, const struct chroma_decoder_config *chroma, size_t copy_capacity);
+struct line_job *line_renderer_job(struct line_renderer *self);
+void line_renderer_submit(struct line_renderer *self);
+void line_renderer_flush(struct line_renderer *self);
+offset_t line_renderer_watermark(struct line_renderer *self, offset_t idle);
+uint64_t line_renderer_take_cpu_ns(struct line_renderer *self);
+void line_renderer_destroy(struct line_renderer *self);
@@ -0,0 +1,150 @@
+#include <math.h>
+#include "line_resampler.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static void line_resampler_init_cubic(struct line_resampler *self)
+{
+	const double one = 1 << line_resampler_weight_bits;
+	for (uint32_t fraction = 0; fraction < pulse_fraction_one; fraction++) {
+		double t = fraction / (double) pulse_fraction_one;
+		double t2 = t * t;
+		double t3 = t2 * t;
+		int32_t w0 = lround(one * (-t3 + 2 * t2 - t) / 2);
+		int32_t w2 = lround(one * (-3 * t3 + 4 * t2 + t) / 2);
+		int32_t w3 = lround(one * (t3 - t2) / 2);
+		/* Weights sum to exactly one, so flat signal stays flat */
+		int32_t w1 = (1 << line_resampler_weight_bits) - w0 - w2 - w3;
+		self->cubic_weights[0][fraction] = w0;
+		self->cubic_weights[1][fraction] = w1;
+		self->cubic_weights[2][fraction] = w2;
+		self->cubic_weights[3][fraction] = w3;
+	}
+}
+
+static const struct line_resampler_plan *line_resampler_plan(struct line_resampler *self, uint64_t duration_fine)
+{
+	uint64_t key = duration_fine >> line_resampler_key_shift;
+	struct line_resampler_plan *plan = &self->plans[key % line_resampler_cache_size];
+	if (plan->valid && plan->key == key) {
+		return plan;
+	}
+	uint64_t duration = key << line_resampler_key_shift;
+	for (uint32_t col = 0; col < self->width; col++) {
+		plan->offsets_fine[col] = duration * col / self->width;
+	}
+	plan->key = key;
+	plan->valid = true;
+	return plan;
+}
+
+static inline int32_t line_resampler_linear_at(const sample_t *data, uint32_t position)
+{
+	uint32_t index = position >> pulse_fraction_bits;
+	int32_t fraction = position & (pulse_fraction_one - 1);
+	int32_t before = data[index];
+	int32_t after = data[index + 1];
+	return before + (((after - before) * fraction) >> pulse_fraction_bits);
+}
+
+static inline int32_t line_resampler_cubic_at(const struct line_resampler *self, const sample_t *data, uint32_t position)
+{
+	uint32_t index = position >> pulse_fraction_bits;
+	uint32_t fraction = position & (pulse_fraction_one - 1);
+	const sample_t *taps = &data[index] - 1;
+	int32_t sum = 1 << (line_resampler_weight_bits - 1);
+	for (int tap = 0; tap < 4; tap++) {
+		sum += self->cubic_weights[tap][fraction] * (int32_t) taps[tap];
+	}
+	return sum >> line_resampler_weight_bits;
+}
+
+#ifdef __AVX2__
+/*
+ * Samples are read 32 bits at a time from the low half of each 64-bit sample,
+ * which holds the whole value as long as it fits in 32 bits.
+ */
+static uint32_t line_resampler_render_avx2(const struct line_resampler *self, const sample_t *data, uint32_t begin_fraction, const uint32_t *offsets_fine, int32_t *out)
+{
+	if (sizeof(sample_t) != sizeof(int64_t)) {
+		return 0;
+	}
+	const int *words = (const int *) data;
+	const __m256i begin = _mm256_set1_epi32(begin_fraction);
+	const __m256i fraction_mask = _mm256_set1_epi32(pulse_fraction_one - 1);
+	const __m256i one = _mm256_set1_epi32(1);
+	const uint32_t width = self->width & ~7u;
+	for (uint32_t col = 0; col < width; col += 8) {
+		__m256i position = _mm256_add_epi32(_mm256_loadu_si256((const __m256i *) &offsets_fine[col]), begin);
+		__m256i index = _mm256_srli_epi32(position, pulse_fraction_bits);
+		__m256i fraction = _mm256_and_si256(position, fraction_mask);
+		__m256i value;
+		if (self->kernel == line_resampler_cubic) {
+			const int *weights = (const int *) self->cubic_weights;
+			__m256i sum = _mm256_set1_epi32(1 << (line_resampler_weight_bits - 1));
+			__m256i tap_index = _mm256_sub_epi32(index, one);
+			for (int tap = 0; tap < 4; tap++) {
+				__m256i sample = _mm256_i32gather_epi32(words, tap_index, 8);
+				__m256i weight = _mm256_i32gather_epi32(weights + tap * pulse_fraction_one, fraction, 4);
+				sum = _mm256_add_epi32(sum, _mm256_mullo_epi32(sample, weight));
+				tap_index = _mm256_add_epi32(tap_index, one);
+			}
+			value = _mm256_srai_epi32(sum, line_resampler_weight_bits);
+		} else {
+			__m256i before = _mm256_i32gather_epi32(words, index, 8);
+			__m256i after = _mm256_i32gather_epi32(words, _mm256_add_epi32(index, one), 8);
+			__m256i step = _mm256_mullo_epi32(_mm256_sub_epi32(after, before), fraction);
+			value = _mm256_add_epi32(before, _mm256_srai_epi32(step, pulse_fraction_bits));
+		}
+		_mm256_storeu_si256((__m256i *) &out[col], value);
+	}
+	return width;
+}
+#endif
+
+/******************************************************************************/
+
+void line_resampler_init(struct line_resampler *self, uint32_t width, enum line_resampler_kernel kernel)
+{
+	self->width = width;
+	self->kernel = kernel;
+	for (size_t index = 0; index < line_resampler_cache_size; index++) {
+		struct line_resampler_plan *plan = &self->plans[index];
+		plan->valid = false;
+		plan->key = 0;
+		plan->offsets_fine = malloc(width * sizeof(*plan->offsets_fine));
+	}
+	line_resampler_init_cubic(self);
+}
+
+/*
+ * Render (width) columns spanning (duration_fine) from (begin_fraction) past
+ * data[0], into (out).  The samples from data[-line_resampler_margin_before]
+ * to line_resampler_margin_after past the last one covered must be readable.
+ */
+void line_resampler_render(struct line_resampler *self, const sample_t *data, uint32_t begin_fraction, uint64_t duration_fine, int32_t *out)
+{
+	const struct line_resampler_plan *plan = line_resampler_plan(self, duration_fine);
+	const uint32_t *offsets_fine = plan->offsets_fine;
+	uint32_t col = 0;
+#ifdef __AVX2__
+	col = line_resampler_render_avx2(self, data, begin_fraction, offsets_fine, out);
+#endif
+	if (self->kernel == line_resampler_cubic) {
+		for (; col < self->width; col++) {
+			out[col] = line_resampler_cubic_at(self, data, begin_fraction + offsets_fine[col]);
+		}
+	} else {
+		for (; col < self->width; col++) {
+			out[col] = line_resampler_linear_at(data, begin_fraction + offsets_fine[col]);
+		}
+	}
+}
+
+void line_resampler_destroy(struct line_resampler *self)
+{
+	for (size_t index = 0; index < line_resampler_cache_size; index++) {
+		free(self->plans[index].offsets_fine);
+	}
+}
@@ -0,0 +1,49 @@
+#pragma once
+#include "stdinc.h"
+#include "buffer.h"
+#include "pulse_width.h"
+
+enum line_resampler_kernel
+{
+	line_resampler_linear = 0,
+	line_resampler_cubic,
+};
+
+enum
+{
+	/* Plans cached, direct-mapped by line length */
+	line_resampler_cache_size = 16,
+	/* Line lengths within 2^-4 samples of each other share a plan */
+	line_resampler_key_shift = 4,
+	/* Samples read before the first and after the last sample of a line */
+	line_resampler_margin_before = 1,
+	line_resampler_margin_after = 2,
+	/* Fractional bits of cubic weights */
+	line_resampler_weight_bits = 12,
+};
+
+/* Where each column samples, relative to the start of a line of one length */
+struct line_resampler_plan
+{
+	bool valid;
+	uint64_t key;
+	uint32_t *offsets_fine;
+};
+
+/*
+ * Resamples lines of signal to a fixed number of columns, interpolating
+ * between samples.  The per-column positions of each line length are worked
+ * out once and cached, so rendering a line takes no divisions.
+ */
+struct line_resampler
+{
+	uint32_t width;
+	enum line_resampler_kernel kernel;
+	struct line_resampler_plan plans[line_resampler_cache_size];
+	/* Catmull-Rom weights of the four samples around each sub-sample position */
+	int32_t cubic_weights[4][pulse_fraction_one];
+};
+
+void line_resampler_init(struct line_resampler *self, uint32_t width, enum line_resampler_kernel kernel);
+void line_resampler_render(struct line_resampler *self, const sample_t *data, uint32_t begin_fraction, uint64_t duration_fine, int32_t *out);
+void line_resampler_destroy(struct line_resampler *self);
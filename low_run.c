@@ -0,0 +1,85 @@
+#include "low_run.h"
+
+/* First sample at or after (from) that is not below (threshold), or (end) */
+static size_t low_run_forward(const sample_t *data, size_t from, size_t end, sample_t threshold)
+{
+	size_t index = from;
+	/*
+	 * Whole blocks are compared without branching, so that they vectorise:
+	 * the sign bit survives the AND only if every sample is below threshold
+	 */
+	while (index + low_run_block <= end) {
+		sample_t low = -1;
+		for (size_t offset = 0; offset < low_run_block; offset++) {
+			low &= data[index + offset] - threshold;
+		}
+		if (low >= 0) {
+			break;
+		}
+		index += low_run_block;
+	}
+	while (index < end && data[index] < threshold) {
+		index++;
+	}
+	return index;
+}
+
+/* First sample of the low run containing (from - 1), no earlier than (begin) */
+static size_t low_run_backward(const sample_t *data, size_t begin, size_t from, sample_t threshold)
+{
+	size_t index = from;
+	while (index >= begin + low_run_block) {
+		sample_t low = -1;
+		for (size_t offset = 0; offset < low_run_block; offset++) {
+			low &= data[index - low_run_block + offset] - threshold;
+		}
+		if (low >= 0) {
+			break;
+		}
+		index -= low_run_block;
+	}
+	while (index > begin && data[index - 1] < threshold) {
+		index--;
+	}
+	return index;
+}
+
+static void low_run_measure(const sample_t *data, size_t begin, size_t end, sample_t threshold, size_t at, struct low_run *run)
+{
+	run->begin = low_run_backward(data, begin, at + 1, threshold);
+	run->end = low_run_forward(data, at + 1, end, threshold);
+}
+
+/******************************************************************************/
+
+/*
+ * Find the first run of at least (min_length) samples below (threshold) in
+ * data[begin, end).  Any such run contains one of every (min_length)th
+ * sample, so only those are probed and each hit is then measured out.  A
+ * shorter run is also reported if it reaches (end), as it may continue in the
+ * next chunk.
+ */
+bool low_run_find(const sample_t *data, size_t begin, size_t end, sample_t threshold, size_t min_length, struct low_run *run)
+{
+	if (begin >= end || !min_length) {
+		return false;
+	}
+	size_t probe = begin + min_length - 1;
+	while (probe < end) {
+		if (data[probe] >= threshold) {
+			probe += min_length;
+			continue;
+		}
+		low_run_measure(data, begin, end, threshold, probe, run);
+		if (run->end - run->begin >= min_length || run->end == end) {
+			return true;
+		}
+		/* A long enough run starting after this one still contains a probe */
+		probe = run->end + min_length - 1;
+	}
+	if (data[end - 1] < threshold) {
+		low_run_measure(data, begin, end, threshold, end - 1, run);
+		return true;
+	}
+	return false;
+}
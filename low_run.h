@@ -0,0 +1,18 @@
+#pragma once
+#include "stdinc.h"
+#include "buffer.h"
+
+enum
+{
+	/* Samples compared at a time when measuring a run */
+	low_run_block = 16,
+};
+
+/* Samples [begin, end) below the threshold */
+struct low_run
+{
+	size_t begin;
+	size_t end;
+};
+
+bool low_run_find(const sample_t *data, size_t begin, size_t end, sample_t threshold, size_t min_length, struct low_run *run);
@@ -3,9 +3,12 @@
 #include "errors.h"
 #include "scope.h"
 #include "decoder.h"
-#include "jpeg.h"
+#include "edge_stream.h"
+#include "jpeg_pool.h"
+#include "raw_writer.h"
 
 #include <sched.h>
+#include <errno.h>
 #include <signal.h>
 #include <time.h>
 #include <poll.h>
@@ -31,9 +34,9 @@ enum __attribute__((__packed__)) {
 	ideal_sample_rate_hz = (uint64_t) horizontal_resolution * billion / line_data_ns,
 	sample_rate_hz = ideal_sample_rate_hz < max_sample_rate_hz ? ideal_sample_rate_hz : max_sample_rate_hz,
 	offset_mv = 0,
-	frame_width = 720,
-	frame_height = 625,
 	jpeg_quality = 85,
+	/* Rows handed to the encoder at a time, one JPEG MCU row with chroma subsampling */
+	jpeg_slice_rows = 16,
 	metrics_period_s = 5,
 };
 
@@ -49,21 +52,71 @@ static struct scope_config requested_scope_config = {
 /* With a lot of help from http://martin.hinner.info/vga/pal.html */
 static struct decoder_config decoder_config = {
 	.sample_period_ps = 0,  // Calculated when initialising scope
-	.interlaced = true,
-	.frame_width = frame_width,
-	.frame_height = frame_height,
 	.sync_threshold = 200 + offset_mv,
 	.black_level = 300 + offset_mv,
 	.white_level = 1000 + offset_mv,
 	.max_backlog_samples = sample_rate_hz / 10,  // Must be longer than 2x frame duration
-	.sync_duration_ns = line_ns / 2,
-	.line_duration_ns = line_ns,
-	.equaliser_low_ns = 2350,
-	.vertical_sync_low_ns = line_ns / 2 - 4700,
-	.horizontal_sync_low_ns = 4700,
-	.front_porch_ns = front_porch_ns,
-	.back_porch_ns = back_porch_ns,
-	.tolerance_ns = 250,  // Much higher than needed
+	.specialise = true,
+	.pulse_extraction_threads = 2,  // Only used to catch up when a backlog builds
+	.flywheel = true,
+	.resampler_kernel = line_resampler_cubic,
+	.render_threads = 2,
+	.slice_rows = jpeg_slice_rows,
+};
+
+/* Timing and sync patterns, selectable on the command line */
+static const struct video_standard *video_standard = &video_standard_pal_bg;
+
+/* Picture lines, the standard's unless given on the command line */
+static struct video_active_area active_area;
+static bool active_area_set;
+
+/* Output modes, selectable on the command line, indexed by enum decoder_output */
+static const char *const decoder_output_names[] = {
+	[decoder_output_frame] = "frame",
+	[decoder_output_weave] = "weave",
+	[decoder_output_bob] = "bob",
+	[decoder_output_field] = "field",
+	[decoder_output_single_field] = "single",
+};
+
+/* Size of the images emitted, which depends on the output mode */
+static uint32_t image_width;
+static uint32_t image_height;
+static enum jpeg_format image_format;
+
+/* Formats the images can be written in, selectable on the command line, indexed by enum raw_format */
+static const char *const raw_format_names[] = {
+	[raw_format_none] = "mjpeg",
+	[raw_format_planes] = "raw",
+	[raw_format_y4m] = "y4m",
+	[raw_format_pgm] = "pgm",
+};
+static enum raw_format raw_format;
+static struct raw_timing raw_timing;
+
+/* Threads encoding the full image, several images at once, or each image in strips at once */
+static uint32_t jpeg_threads = 1;
+static uint32_t jpeg_strips = 1;
+
+struct worker
+{
+	const char *name;
+	void (*entry_point)(void *arg);
+	void *arg;
+	pthread_t thread;
+};
+
+/* Where an image is encoded to: the full one to stdout, each smaller one to a file of its own */
+struct image_sink
+{
+	const char *label;
+	const char *path;
+	FILE *file;
+	struct image_exchange *images;
+	uint32_t width;
+	uint32_t height;
+	struct worker worker;
 };
 
 static int ending;
@@ -75,22 +128,25 @@ static pthread_mutex_t mutex;
 static pthread_cond_t analog_signal_cond;
 static struct buffer analog_signal;
 
-static pthread_cond_t image_frames_cond;
-static struct buffer image_frames;
+/* Written by the decoder worker, whose images the encoder reads in place */
+static struct decoder decoder;
 
 static offset_t frame_counter;
+/* Time from an image's last row leaving the decoder until its last JPEG byte */
+static uint64_t image_latency_ns_total;
+static uint64_t image_latency_ns_max;
+static uint64_t image_latency_count;
 static struct decoder_errors decoder_errors;
+static struct decoder_stats decoder_stats;
 
-struct worker
-{
-	const char *name;
-	void (*entry_point)();
-	pthread_t thread;
-};
+/* Optional recording of sync edges, written by the decoder worker */
+static const char *edge_stream_path;
+static FILE *edge_stream_file;
+static struct edge_stream_writer edge_stream_writer;
 
-static void run_receiver();
-static void run_decoder();
-static void run_image_encoder();
+static void run_receiver(void *arg);
+static void run_decoder(void *arg);
+static void run_image_encoder(void *arg);
 
 static struct worker worker_receiver = {
 	.name = "Receiver",
@@ -100,10 +156,29 @@ static struct worker worker_decoder = {
 	.name = "Decoder",
 	.entry_point = run_decoder,
 };
-static struct worker worker_image_encoder = {
-	.name = "Image encoder",
-	.entry_point = run_image_encoder,
+/* The first always, one more for each smaller image asked for */
+static struct image_sink image_sinks[1 + decoder_max_pyramid_levels] = {
+	{
+		.label = "Full",
+		.worker = { .name = "Image encoder", .entry_point = run_image_encoder, .arg = &image_sinks[0], },
+	},
+	{
+		.label = "1/2 size",
+		.worker = { .name = "Encoder 1/2", .entry_point = run_image_encoder, .arg = &image_sinks[1], },
+	},
+	{
+		.label = "1/4 size",
+		.worker = { .name = "Encoder 1/4", .entry_point = run_image_encoder, .arg = &image_sinks[2], },
+	},
 };
+static uint32_t image_sink_count = 1;
+
+static uint64_t monotonic_ns()
+{
+	struct timespec now;
+	assert_equal(0, clock_gettime(CLOCK_MONOTONIC, &now));
+	return now.tv_sec * billion + now.tv_nsec;
+}
 
 static bool is_not_ending()
 {
@@ -122,10 +197,10 @@ static void set_ending(const char *reason)
 	write(ending, &value, sizeof(&value));
 	log("Exiting: %s", reason);
 	pthread_cond_signal(&analog_signal_cond);
-	pthread_cond_signal(&image_frames_cond);
+	decoder_close_images(&decoder);
 }
 
-void run_receiver()
+void run_receiver(void *arg)
 {
 	struct buffer chunks;
 	bool overflow;
@@ -146,13 +221,10 @@ void run_receiver()
 	buffer_destroy(&chunks);
 }
 
-void run_decoder()
+void run_decoder(void *arg)
 {
 	struct buffer chunks;
-	struct decoder decoder;
 	buffer_init(&chunks);
-	decoder_init(&decoder, &decoder_config);
-	const uint32_t frame_bytes = decoder_config.frame_width * decoder_config.frame_height;
 	while (is_not_ending()) {
 		/* Wait for analog signal data */
 		pthread_mutex_lock(&mutex);
@@ -164,49 +236,100 @@ void run_decoder()
 		/* Pass to decoder and accumulate error counters */
 		decoder_bind_and_steal(&decoder, &chunks);
 		decoder_reset_error_counters(&decoder, &decoder_errors);
-		/* Read frame by frame back from decoder */
-		while (decoder_read_frame(&decoder)) {
-			/* Write frame to image encoder queue */
-			pthread_mutex_lock(&mutex);
-			struct buffer_chunk *frame = buffer_append(&image_frames, frame_bytes);
-			frame->offset = frame_counter++;
-			memcpy(frame->data, decoder.frame, frame_bytes);
-			pthread_cond_signal(&image_frames_cond);
-			pthread_mutex_unlock(&mutex);
+		decoder_reset_stats(&decoder, &decoder_stats);
+		/* Decode, handing images to the encoder a slice at a time through decoder.images */
+		struct decoder_slice slice;
+		while (decoder_read_slice(&decoder, &slice)) {
+			if (slice.last) {
+				pthread_mutex_lock(&mutex);
+				frame_counter++;
+				pthread_mutex_unlock(&mutex);
+			}
 		}
 	}
-	decoder_destroy(&decoder);
 	buffer_destroy(&chunks);
-	pthread_cond_signal(&image_frames_cond);
+	decoder_close_images(&decoder);
 }
 
-void run_image_encoder()
+/* Account for the time from an image's last row leaving the decoder until its encoding is out */
+static void record_image_latency(uint64_t completed_ns)
 {
-	struct buffer frames;
-	buffer_init(&frames);
-	while (is_not_ending()) {
-		/* Read raw frame from image encoder queue */
-		pthread_mutex_lock(&mutex);
-		while (buffer_is_empty(&image_frames) && is_not_ending()) {
-			pthread_cond_wait(&image_frames_cond, &mutex);
+	uint64_t latency = monotonic_ns() - completed_ns;
+	pthread_mutex_lock(&mutex);
+	image_latency_ns_total += latency;
+	image_latency_ns_max = latency > image_latency_ns_max ? latency : image_latency_ns_max;
+	image_latency_count++;
+	pthread_mutex_unlock(&mutex);
+}
+
+/* Write the whole of (data), which a pipe may take in more than one go */
+static bool write_all(int fd, const uint8_t *data, size_t length)
+{
+	while (length) {
+		ssize_t written = write(fd, data, length);
+		if (written < 0 && errno == EINTR) {
+			continue;
 		}
-		buffer_concatenate(&frames, &image_frames);
-		pthread_mutex_unlock(&mutex);
-		/* Encode and emit frame / notify about frame */
-		if (isatty(STDOUT_FILENO)) {
-			log("Frame decoded!");
-		} else {
-			struct buffer_chunk *frame = frames.tail;
-			while (frame) {
-				if (!jpeg_write_image(stdout, frame_width, frame_height, false, frame->data, jpeg_quality)) {
-					set_ending("Encoder worker failed to write JPEG");
-				}
-				frame = frame->next;
+		if (written <= 0) {
+			return false;
+		}
+		data += written;
+		length -= written;
+	}
+	return true;
+}
+
+/* Write out each JPEG whole as the pool emits it, in order */
+static void write_image(void *arg, const uint8_t *data, size_t length, uint64_t completed_ns)
+{
+	struct image_sink *sink = arg;
+	if (!data || !write_all(fileno(sink->file), data, length)) {
+		set_ending("Encoder worker failed to write JPEG");
+	}
+	if (sink == &image_sinks[0]) {
+		record_image_latency(completed_ns);
+	}
+}
+
+void run_image_encoder(void *arg)
+{
+	struct image_sink *sink = arg;
+	const bool full = sink == &image_sinks[0];
+	const bool tty = isatty(fileno(sink->file));
+	const bool raw = !tty && raw_format != raw_format_none;
+	/* Images are copied to the pool as their rows are published, each encoded by one of its threads */
+	struct jpeg_pool jpeg;
+	if (!tty && !raw) {
+		jpeg_pool_init(&jpeg, full ? jpeg_threads : 1, full ? jpeg_strips : 1, sink->width, sink->height, image_format, jpeg_quality, write_image, sink);
+	}
+	/* Or written uncompressed, from the image in place as it is read */
+	struct raw_writer writer;
+	if (raw) {
+		raw_writer_init(&writer, fileno(sink->file), raw_format, sink->width, sink->height, sink->images->row_bytes / sink->width, &raw_timing);
+	}
+	struct image_exchange_slice slice;
+	/* Encode rows as they are published, and emit frame / notify about frame */
+	while (image_exchange_read(sink->images, &slice)) {
+		if (raw) {
+			const uint8_t *image = slice.rows - slice.first_row * sink->images->row_bytes;
+			if (!raw_writer_add_rows(&writer, image, slice.first_row, slice.row_count)) {
+				set_ending("Encoder worker failed to write image");
 			}
+			if (slice.last && full) {
+				record_image_latency(slice.completed_ns);
+			}
+		} else if (!tty) {
+			jpeg_pool_add_rows(&jpeg, slice.rows, slice.first_row, slice.row_count, slice.completed_ns);
+		} else if (slice.last && full) {
+			log("Frame decoded!");
+			record_image_latency(slice.completed_ns);
 		}
-		buffer_clear(&frames);
 	}
-	buffer_destroy(&frames);
+	if (raw) {
+		raw_writer_destroy(&writer);
+	} else if (!tty) {
+		jpeg_pool_destroy(&jpeg);
+	}
 }
 
 static void log_metrics()
@@ -214,11 +337,28 @@ static void log_metrics()
 	static offset_t prev_frames;
 	pthread_mutex_lock(&mutex);
 	struct decoder_errors errors = decoder_errors;
+	struct decoder_stats stats = decoder_stats;
 	offset_t frames = frame_counter;
+	uint64_t latency_count = image_latency_count;
+	uint64_t latency_ns_total = image_latency_ns_total;
+	uint64_t latency_ns_max = image_latency_ns_max;
 	pthread_mutex_unlock(&mutex);
 	float fps = (frames - prev_frames) * 1.0f / metrics_period_s;
 	prev_frames = frames;
 	log("Frames emitted so far: %lu @ %.1fHz", frames, fps);
+	if (latency_count) {
+		log(
+			"Image latency since start, last row decoded to last byte written: mean = %.1fms, worst = %.1fms",
+			latency_ns_total / 1e6 / latency_count,
+			latency_ns_max / 1e6
+		);
+	}
+	for (uint32_t index = 0; index < image_sink_count; index++) {
+		uint64_t dropped = image_exchange_dropped(image_sinks[index].images);
+		if (dropped) {
+			log("%s images dropped since start, as the encoder was busy: %lu", image_sinks[index].label, dropped);
+		}
+	}
 	if (errors.no_signal_or_overrun) {
 		log("Decoder errors since start: no_signal_or_overrun = %lu", errors.no_signal_or_overrun);
 	}
@@ -231,6 +371,25 @@ static void log_metrics()
 	if (errors.unrecognised_sync_pattern) {
 		log("Decoder errors since start: unrecognised_sync_pattern = %lu", errors.unrecognised_sync_pattern);
 	}
+	if (errors.missing_horizontal_sync) {
+		log("Decoder errors since start: missing_horizontal_sync = %lu", errors.missing_horizontal_sync);
+	}
+	if (errors.missing_vertical_sync) {
+		log("Decoder errors since start: missing_vertical_sync = %lu", errors.missing_vertical_sync);
+	}
+	if (stats.acquisitions) {
+		log(
+			"Sync acquisitions since start: %lu, time to lock mean = %.1fms, worst = %.1fms",
+			stats.acquisitions,
+			stats.acquisition_ns_total / 1e6 / stats.acquisitions,
+			stats.acquisition_ns_max / 1e6
+		);
+	}
+	log(
+		"CPU time since start: sync stage = %.2fs, render stage = %.2fs",
+		stats.sync_cpu_ns / 1e9,
+		stats.render_cpu_ns / 1e9
+	);
 }
 
 static void *worker_wrapper(void *arg)
@@ -238,7 +397,7 @@ static void *worker_wrapper(void *arg)
 	const struct worker *worker = arg;
 	assert_equal(0, pthread_setname_np(pthread_self(), worker->name));
 	log("Starting worker %s", worker->name);
-	worker->entry_point();
+	worker->entry_point(worker->arg);
 	log("Exiting worker %s", worker->name);
 	return NULL;
 }
@@ -257,7 +416,9 @@ static void start_pipeline()
 {
 	start_worker(&worker_receiver);
 	start_worker(&worker_decoder);
-	start_worker(&worker_image_encoder);
+	for (uint32_t index = 0; index < image_sink_count; index++) {
+		start_worker(&image_sinks[index].worker);
+	}
 }
 
 static void stop_pipeline()
@@ -265,7 +426,9 @@ static void stop_pipeline()
 	set_ending("Pipeline stopping");
 	wait_worker(&worker_receiver);
 	wait_worker(&worker_decoder);
-	wait_worker(&worker_image_encoder);
+	for (uint32_t index = 0; index < image_sink_count; index++) {
+		wait_worker(&image_sinks[index].worker);
+	}
 }
 
 static void main_loop()
@@ -331,31 +494,221 @@ static void main_loop()
 	close(ending);
 }
 
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s [-s standard] [-o output] [-c] [-t] [-r left,top,width,height] [-d columns,rows] [-a first-line,height] [-p smaller-mjpeg-file]... [-j jpeg-threads[,strips]] [-f format] [-e edge-stream-file]\n", name);
+	fprintf(stderr, "  -c       Decode colour, sampling at 4x the subcarrier\n");
+	fprintf(stderr, "  -t       Pin each render thread to a core of its own, of those this process may use\n");
+	fprintf(stderr, "  -r       Emit only this part of the output's image (zero size for the rest)\n");
+	fprintf(stderr, "  -d       Emit every nth column and row of that\n");
+	fprintf(stderr, "  -a       Lines of each field to pass over after its vertical sync, and picture lines (0 for all lines)\n");
+	fprintf(stderr, "  -p       Also write MJPEG at half size to a file, again for a quarter\n");
+	fprintf(stderr, "  -j       Threads encoding full size images, several at once, still written in order\n");
+	fprintf(stderr, "           With strips, each image is split into that many, encoded at once for less latency\n");
+	fprintf(stderr, "  -f       Format of every image file: mjpeg (default), or uncompressed:\n");
+	fprintf(stderr, "           raw (grey, or Y, Cb and Cr planes), y4m, or pgm (of grey or Y alone)\n");
+	fprintf(stderr, "Standards:\n");
+	for (size_t index = 0; video_standard_get(index); index++) {
+		const struct video_standard *standard = video_standard_get(index);
+		fprintf(stderr, "  %-8s %s\n", standard->name, standard->description);
+	}
+	fprintf(stderr, "Outputs (interlaced standards):\n");
+	fprintf(stderr, "  frame    Whole frames, at frame rate (default)\n");
+	fprintf(stderr, "  weave    Whole frames, at field rate\n");
+	fprintf(stderr, "  bob      Line-doubled fields, at field rate\n");
+	fprintf(stderr, "  field    Half-height fields, at field rate\n");
+	fprintf(stderr, "  single   The first field of each frame, half height, at frame rate\n");
+	exit(1);
+}
+
+static bool find_output(const char *name, enum decoder_output *output)
+{
+	for (size_t index = 0; index < sizeof(decoder_output_names) / sizeof(decoder_output_names[0]); index++) {
+		if (strcmp(decoder_output_names[index], name) == 0) {
+			*output = index;
+			return true;
+		}
+	}
+	return false;
+}
+
+static bool find_raw_format(const char *name, enum raw_format *format)
+{
+	for (size_t index = 0; index < sizeof(raw_format_names) / sizeof(raw_format_names[0]); index++) {
+		if (strcmp(raw_format_names[index], name) == 0) {
+			*format = index;
+			return true;
+		}
+	}
+	return false;
+}
+
+static void parse_args(int argc, char *argv[])
+{
+	int opt;
+	while ((opt = getopt(argc, argv, "s:o:ctr:d:a:p:j:f:e:")) != -1) {
+		switch (opt) {
+		case 's':
+			video_standard = video_standard_find(optarg);
+			if (!video_standard) {
+				fprintf(stderr, "Unknown video standard: %s\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 'o':
+			if (!find_output(optarg, &decoder_config.output)) {
+				fprintf(stderr, "Unknown output: %s\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 'c':
+			decoder_config.colour = true;
+			break;
+		case 't':
+			decoder_config.pin_render_threads = true;
+			break;
+		case 'r':
+			if (sscanf(optarg, "%u,%u,%u,%u", &decoder_config.crop.left, &decoder_config.crop.top, &decoder_config.crop.width, &decoder_config.crop.height) != 4) {
+				fprintf(stderr, "Invalid region: %s\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 'd':
+			if (sscanf(optarg, "%u,%u", &decoder_config.horizontal_decimation, &decoder_config.vertical_decimation) != 2) {
+				fprintf(stderr, "Invalid decimation: %s\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 'a':
+			if (sscanf(optarg, "%u,%u", &active_area.first_line, &active_area.height) != 2) {
+				fprintf(stderr, "Invalid active area: %s\n", optarg);
+				usage(argv[0]);
+			}
+			active_area_set = true;
+			break;
+		case 'p':
+			if (image_sink_count == sizeof(image_sinks) / sizeof(image_sinks[0])) {
+				fprintf(stderr, "Too many smaller images: %s\n", optarg);
+				usage(argv[0]);
+			}
+			image_sinks[image_sink_count++].path = optarg;
+			break;
+		case 'j':
+			if (sscanf(optarg, "%u,%u", &jpeg_threads, &jpeg_strips) < 1 || !jpeg_threads || !jpeg_strips) {
+				fprintf(stderr, "Invalid JPEG encoder threads: %s\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 'f':
+			if (!find_raw_format(optarg, &raw_format)) {
+				fprintf(stderr, "Unknown format: %s\n", optarg);
+				usage(argv[0]);
+			}
+			break;
+		case 'e':
+			edge_stream_path = optarg;
+			break;
+		default:
+			usage(argv[0]);
+		}
+	}
+	if (optind != argc) {
+		usage(argv[0]);
+	}
+}
+
 int main(int argc, char *argv[])
 {
+	parse_args(argc, argv);
+	/* Colour needs more than the default rate, to keep demodulation images clear of the chroma band */
+	if (decoder_config.colour) {
+		uint64_t subcarrier_millihertz = video_standard->timing.colour_subcarrier_millihertz;
+		if (!subcarrier_millihertz) {
+			fatal_error("No colour decoding for %s", video_standard->description);
+		}
+		uint64_t colour_sample_rate_hz = 4 * subcarrier_millihertz / thousand;
+		requested_scope_config.user_sample_period_ps = trillion / colour_sample_rate_hz;
+		requested_scope_config.chunk_max_samples = colour_sample_rate_hz / 200;
+		decoder_config.max_backlog_samples = colour_sample_rate_hz / 10;
+		/* Under the troughs of the burst, which swings 3/14 of the luma range either side of black */
+		decoder_config.sync_threshold = 100 + offset_mv;
+	}
 	struct scope_config actual_scope_config;
 	scope_init(&scope, &requested_scope_config, &actual_scope_config);
 	decoder_config.sample_period_ps = actual_scope_config.user_sample_period_ps;
+	decoder_config_set_standard(&decoder_config, video_standard);
+	if (active_area_set) {
+		decoder_config.active_area = active_area;
+	}
+	log("Video standard: %s", video_standard->description);
+	decoder_image_size(&decoder_config, &image_width, &image_height);
+	image_format = decoder_image_components(&decoder_config) == 3 ? jpeg_format_ycbcr : jpeg_format_grey;
+	log("Output: %s, %ux%u %s, %s", decoder_output_names[decoder_config.output], image_width, image_height, image_format == jpeg_format_grey ? "grey" : "colour", raw_format_names[raw_format]);
+	/* Images come a frame apart, or a field apart in the modes that emit every field */
+	const struct video_timing *timing = &decoder_config.timing;
+	const bool every_field = timing->interlaced && (decoder_config.output == decoder_output_weave || decoder_config.output == decoder_output_bob || decoder_config.output == decoder_output_field);
+	raw_timing.rate_numerator = every_field ? 2000000000 : 1000000000;
+	raw_timing.rate_denominator = (uint64_t) timing->line_duration_ns * timing->frame_height;
+	raw_timing.interlaced = timing->interlaced && (decoder_config.output == decoder_output_frame || decoder_config.output == decoder_output_weave);
+	/* Edge stream recording */
+	if (edge_stream_path) {
+		edge_stream_file = fopen(edge_stream_path, "wb");
+		if (!edge_stream_file) {
+			fatal_error("Failed to open edge stream file %s", edge_stream_path);
+		}
+		edge_stream_writer_init(&edge_stream_writer, edge_stream_file, decoder_config.sample_period_ps, decoder_config.sync_threshold);
+		log("Recording sync edges to %s", edge_stream_path);
+	}
 	/* Inter-thread queues */
 	buffer_init(&analog_signal);
-	buffer_init(&image_frames);
 	/* Synchronisation primitives */
 	pthread_mutex_init(&mutex, NULL);
 	pthread_cond_init(&analog_signal_cond, NULL);
-	pthread_cond_init(&image_frames_cond, NULL);
 	/* Real-time scheduling */
 	struct sched_param sched_param;
 	sched_param.sched_priority = sched_get_priority_max(SCHED_RR);
 	sched_setscheduler(0, SCHED_RR, &sched_param);
+	/* Decoder, after real-time scheduling so that its worker threads inherit it */
+	decoder_config.pyramid_levels = image_sink_count - 1;
+	decoder_init(&decoder, &decoder_config);
+	if (edge_stream_file) {
+		decoder_record_edges(&decoder, &edge_stream_writer);
+	}
+	/* Image sinks, each smaller image from the same decoding pass as the full one */
+	image_sinks[0].file = stdout;
+	image_sinks[0].images = &decoder.images;
+	image_sinks[0].width = image_width;
+	image_sinks[0].height = image_height;
+	for (uint32_t index = 1; index < image_sink_count; index++) {
+		struct image_sink *sink = &image_sinks[index];
+		struct decoder_pyramid_level *level = &decoder.pyramid[index - 1];
+		sink->file = fopen(sink->path, "wb");
+		if (!sink->file) {
+			fatal_error("Failed to open image file %s", sink->path);
+		}
+		sink->images = &level->images;
+		sink->width = level->width;
+		sink->height = level->height;
+		log("Also writing %s images, %ux%u, to %s", sink->label, sink->width, sink->height, sink->path);
+	}
 	/* Main loop */
 	main_loop();
+	/* Image sinks */
+	for (uint32_t index = 1; index < image_sink_count; index++) {
+		fclose(image_sinks[index].file);
+	}
+	/* Decoder */
+	decoder_destroy(&decoder);
 	/* Synchronisation primitives */
 	pthread_cond_destroy(&analog_signal_cond);
-	pthread_cond_destroy(&image_frames_cond);
 	pthread_mutex_destroy(&mutex);
 	/* Inter-thread queues */
-	buffer_destroy(&image_frames);
 	buffer_destroy(&analog_signal);
+	/* Edge stream recording */
+	if (edge_stream_file) {
+		edge_stream_writer_destroy(&edge_stream_writer);
+		fclose(edge_stream_file);
+	}
 	log("Shutting down scope");
 	scope_destroy(&scope);
 }
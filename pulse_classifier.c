@@ -0,0 +1,133 @@
+/* Before errors.h, whose log() macro would otherwise clash */
+#include <math.h>
+
+#include "pulse_classifier.h"
+#include "pulse_width.h"
+#include "errors.h"
+
+/* Fine units either side of a band that might hold a boundary, against rounding in working it out */
+static const double pulse_classifier_slack_fine = 1;
+
+/* Fine values where a comparison surely holds (inner) and where it might (outer), on one axis */
+struct pulse_classifier_band
+{
+	double inner_min;
+	double inner_max;
+	double outer_min;
+	double outer_max;
+};
+
+/*
+ * Whole nanoseconds from fine units, rounded down, are (ns) <= x < (ns) + 1
+ * where x is the exact time.  So the duration of a pulse is within tolerance
+ * for exactly x in [reference - tolerance, reference + tolerance + 1).  Its
+ * low time, the difference of two such, is within 1ns of exact either way,
+ * so it surely matches for x in [reference - tolerance, reference +
+ * tolerance] and surely not outside (reference - tolerance - 1, reference +
+ * tolerance + 1).
+ */
+static void pulse_classifier_band(struct pulse_classifier_band *band, double fine_per_ns, double inner_min_ns, double inner_max_ns, double outer_min_ns, double outer_max_ns)
+{
+	band->inner_min = inner_min_ns * fine_per_ns + pulse_classifier_slack_fine;
+	band->inner_max = inner_max_ns * fine_per_ns - pulse_classifier_slack_fine;
+	band->outer_min = outer_min_ns * fine_per_ns - pulse_classifier_slack_fine;
+	band->outer_max = outer_max_ns * fine_per_ns + pulse_classifier_slack_fine;
+}
+
+/* First and last values of (bin) */
+static void pulse_classifier_bin_extent(uint32_t bin, uint64_t origin, uint64_t range, uint64_t scale, double *first, double *last)
+{
+	uint64_t begin = (((uint64_t) bin << 32) + scale - 1) / scale;
+	uint64_t end = bin + 1 < pulse_classifier_bins ? (((uint64_t) (bin + 1) << 32) + scale - 1) / scale : range;
+	*first = origin + begin;
+	*last = origin + end - 1;
+}
+
+/******************************************************************************/
+
+void pulse_classifier_init(struct pulse_classifier *self, const struct pulse_prototype *prototypes, size_t count, uint32_t sample_period_ps)
+{
+	assert_equal(true, count > 0);
+	self->prototypes = malloc(count * sizeof(*prototypes));
+	memcpy(self->prototypes, prototypes, count * sizeof(*prototypes));
+	self->prototype_count = count;
+	self->sample_period_ps = sample_period_ps;
+	const double fine_per_ns = (1000.0 * pulse_fraction_one) / sample_period_ps;
+	struct pulse_classifier_band *durations = calloc(count, sizeof(*durations));
+	struct pulse_classifier_band *lows = calloc(count, sizeof(*lows));
+	double duration_min = INFINITY;
+	double duration_max = 0;
+	double low_min = INFINITY;
+	double low_max = 0;
+	for (size_t index = 0; index < count; index++) {
+		const struct pulse_prototype *prototype = &prototypes[index];
+		const double tolerance = prototype->tolerance_ns;
+		const double duration = prototype->duration_ns;
+		const double low = prototype->low_ns;
+		pulse_classifier_band(&durations[index], fine_per_ns, duration - tolerance, duration + tolerance + 1, duration - tolerance, duration + tolerance + 1);
+		pulse_classifier_band(&lows[index], fine_per_ns, low - tolerance, low + tolerance, low - tolerance - 1, low + tolerance + 1);
+		duration_min = fmin(duration_min, durations[index].outer_min);
+		duration_max = fmax(duration_max, durations[index].outer_max);
+		low_min = fmin(low_min, lows[index].outer_min);
+		low_max = fmax(low_max, lows[index].outer_max);
+	}
+	/* Anything outside the outer bands of every prototype matches none of them */
+	self->duration_origin = duration_min > 0 ? (uint64_t) duration_min : 0;
+	self->duration_range = (uint64_t) duration_max + 1 - self->duration_origin;
+	self->duration_scale = ((uint64_t) pulse_classifier_bins << 32) / self->duration_range;
+	self->low_origin = low_min > 0 ? (uint64_t) low_min : 0;
+	self->low_range = (uint64_t) low_max + 1 - self->low_origin;
+	self->low_scale = ((uint64_t) pulse_classifier_bins << 32) / self->low_range;
+	/* Scale rounds down, so the last value in range must still land in the last bin */
+	assert_equal(pulse_classifier_bins - 1, (self->duration_range - 1) * self->duration_scale >> 32);
+	assert_equal(pulse_classifier_bins - 1, (self->low_range - 1) * self->low_scale >> 32);
+	self->table = calloc(pulse_classifier_stride * pulse_classifier_stride, sizeof(*self->table));
+	for (uint32_t duration = 0; duration < pulse_classifier_bins; duration++) {
+		double duration_first;
+		double duration_last;
+		pulse_classifier_bin_extent(duration, self->duration_origin, self->duration_range, self->duration_scale, &duration_first, &duration_last);
+		for (uint32_t low = 0; low < pulse_classifier_bins; low++) {
+			double low_first;
+			double low_last;
+			pulse_classifier_bin_extent(low, self->low_origin, self->low_range, self->low_scale, &low_first, &low_last);
+			/* The first prototype that the cell is not wholly outside decides it, unless the cell straddles its edge */
+			uint8_t type = 0;
+			for (size_t index = 0; index < count; index++) {
+				const struct pulse_classifier_band *d = &durations[index];
+				const struct pulse_classifier_band *l = &lows[index];
+				if (duration_last < d->outer_min || duration_first > d->outer_max || low_last < l->outer_min || low_first > l->outer_max) {
+					continue;
+				}
+				bool inside = duration_first >= d->inner_min && duration_last <= d->inner_max && low_first >= l->inner_min && low_last <= l->inner_max;
+				type = inside ? prototypes[index].type : pulse_classifier_boundary;
+				break;
+			}
+			self->table[duration * pulse_classifier_stride + low] = type;
+		}
+	}
+	free(durations);
+	free(lows);
+	/* Anything outside the range matches nothing, on either side of it */
+	const uint64_t duration_fine = self->duration_origin + self->duration_range / 2;
+	const uint64_t low_fine = self->low_origin + self->low_range / 2;
+	assert_equal(0, pulse_classifier_classify(self, self->duration_origin + self->duration_range, low_fine));
+	assert_equal(0, pulse_classifier_classify(self, duration_fine, self->low_origin + self->low_range));
+	if (self->duration_origin) {
+		assert_equal(0, pulse_classifier_classify(self, self->duration_origin - 1, low_fine));
+	}
+	if (self->low_origin) {
+		assert_equal(0, pulse_classifier_classify(self, duration_fine, self->low_origin - 1));
+	}
+}
+
+/* The chain of comparisons in whole nanoseconds that the table stands for */
+char pulse_classifier_compare(const struct pulse_classifier *self, uint64_t duration_fine, uint64_t low_fine)
+{
+	return pulse_classifier_match(self->prototypes, self->prototype_count, self->sample_period_ps, duration_fine, low_fine);
+}
+
+void pulse_classifier_destroy(struct pulse_classifier *self)
+{
+	free(self->table);
+	free(self->prototypes);
+}
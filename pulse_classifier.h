@@ -0,0 +1,142 @@
+#pragma once
+#include "stdinc.h"
+#include "pulse_width.h"
+
+enum
+{
+	/* Quantisation steps per axis; one more bin on each catches everything out of range */
+	pulse_classifier_bins = 256,
+	pulse_classifier_stride = pulse_classifier_bins + 1,
+	/* Table entry for cells that a tolerance boundary passes through, resolved by comparing exactly */
+	pulse_classifier_boundary = 1,
+};
+
+/* Reference pulse shape, as the standard gives it */
+struct pulse_prototype
+{
+	char type;
+	uint32_t duration_ns;
+	uint32_t low_ns;
+	uint32_t tolerance_ns;
+};
+
+/*
+ * Classifies pulses by (duration, low time) in fine sample units, as a chain
+ * of comparisons in whole nanoseconds would, the first match winning, or 0
+ * where none does.  One lookup in a table built from a list of prototypes
+ * gives the answer wherever it is the same across a cell; cells that a
+ * tolerance boundary passes through fall back to the comparisons.  Each axis
+ * only spans the range covered by the prototypes, so that 256 steps leave
+ * few cells of the real pulses on a boundary.
+ */
+struct pulse_classifier
+{
+	uint64_t duration_origin;
+	uint64_t duration_range;
+	uint64_t duration_scale;
+	uint64_t low_origin;
+	uint64_t low_range;
+	uint64_t low_scale;
+	uint8_t *table;
+	struct pulse_prototype *prototypes;
+	size_t prototype_count;
+	uint32_t sample_period_ps;
+};
+
+void pulse_classifier_init(struct pulse_classifier *self, const struct pulse_prototype *prototypes, size_t count, uint32_t sample_period_ps);
+char pulse_classifier_compare(const struct pulse_classifier *self, uint64_t duration_fine, uint64_t low_fine);
+void pulse_classifier_destroy(struct pulse_classifier *self);
+
+static inline bool pulse_classifier_similar(uint32_t measurement, uint32_t reference, uint32_t tolerance)
+{
+	int32_t difference = measurement;
+	difference -= reference;
+	return (uint32_t) abs(difference) <= tolerance;
+}
+
+/*
+ * The chain of comparisons in whole nanoseconds, first match winning.  Always
+ * inlined, so that with the prototypes and sample period known at compile
+ * time it comes down to multiplications and constant bounds.
+ */
+static inline __attribute__((always_inline)) char pulse_classifier_match(const struct pulse_prototype *prototypes, size_t count, uint32_t sample_period_ps, uint64_t duration_fine, uint64_t low_fine)
+{
+	const uint32_t duration_ns = (duration_fine * sample_period_ps / 1000) >> pulse_fraction_bits;
+	const uint32_t high_ns = ((duration_fine - low_fine) * sample_period_ps / 1000) >> pulse_fraction_bits;
+	const uint32_t low_ns = duration_ns - high_ns;
+	#pragma GCC unroll 8
+	for (size_t index = 0; index < count; index++) {
+		const struct pulse_prototype *prototype = &prototypes[index];
+		if (pulse_classifier_similar(duration_ns, prototype->duration_ns, prototype->tolerance_ns) && pulse_classifier_similar(low_ns, prototype->low_ns, prototype->tolerance_ns)) {
+			return prototype->type;
+		}
+	}
+	return 0;
+}
+
+/* Least fine value that is at least (ns), or so many whole nanoseconds once rounded down */
+static inline uint64_t pulse_classifier_fine_at_least(uint32_t ns, uint32_t sample_period_ps)
+{
+	return (((uint64_t) ns * 1000 << pulse_fraction_bits) + sample_period_ps - 1) / sample_period_ps;
+}
+
+/* Greatest fine value that is at most (ns) */
+static inline uint64_t pulse_classifier_fine_at_most(uint32_t ns, uint32_t sample_period_ps)
+{
+	return ((uint64_t) ns * 1000 << pulse_fraction_bits) / sample_period_ps;
+}
+
+/*
+ * What pulse_classifier_match gives, with each prototype's bounds in fine
+ * units, so that with the prototypes and sample period known at compile time
+ * they are all constants.  A duration rounded down to whole nanoseconds is
+ * within bounds for exactly a range of fine values.  A low time, as the
+ * difference of two rounded times, is only sure to be within bounds for fine
+ * values within them, and sure not to be for those a nanosecond or more
+ * outside; between, it takes the comparisons.
+ */
+static inline __attribute__((always_inline)) char pulse_classifier_match_fine(const struct pulse_prototype *prototypes, size_t count, uint32_t sample_period_ps, uint64_t duration_fine, uint64_t low_fine)
+{
+	#pragma GCC unroll 8
+	for (size_t index = 0; index < count; index++) {
+		const struct pulse_prototype *prototype = &prototypes[index];
+		const uint32_t tolerance = prototype->tolerance_ns;
+		if (duration_fine < pulse_classifier_fine_at_least(prototype->duration_ns - tolerance, sample_period_ps) || duration_fine >= pulse_classifier_fine_at_least(prototype->duration_ns + tolerance + 1, sample_period_ps)) {
+			continue;
+		}
+		const uint32_t low_min_ns = prototype->low_ns - tolerance;
+		const uint32_t low_max_ns = prototype->low_ns + tolerance;
+		const uint64_t low_min = pulse_classifier_fine_at_least(low_min_ns, sample_period_ps);
+		const uint64_t low_max = pulse_classifier_fine_at_most(low_max_ns, sample_period_ps);
+		if (low_fine >= low_min && low_fine <= low_max) {
+			return prototype->type;
+		}
+		bool near = low_fine < low_min ? low_fine > pulse_classifier_fine_at_most(low_min_ns - 1, sample_period_ps) : low_fine < pulse_classifier_fine_at_least(low_max_ns + 1, sample_period_ps);
+		if (near) {
+			/* Every prototype before surely does not match, so the comparisons agree on those */
+			return pulse_classifier_match(prototypes, count, sample_period_ps, duration_fine, low_fine);
+		}
+	}
+	return 0;
+}
+
+static inline uint32_t pulse_classifier_bin(uint64_t value, uint64_t origin, uint64_t range, uint64_t scale)
+{
+	/* Below the origin wraps around, so goes to the out-of-range bin along with anything above */
+	uint64_t offset = value - origin;
+	if (offset >= range) {
+		return pulse_classifier_bins;
+	}
+	return (offset * scale) >> 32;
+}
+
+static inline char pulse_classifier_classify(const struct pulse_classifier *self, uint64_t duration_fine, uint64_t low_fine)
+{
+	uint32_t duration = pulse_classifier_bin(duration_fine, self->duration_origin, self->duration_range, self->duration_scale);
+	uint32_t low = pulse_classifier_bin(low_fine, self->low_origin, self->low_range, self->low_scale);
+	char type = self->table[duration * pulse_classifier_stride + low];
+	if (type == pulse_classifier_boundary) {
+		return pulse_classifier_compare(self, duration_fine, low_fine);
+	}
+	return type;
+}
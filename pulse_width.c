@@ -3,33 +3,35 @@
 void pulse_analyser_init(struct pulse_analyser *self, uint64_t initial_offset, bool right_aligned)
 {
 	self->right_aligned = right_aligned;
-	self->rise_at = initial_offset;
-	self->fall_at = initial_offset;
+	self->rise_at_fine = initial_offset << pulse_fraction_bits;
+	self->fall_at_fine = initial_offset << pulse_fraction_bits;
 	self->last_state = !right_aligned;
 }
 
-bool pulse_analyser_transition(struct pulse_analyser *self, uint64_t offset, bool state, struct pulse_info *info)
+bool pulse_analyser_transition(struct pulse_analyser *self, uint64_t fine_offset, bool state, struct pulse_info *info)
 {
 	bool actually_transitioned = state != self->last_state;
 	bool correct_edge = state != self->right_aligned;
-	bool have_all_timings = self->rise_at != self->fall_at;
+	bool have_all_timings = self->rise_at_fine != self->fall_at_fine;
 	bool is_valid = actually_transitioned && correct_edge && have_all_timings;
 	if (is_valid) {
 		if (state) {
-			info->start = self->rise_at;
-			info->transition = self->fall_at;
-			info->end = offset;
+			info->start_fine = self->rise_at_fine;
+			info->transition_fine = self->fall_at_fine;
 		} else {
-			info->start = self->fall_at;
-			info->transition = self->rise_at;
-			info->end = offset;
+			info->start_fine = self->fall_at_fine;
+			info->transition_fine = self->rise_at_fine;
 		}
+		info->end_fine = fine_offset;
+		info->start = pulse_fine_to_offset(info->start_fine);
+		info->transition = pulse_fine_to_offset(info->transition_fine);
+		info->end = pulse_fine_to_offset(info->end_fine);
 		is_valid = info->end > info->transition && info->transition > info->start;
 	}
 	if (state) {
-		self->rise_at = offset;
+		self->rise_at_fine = fine_offset;
 	} else {
-		self->fall_at = offset;
+		self->fall_at_fine = fine_offset;
 	}
 	self->last_state = state;
 	return is_valid;
@@ -37,8 +39,8 @@ bool pulse_analyser_transition(struct pulse_analyser *self, uint64_t offset, boo
 
 void pulse_analyser_reset(struct pulse_analyser *self, uint64_t offset)
 {
-	self->rise_at = offset;
-	self->fall_at = offset;
+	self->rise_at_fine = offset << pulse_fraction_bits;
+	self->fall_at_fine = offset << pulse_fraction_bits;
 }
 
 void pulse_analyser_destroy(struct pulse_analyser *self)
@@ -51,6 +53,13 @@ void pulse_stream_reader_init(struct pulse_stream_reader *self, struct pulse_ana
 	self->pulse_analyser = pulse_analyser;
 	self->threshold = threshold;
 	self->previous_state = initial_state;
+	/* Any value on the correct side of the threshold, so the first crossing interpolates sanely */
+	self->previous_sample = initial_state ? threshold : threshold - 1;
+	self->signal_state = initial_state;
+	self->resync_pending = false;
+	self->last_edge_fine = initial_offset << pulse_fraction_bits;
+	self->position = initial_offset;
+	self->recorder = NULL;
 	pulse_stream_reader_reset(self);
 	pulse_stream_reader_bind(self, NULL);
 }
@@ -58,46 +67,406 @@ void pulse_stream_reader_init(struct pulse_stream_reader *self, struct pulse_ana
 void pulse_stream_reader_bind(struct pulse_stream_reader *self, struct buffer_chunk *buffer)
 {
 	self->buffer = buffer;
+	self->edges = NULL;
 	self->next_sample_index = 0;
+	self->next_edge_index = 0;
+}
+
+/* Bind a chunk whose edges were already found by an edge_extractor */
+void pulse_stream_reader_bind_edges(struct pulse_stream_reader *self, const struct edge_list *edges)
+{
+	pulse_stream_reader_bind(self, edges->chunk);
+	self->edges = edges;
 }
 
 void pulse_stream_reader_reset(struct pulse_stream_reader *self)
 {
 	self->reset_pending = true;
+	pulse_stream_reader_ungate(self);
+}
+
+/* Also write every edge to (recorder) as it is found, NULL to stop */
+void pulse_stream_reader_record(struct pulse_stream_reader *self, struct edge_stream_writer *recorder)
+{
+	self->recorder = recorder;
+}
+
+/* First and last sample offsets of the current window */
+static inline offset_t pulse_gate_open(const struct pulse_gate *self)
+{
+	return (self->predicted_fine - self->window_fine) >> pulse_fraction_bits;
+}
+
+static inline offset_t pulse_gate_close(const struct pulse_gate *self)
+{
+	return (self->predicted_fine + self->hold_fine + self->window_fine) >> pulse_fraction_bits;
+}
+
+/*
+ * Gate edges around the syncs predicted in (gate): the first at
+ * (predicted_fine), then every (period_fine), each lasting (hold_fine).
+ * Windows that closed before the current read position are skipped.
+ */
+void pulse_stream_reader_gate(struct pulse_stream_reader *self, const struct pulse_gate *gate)
+{
+	struct pulse_gate *own = &self->gate;
+	own->active = false;
+	/* Windows would overlap */
+	if (gate->period_fine <= gate->hold_fine + 2 * gate->window_fine || gate->predicted_fine < gate->window_fine) {
+		return;
+	}
+	*own = *gate;
+	own->entered = false;
+	own->skip = true;
+	own->fall_seen = false;
+	while (own->predicted_fine < own->end_fine && pulse_gate_close(own) < self->position) {
+		own->predicted_fine += own->period_fine;
+	}
+	own->active = own->predicted_fine - own->window_fine < own->end_fine;
+	if (own->active && pulse_gate_open(own) < self->position) {
+		own->entered = true;
+	}
+	/* Bring the analyser back in line with the signal if edges were gated out before */
+	self->resync_pending = self->previous_state != self->signal_state;
+}
+
+void pulse_stream_reader_ungate(struct pulse_stream_reader *self)
+{
+	self->gate.active = false;
+}
+
+/* Move on to the next window, following the sync if one was found in this one */
+static void pulse_gate_advance(struct pulse_gate *self)
+{
+	self->predicted_fine = (self->fall_seen ? self->fall_fine : self->predicted_fine) + self->period_fine;
+	self->entered = false;
+	self->fall_seen = false;
+	if (self->predicted_fine - self->window_fine < self->end_fine) {
+		return;
+	}
+	if (self->resume_fine > self->window_fine) {
+		/* Read the vertical interval as usual, then gate the next field */
+		self->predicted_fine = self->resume_fine;
+		self->end_fine = self->resume_end_fine;
+		self->resume_fine = 0;
+		self->skip = false;
+	} else {
+		self->active = false;
+	}
+}
+
+static inline bool pulse_stream_reader_edge(struct pulse_stream_reader *self, uint64_t fine_offset, bool state, struct pulse_info *info)
+{
+	struct pulse_gate *gate = &self->gate;
+	if (self->recorder) {
+		edge_stream_writer_edge(self->recorder, fine_offset, state);
+	}
+	if (!state && gate->active && gate->entered && !gate->fall_seen) {
+		gate->fall_seen = true;
+		gate->fall_fine = fine_offset;
+	}
+	self->last_edge_fine = fine_offset;
+	return pulse_analyser_transition(self->pulse_analyser, fine_offset, state, info);
+}
+
+/* Edge at (offset) taking the analyser to the signal's actual state */
+static inline bool pulse_stream_reader_resync(struct pulse_stream_reader *self, offset_t offset, struct pulse_info *info)
+{
+	if (self->signal_state == self->previous_state) {
+		return false;
+	}
+	self->previous_state = self->signal_state;
+	return pulse_stream_reader_edge(self, (uint64_t) offset << pulse_fraction_bits, self->signal_state, info);
+}
+
+/*
+ * Entering a window: if edges were gated out since the last one, the state
+ * seen by the analyser is brought back in line with the signal by an edge at
+ * the window's first sample.
+ */
+static inline bool pulse_stream_reader_enter_window(struct pulse_stream_reader *self, struct pulse_info *info)
+{
+	struct pulse_gate *gate = &self->gate;
+	gate->entered = true;
+	gate->skip = true;
+	return pulse_stream_reader_resync(self, pulse_gate_open(gate), info);
+}
+
+/*
+ * Apply the gate to one pre-scanned edge.  Returns false if a window had to
+ * be entered or left first, in which case the edge must be fed again.
+ */
+static inline bool pulse_stream_reader_feed_edge(struct pulse_stream_reader *self, const struct edge *edge, struct pulse_info *out, size_t *count)
+{
+	struct pulse_gate *gate = &self->gate;
+	if (gate->active) {
+		if (!gate->entered) {
+			if (edge->fine_offset > (uint64_t) pulse_gate_open(gate) << pulse_fraction_bits) {
+				if (pulse_stream_reader_enter_window(self, &out[*count])) {
+					(*count)++;
+				}
+				return false;
+			}
+			if (gate->skip) {
+				self->signal_state = edge->state;
+				return true;
+			}
+		} else if (edge->fine_offset > (uint64_t) pulse_gate_close(gate) << pulse_fraction_bits) {
+			pulse_gate_advance(gate);
+			return false;
+		}
+	}
+	self->signal_state = edge->state;
+	self->previous_state = edge->state;
+	if (pulse_stream_reader_edge(self, edge->fine_offset, edge->state, &out[*count])) {
+		(*count)++;
+	}
+	return true;
+}
+
+/* Enter and leave the windows that the sample scan would have by the end of the chunk */
+static inline void pulse_stream_reader_flush_gate(struct pulse_stream_reader *self, offset_t last_offset, struct pulse_info *out, size_t *count, size_t capacity)
+{
+	struct pulse_gate *gate = &self->gate;
+	while (gate->active && *count < capacity) {
+		if (!gate->entered && pulse_gate_open(gate) <= last_offset) {
+			if (pulse_stream_reader_enter_window(self, &out[*count])) {
+				(*count)++;
+			}
+		} else if (gate->entered && pulse_gate_close(gate) < last_offset) {
+			pulse_gate_advance(gate);
+		} else {
+			break;
+		}
+	}
+}
+
+static inline void pulse_stream_reader_apply_reset(struct pulse_stream_reader *self, offset_t offset)
+{
+	self->reset_pending = false;
+	pulse_analyser_reset(self->pulse_analyser, offset);
+	if (self->recorder) {
+		edge_stream_writer_reset(self->recorder, offset);
+	}
+}
+
+/* Index in the bound chunk of the next sample to be read */
+size_t pulse_stream_reader_index(const struct pulse_stream_reader *self)
+{
+	if (!self->buffer || !self->next_sample_index) {
+		return 0;
+	}
+	return self->position - self->buffer->offset;
+}
+
+/*
+ * Carry on reading from sample (offset) of the bound chunk, as though the
+ * stream had been reset there.  Offsets at or before the read position are
+ * ignored.
+ */
+void pulse_stream_reader_skip(struct pulse_stream_reader *self, offset_t offset)
+{
+	struct buffer_chunk *buffer = self->buffer;
+	if (!buffer || offset <= buffer->offset + pulse_stream_reader_index(self)) {
+		return;
+	}
+	size_t index = offset - buffer->offset;
+	if (index > buffer->length) {
+		index = buffer->length;
+		offset = buffer->offset + index;
+	}
+	sample_t previous_sample = buffer->data[index - 1];
+	bool state = previous_sample >= self->threshold;
+	self->previous_sample = previous_sample;
+	self->previous_state = state;
+	self->signal_state = state;
+	self->resync_pending = false;
+	self->next_sample_index = index;
+	if (self->edges) {
+		const struct edge_list *edges = self->edges;
+		size_t next_edge_index = self->next_edge_index;
+		while (next_edge_index < edges->length && pulse_fine_to_offset(edges->edges[next_edge_index].fine_offset) < offset) {
+			next_edge_index++;
+		}
+		self->next_edge_index = next_edge_index;
+	}
+	self->position = offset;
+	self->last_edge_fine = (uint64_t) offset << pulse_fraction_bits;
+	pulse_stream_reader_apply_reset(self, offset);
+}
+
+/* The bound chunk lost (count) samples from its front, all of them already read, and its offset moved past them */
+void pulse_stream_reader_drop(struct pulse_stream_reader *self, size_t count)
+{
+	self->next_sample_index -= count;
 }
 
 bool pulse_stream_reader_next(struct pulse_stream_reader *self, struct pulse_info *info)
 {
-	bool result = false;
+	return pulse_stream_reader_read(self, info, 1) == 1;
+}
+
+/* Where the sample scan would have stopped, had it produced the same pulses */
+static void pulse_stream_reader_edges_position(struct pulse_stream_reader *self)
+{
 	struct buffer_chunk *buffer = self->buffer;
-	if (!buffer) {
-		return false;
+	if (self->next_sample_index == buffer->length) {
+		self->position = buffer->offset + buffer->length;
+	} else {
+		self->position = pulse_fine_to_offset(self->last_edge_fine) + 1;
+	}
+}
+
+/*
+ * Stitch a pre-scanned edge list onto the stream, producing exactly what the
+ * sample scan in pulse_stream_reader_read would have.
+ */
+static size_t pulse_stream_reader_read_edges(struct pulse_stream_reader *self, struct pulse_info *out, size_t capacity)
+{
+	size_t count = 0;
+	const struct edge_list *edges = self->edges;
+	struct buffer_chunk *buffer = self->buffer;
+	sample_t threshold = self->threshold;
+	if (!buffer->length || self->next_sample_index == buffer->length) {
+		return 0;
+	}
+	/* Crossing between the end of the previous chunk and the start of this one */
+	if (self->next_sample_index == 0) {
+		bool state = edges->first_sample >= threshold;
+		if (state != self->signal_state) {
+			struct edge edge = {
+				.fine_offset = pulse_interpolate_crossing(threshold, self->previous_sample, edges->first_sample, buffer->offset),
+				.state = state,
+			};
+			while (!pulse_stream_reader_feed_edge(self, &edge, out, &count)) {
+				if (count == capacity) {
+					pulse_stream_reader_edges_position(self);
+					return count;
+				}
+			}
+		}
+		self->next_sample_index = 1;
+	}
+	size_t next_edge_index = self->next_edge_index;
+	while (next_edge_index < edges->length && count < capacity) {
+		if (pulse_stream_reader_feed_edge(self, &edges->edges[next_edge_index], out, &count)) {
+			next_edge_index++;
+		}
+	}
+	self->next_edge_index = next_edge_index;
+	if (next_edge_index == edges->length && count < capacity) {
+		pulse_stream_reader_flush_gate(self, buffer->offset + buffer->length - 1, out, &count, capacity);
+		if (count < capacity) {
+			self->next_sample_index = buffer->length;
+			self->previous_sample = edges->last_sample;
+		}
+	}
+	pulse_stream_reader_edges_position(self);
+	return count;
+}
+
+/*
+ * Scan the bound chunk, writing up to (capacity) pulses to (out) in one pass.
+ * Returns the number written; zero means that the chunk is exhausted.
+ */
+size_t pulse_stream_reader_read(struct pulse_stream_reader *self, struct pulse_info *out, size_t capacity)
+{
+	size_t count = 0;
+	struct buffer_chunk *buffer = self->buffer;
+	if (!buffer || !capacity) {
+		return 0;
 	}
 	if (self->reset_pending) {
-		self->reset_pending = false;
-		pulse_analyser_reset(self->pulse_analyser, buffer->offset);
+		pulse_stream_reader_apply_reset(self, buffer->offset);
+	}
+	if (self->resync_pending) {
+		self->resync_pending = false;
+		if (pulse_stream_reader_resync(self, self->position, &out[count]) && ++count == capacity) {
+			return count;
+		}
+	}
+	if (self->edges) {
+		return count + pulse_stream_reader_read_edges(self, &out[count], capacity - count);
 	}
 	bool previous_state = self->previous_state;
 	size_t next_sample_index = self->next_sample_index;
 	sample_t *data = buffer->data;
 	sample_t threshold = self->threshold;
 	size_t length = buffer->length;
+	offset_t base_offset = buffer->offset;
+	struct pulse_gate *gate = &self->gate;
 	while (next_sample_index < length) {
-		size_t sample_index = next_sample_index++;
-		bool state = data[sample_index] >= threshold;
-		if (state == previous_state) {
-			continue;
+		size_t limit = length;
+		if (gate->active) {
+			offset_t position = base_offset + next_sample_index;
+			if (!gate->entered) {
+				offset_t open = pulse_gate_open(gate);
+				if (!gate->skip && position <= open) {
+					/* Read up to and including the window's first sample as usual */
+					if (open + 1 - base_offset < length) {
+						limit = open + 1 - base_offset;
+					}
+				} else if (position < open) {
+					/* Nothing to look for between syncs */
+					next_sample_index = open - base_offset < length ? open - base_offset : length;
+					continue;
+				} else if (position == open) {
+					self->previous_state = previous_state;
+					self->signal_state = data[next_sample_index] >= threshold;
+					bool resynced = pulse_stream_reader_enter_window(self, &out[count]);
+					previous_state = self->previous_state;
+					next_sample_index++;
+					if (resynced && ++count == capacity) {
+						break;
+					}
+					continue;
+				} else {
+					gate->entered = true;
+					gate->skip = true;
+				}
+			}
+			if (gate->entered) {
+				offset_t close = pulse_gate_close(gate);
+				if (position > close) {
+					pulse_gate_advance(gate);
+					continue;
+				}
+				if (close + 1 - base_offset < length) {
+					limit = close + 1 - base_offset;
+				}
+			}
+		}
+		bool full = false;
+		while (next_sample_index < limit) {
+			size_t sample_index = next_sample_index++;
+			bool state = data[sample_index] >= threshold;
+			if (state == previous_state) {
+				continue;
+			}
+			previous_state = state;
+			sample_t before = sample_index ? data[sample_index - 1] : self->previous_sample;
+			uint64_t fine_offset = pulse_interpolate_crossing(threshold, before, data[sample_index], base_offset + sample_index);
+			if (pulse_stream_reader_edge(self, fine_offset, state, &out[count])) {
+				if (++count == capacity) {
+					full = true;
+					break;
+				}
+			}
 		}
-		previous_state = state;
-		if (pulse_analyser_transition(self->pulse_analyser, buffer->offset + sample_index, state, info)) {
-			result = true;
-			goto done;
+		if (full) {
+			break;
 		}
 	}
-done:
+	self->signal_state = previous_state;
+	if (next_sample_index == length && length) {
+		self->previous_sample = data[length - 1];
+		/* Edges may have been skipped since the last window */
+		self->signal_state = data[length - 1] >= threshold;
+	}
 	self->next_sample_index = next_sample_index;
 	self->previous_state = previous_state;
-	return result;
+	self->position = base_offset + next_sample_index;
+	return count;
 }
 
 void pulse_stream_reader_destroy(struct pulse_stream_reader *self)
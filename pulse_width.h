@@ -1,42 +1,119 @@
 #pragma once
 #include "stdinc.h"
 #include "buffer.h"
+#include "edge_extractor.h"
+#include "edge_stream.h"
 
 static const bool pulse_left_aligned = false;
 static const bool pulse_right_aligned = true;
 
+enum
+{
+	/* Fractional bits of the fixed-point ("fine") edge positions */
+	pulse_fraction_bits = 8,
+	pulse_fraction_one = 1 << pulse_fraction_bits,
+};
+
 struct pulse_info
 {
+	/* Offset of first sample in the new state after each edge */
 	uint64_t start;
 	uint64_t transition;
 	uint64_t end;
+	/* Fixed-point threshold crossing times, interpolated between samples */
+	uint64_t start_fine;
+	uint64_t transition_fine;
+	uint64_t end_fine;
 };
 
 struct pulse_analyser
 {
 	bool right_aligned;
-	uint64_t rise_at;
-	uint64_t fall_at;
+	uint64_t rise_at_fine;
+	uint64_t fall_at_fine;
 	bool last_state;
 };
 
+static inline uint64_t pulse_fine_to_offset(uint64_t fine)
+{
+	return (fine + pulse_fraction_one - 1) >> pulse_fraction_bits;
+}
+
+/*
+ * Fixed-point position of a threshold crossing between the sample before
+ * (offset) and the sample at (offset), by linear interpolation of the two.
+ * Result lies in the interval ((offset - 1), offset].
+ */
+static inline uint64_t pulse_interpolate_crossing(sample_t threshold, sample_t before, sample_t after, uint64_t offset)
+{
+	int64_t step_back = ((int64_t) (after - threshold) * pulse_fraction_one) / (after - before);
+	if (step_back >= pulse_fraction_one) {
+		step_back = pulse_fraction_one - 1;
+	}
+	return (offset << pulse_fraction_bits) - step_back;
+}
+
 void pulse_analyser_init(struct pulse_analyser *self, uint64_t initial_offset, bool right_aligned);
-bool pulse_analyser_transition(struct pulse_analyser *self, uint64_t offset, bool state, struct pulse_info *info);
+bool pulse_analyser_transition(struct pulse_analyser *self, uint64_t fine_offset, bool state, struct pulse_info *info);
 void pulse_analyser_reset(struct pulse_analyser *self, uint64_t offset);
 void pulse_analyser_destroy(struct pulse_analyser *self);
 
+/*
+ * Once the line period is known, edges are only looked for in a window
+ * around each predicted horizontal sync (from (window_fine) before its start
+ * to (window_fine) after its end), re-centred on each sync actually found.
+ * Samples between windows are skipped.  Gating stops at (end_fine), before
+ * the vertical sync, and optionally resumes for the next field, at
+ * (resume_fine) until (resume_end_fine).
+ */
+struct pulse_gate
+{
+	bool active;
+	bool entered;
+	/* Whether edges before the next window are skipped, rather than read as usual */
+	bool skip;
+	bool fall_seen;
+	uint64_t predicted_fine;
+	uint64_t fall_fine;
+	uint64_t period_fine;
+	uint64_t hold_fine;
+	uint64_t window_fine;
+	uint64_t end_fine;
+	uint64_t resume_fine;
+	uint64_t resume_end_fine;
+};
+
 struct pulse_stream_reader
 {
 	struct pulse_analyser *pulse_analyser;
 	sample_t threshold;
 	bool previous_state;
+	sample_t previous_sample;
 	struct buffer_chunk *buffer;
 	size_t next_sample_index;
+	const struct edge_list *edges;
+	size_t next_edge_index;
 	bool reset_pending;
+	struct edge_stream_writer *recorder;
+	struct pulse_gate gate;
+	/* State of the signal itself, which differs from previous_state while edges are gated out */
+	bool signal_state;
+	bool resync_pending;
+	uint64_t last_edge_fine;
+	/* Samples before this offset have been read */
+	offset_t position;
 };
 
 void pulse_stream_reader_init(struct pulse_stream_reader *self, struct pulse_analyser *pulse_analyser, sample_t threshold, bool initial_state, uint64_t initial_offset);
 void pulse_stream_reader_bind(struct pulse_stream_reader *self, struct buffer_chunk *buffer);
+void pulse_stream_reader_bind_edges(struct pulse_stream_reader *self, const struct edge_list *edges);
 bool pulse_stream_reader_next(struct pulse_stream_reader *self, struct pulse_info *info);
+size_t pulse_stream_reader_read(struct pulse_stream_reader *self, struct pulse_info *out, size_t capacity);
 void pulse_stream_reader_reset(struct pulse_stream_reader *self);
+size_t pulse_stream_reader_index(const struct pulse_stream_reader *self);
+void pulse_stream_reader_skip(struct pulse_stream_reader *self, offset_t offset);
+void pulse_stream_reader_drop(struct pulse_stream_reader *self, size_t count);
+void pulse_stream_reader_record(struct pulse_stream_reader *self, struct edge_stream_writer *recorder);
+void pulse_stream_reader_gate(struct pulse_stream_reader *self, const struct pulse_gate *gate);
+void pulse_stream_reader_ungate(struct pulse_stream_reader *self);
 void pulse_stream_reader_destroy(struct pulse_stream_reader *self);
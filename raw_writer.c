@@ -0,0 +1,164 @@
+#include "raw_writer.h"
+
+#include <errno.h>
+#include <sys/uio.h>
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+/* Write the whole of (iov), which a pipe may take in more than one go */
+static bool raw_writer_writev(int fd, struct iovec *iov, int count)
+{
+	while (count) {
+		ssize_t written = writev(fd, iov, count);
+		if (written < 0 && errno == EINTR) {
+			continue;
+		}
+		if (written <= 0) {
+			return false;
+		}
+		for (; count && (size_t) written >= iov->iov_len; iov++, count--) {
+			written -= iov->iov_len;
+		}
+		if (count) {
+			iov->iov_base = (uint8_t *) iov->iov_base + written;
+			iov->iov_len -= written;
+		}
+	}
+	return true;
+}
+
+static uint64_t raw_writer_gcd(uint64_t a, uint64_t b)
+{
+	while (b) {
+		uint64_t r = a % b;
+		a = b;
+		b = r;
+	}
+	return a;
+}
+
+#ifdef __AVX2__
+/* 16 pixels of interleaved Y, Cb and Cr at a time into planes, each plane's bytes shuffled out of the 48 in, returns the pixels split */
+static size_t raw_writer_split_avx2(const uint8_t *in, uint8_t *y, uint8_t *cb, uint8_t *cr, size_t count)
+{
+	/* For each plane and each 16 bytes in, which of them go to each byte out, -1 for none */
+	__m128i masks[3][3];
+	for (int plane = 0; plane < 3; plane++) {
+		for (int part = 0; part < 3; part++) {
+			int8_t bytes[16];
+			for (int pixel = 0; pixel < 16; pixel++) {
+				const int byte = 3 * pixel + plane;
+				bytes[pixel] = byte / 16 == part ? byte % 16 : -1;
+			}
+			masks[plane][part] = _mm_loadu_si128((const __m128i *) bytes);
+		}
+	}
+	uint8_t *const planes[3] = { y, cb, cr };
+	const size_t pixels = count / 16 * 16;
+	for (size_t pixel = 0; pixel < pixels; pixel += 16) {
+		const __m128i parts[3] = {
+			_mm_loadu_si128((const __m128i *) &in[3 * pixel]),
+			_mm_loadu_si128((const __m128i *) &in[3 * pixel + 16]),
+			_mm_loadu_si128((const __m128i *) &in[3 * pixel + 32]),
+		};
+		for (int plane = 0; plane < 3; plane++) {
+			__m128i out = _mm_or_si128(_mm_shuffle_epi8(parts[0], masks[plane][0]), _mm_shuffle_epi8(parts[1], masks[plane][1]));
+			out = _mm_or_si128(out, _mm_shuffle_epi8(parts[2], masks[plane][2]));
+			_mm_storeu_si128((__m128i *) &planes[plane][pixel], out);
+		}
+	}
+	return pixels;
+}
+#endif
+
+/******************************************************************************/
+
+void raw_writer_init(struct raw_writer *self, int fd, enum raw_format format, uint32_t width, uint32_t height, uint32_t components, const struct raw_timing *timing)
+{
+	self->fd = fd;
+	self->format = format;
+	self->width = width;
+	self->height = height;
+	self->components = components;
+	self->stream_header_length = 0;
+	self->image_header_length = 0;
+	self->started = false;
+	if (format == raw_format_y4m) {
+		const uint64_t gcd = raw_writer_gcd(timing->rate_numerator, timing->rate_denominator);
+		self->stream_header_length = snprintf(
+			self->stream_header, sizeof(self->stream_header),
+			"YUV4MPEG2 W%u H%u F%lu:%lu I%c A1:1 C%s\n",
+			width, height,
+			timing->rate_numerator / gcd, timing->rate_denominator / gcd,
+			timing->interlaced ? 't' : 'p',
+			components == 1 ? "mono" : "444"
+		);
+		self->image_header_length = snprintf(self->image_header, sizeof(self->image_header), "FRAME\n");
+	} else if (format == raw_format_pgm) {
+		self->image_header_length = snprintf(self->image_header, sizeof(self->image_header), "P5\n%u %u\n255\n", width, height);
+	}
+	self->planes = components == 1 ? NULL : malloc((size_t) width * height * components);
+}
+
+/*
+ * Give the next (count) rows of (image), which must stay in place until its
+ * last rows are given, when the image is written.  False if writing failed.
+ */
+bool raw_writer_add_rows(struct raw_writer *self, const uint8_t *image, uint32_t first_row, uint32_t count)
+{
+	const size_t plane_bytes = (size_t) self->width * self->height;
+	if (self->planes) {
+		const size_t first = (size_t) first_row * self->width;
+		const size_t end = first + (size_t) count * self->width;
+		uint8_t *restrict y = self->planes;
+		uint8_t *restrict cb = &self->planes[plane_bytes];
+		uint8_t *restrict cr = &self->planes[2 * plane_bytes];
+		const uint8_t *restrict in = image;
+		if (self->format == raw_format_pgm) {
+			/* A PGM holds the Y plane alone */
+			for (size_t pixel = first; pixel < end; pixel++) {
+				y[pixel] = in[3 * pixel];
+			}
+		} else {
+			size_t pixel = first;
+#ifdef __AVX2__
+			pixel += raw_writer_split_avx2(&in[3 * first], &y[first], &cb[first], &cr[first], end - first);
+#endif
+			for (; pixel < end; pixel++) {
+				y[pixel] = in[3 * pixel];
+				cb[pixel] = in[3 * pixel + 1];
+				cr[pixel] = in[3 * pixel + 2];
+			}
+		}
+	}
+	if (first_row + count < self->height) {
+		return true;
+	}
+	struct iovec iov[2];
+	int iov_count = 0;
+	/* The stream header goes out with the first image, in the same call */
+	char header[2 * raw_writer_header_capacity];
+	size_t header_length = 0;
+	if (!self->started) {
+		memcpy(header, self->stream_header, self->stream_header_length);
+		header_length = self->stream_header_length;
+		self->started = true;
+	}
+	memcpy(&header[header_length], self->image_header, self->image_header_length);
+	header_length += self->image_header_length;
+	if (header_length) {
+		iov[iov_count++] = (struct iovec) { .iov_base = header, .iov_len = header_length };
+	}
+	if (!self->planes) {
+		iov[iov_count++] = (struct iovec) { .iov_base = (void *) image, .iov_len = plane_bytes };
+	} else {
+		iov[iov_count++] = (struct iovec) { .iov_base = self->planes, .iov_len = self->format == raw_format_pgm ? plane_bytes : plane_bytes * self->components };
+	}
+	return raw_writer_writev(self->fd, iov, iov_count);
+}
+
+void raw_writer_destroy(struct raw_writer *self)
+{
+	free(self->planes);
+}
@@ -0,0 +1,56 @@
+#pragma once
+#include "stdinc.h"
+
+enum
+{
+	/* Longest header of a stream or an image */
+	raw_writer_header_capacity = 128,
+};
+
+/* Uncompressed formats that images can be written in, for consumers that would only decode JPEG again */
+enum raw_format
+{
+	/* Not uncompressed: MJPEG instead */
+	raw_format_none = 0,
+	/* Planes alone, back to back, grey or Y, Cb and Cr each at full size */
+	raw_format_planes,
+	/* YUV4MPEG2, the same planes after a header for the stream and one for each image */
+	raw_format_y4m,
+	/* A PGM for each image, of its grey or Y plane alone */
+	raw_format_pgm,
+};
+
+/* Rate and scanning of the images written, for the formats that record them */
+struct raw_timing
+{
+	uint64_t rate_numerator;
+	uint64_t rate_denominator;
+	bool interlaced;
+};
+
+/*
+ * Writes images to a file descriptor with no encoding, each in one writev
+ * once its last rows are given.  Grey images are written from where they are
+ * given; colour, given as interleaved Y, Cb and Cr, is split into planes as
+ * its rows come.
+ */
+struct raw_writer
+{
+	int fd;
+	enum raw_format format;
+	uint32_t width;
+	uint32_t height;
+	uint32_t components;
+	/* Written before the first image, then before each */
+	char stream_header[raw_writer_header_capacity];
+	size_t stream_header_length;
+	char image_header[raw_writer_header_capacity];
+	size_t image_header_length;
+	bool started;
+	/* Colour: Y, Cb and Cr planes of the image being given, one after another */
+	uint8_t *planes;
+};
+
+void raw_writer_init(struct raw_writer *self, int fd, enum raw_format format, uint32_t width, uint32_t height, uint32_t components, const struct raw_timing *timing);
+bool raw_writer_add_rows(struct raw_writer *self, const uint8_t *image, uint32_t first_row, uint32_t count);
+void raw_writer_destroy(struct raw_writer *self);
@@ -0,0 +1,112 @@
+#include "sync_flywheel.h"
+
+static void sync_flywheel_miss(struct sync_flywheel *self)
+{
+	self->lock_count = 0;
+	if (++self->misses > sync_flywheel_max_misses) {
+		self->locked = false;
+		self->period_fine = self->nominal_period_fine;
+	}
+}
+
+void sync_flywheel_init(struct sync_flywheel *self, uint64_t nominal_period_fine, uint64_t tolerance_fine)
+{
+	self->nominal_period_fine = nominal_period_fine;
+	self->tolerance_fine = tolerance_fine;
+	sync_flywheel_reset(self);
+}
+
+void sync_flywheel_reset(struct sync_flywheel *self)
+{
+	self->period_fine = self->nominal_period_fine;
+	self->have_last_sync = false;
+	self->lock_count = 0;
+	self->misses = 0;
+	self->locked = false;
+	self->field = 0;
+	self->field_started = false;
+	self->field_start_fine = 0;
+	memset(self->field_duration_fine, 0, sizeof(self->field_duration_fine));
+	memset(self->field_active_fine, 0, sizeof(self->field_active_fine));
+}
+
+/*
+ * A horizontal sync was detected starting at (sync_fine).  Syncs a whole
+ * number of lines after the last one keep the lock (lines in between may have
+ * been lost to noise), but only those one line apart refine the period.
+ */
+void sync_flywheel_line(struct sync_flywheel *self, uint64_t sync_fine)
+{
+	if (self->have_last_sync) {
+		uint64_t span = sync_fine - self->last_sync_fine;
+		uint32_t lines = (span + self->period_fine / 2) / self->period_fine;
+		int64_t error = (int64_t) span - (int64_t) (lines * self->period_fine);
+		if (lines >= 1 && (uint64_t) llabs(error) <= self->tolerance_fine * lines) {
+			if (lines == 1) {
+				self->period_fine += error / (1 << sync_flywheel_period_shift);
+			}
+			self->misses = 0;
+			if (++self->lock_count >= sync_flywheel_lock_lines) {
+				self->locked = true;
+			}
+		} else {
+			sync_flywheel_miss(self);
+		}
+	}
+	self->last_sync_fine = sync_fine;
+	self->have_last_sync = true;
+}
+
+/*
+ * Something starting at (sync_fine) that was not recognised as a line sync is
+ * followed by the next sync at (next_sync_fine).  When locked, and that span
+ * is a whole number of lines starting where a sync was due, returns the
+ * number of lines and accounts for them, otherwise returns zero.
+ */
+uint32_t sync_flywheel_coast(struct sync_flywheel *self, uint64_t sync_fine, uint64_t next_sync_fine)
+{
+	if (!self->locked) {
+		return 0;
+	}
+	if (self->have_last_sync) {
+		int64_t phase_error = (int64_t) (sync_fine - sync_flywheel_predict(self));
+		if ((uint64_t) llabs(phase_error) > self->tolerance_fine) {
+			return 0;
+		}
+	}
+	uint64_t span = next_sync_fine - sync_fine;
+	uint32_t lines = (span + self->period_fine / 2) / self->period_fine;
+	int64_t error = (int64_t) span - (int64_t) (lines * self->period_fine);
+	if (lines < 1 || (uint64_t) llabs(error) > self->tolerance_fine * lines) {
+		return 0;
+	}
+	sync_flywheel_line(self, sync_fine);
+	self->last_sync_fine += (lines - 1) * self->period_fine;
+	return lines;
+}
+
+/* Vertical sync for (field) was recognised (or inferred), its first line starting at (sync_fine) */
+void sync_flywheel_field(struct sync_flywheel *self, int field, uint64_t sync_fine)
+{
+	/* Only measure a field that was tracked from its start */
+	if (self->field_started) {
+		self->field_duration_fine[self->field] = sync_fine - self->field_start_fine;
+		self->field_active_fine[self->field] = self->have_last_sync ? self->last_sync_fine + self->period_fine - self->field_start_fine : 0;
+	}
+	self->field_started = true;
+	self->field_start_fine = sync_fine;
+	self->field = field;
+	self->have_last_sync = false;
+}
+
+/* Whether a line sync at (sync_fine) is within (margin_lines) of where the next field should start */
+bool sync_flywheel_field_due(const struct sync_flywheel *self, uint64_t sync_fine, uint32_t margin_lines)
+{
+	uint64_t duration = self->field_duration_fine[self->field];
+	return self->locked && self->field_started && duration && sync_fine + margin_lines * self->period_fine >= self->field_start_fine + duration;
+}
+
+void sync_flywheel_destroy(struct sync_flywheel *self)
+{
+	(void) self;
+}
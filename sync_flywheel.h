@@ -0,0 +1,52 @@
+#pragma once
+#include "stdinc.h"
+
+enum
+{
+	/* Consecutive on-time horizontal syncs before the flywheel trusts its period */
+	sync_flywheel_lock_lines = 16,
+	/* Late or early syncs tolerated before dropping lock */
+	sync_flywheel_max_misses = 4,
+	/* Period filter gain, as a power of two */
+	sync_flywheel_period_shift = 4,
+};
+
+/*
+ * Tracks the horizontal sync period and the field cadence from the syncs that
+ * were detected, so that the positions of syncs which are missing or
+ * corrupted can be predicted.  All positions are fine (fixed-point) sample
+ * offsets.  Fields start at the first line sync after their vertical sync.
+ */
+struct sync_flywheel
+{
+	uint64_t nominal_period_fine;
+	uint64_t tolerance_fine;
+	/* Filtered line period */
+	uint64_t period_fine;
+	uint64_t last_sync_fine;
+	bool have_last_sync;
+	uint32_t lock_count;
+	uint32_t misses;
+	bool locked;
+	/* Field cadence, zero where not measured yet */
+	int field;
+	bool field_started;
+	uint64_t field_start_fine;
+	uint64_t field_duration_fine[2];
+	/* From the start of each field until after its last line sync */
+	uint64_t field_active_fine[2];
+};
+
+void sync_flywheel_init(struct sync_flywheel *self, uint64_t nominal_period_fine, uint64_t tolerance_fine);
+void sync_flywheel_reset(struct sync_flywheel *self);
+void sync_flywheel_line(struct sync_flywheel *self, uint64_t sync_fine);
+uint32_t sync_flywheel_coast(struct sync_flywheel *self, uint64_t sync_fine, uint64_t next_sync_fine);
+void sync_flywheel_field(struct sync_flywheel *self, int field, uint64_t sync_fine);
+bool sync_flywheel_field_due(const struct sync_flywheel *self, uint64_t sync_fine, uint32_t margin_lines);
+void sync_flywheel_destroy(struct sync_flywheel *self);
+
+/* Where the next horizontal sync should start */
+static inline uint64_t sync_flywheel_predict(const struct sync_flywheel *self)
+{
+	return self->last_sync_fine + self->period_fine;
+}
@@ -0,0 +1,152 @@
+#include "sync_pattern.h"
+#include "errors.h"
+
+typedef uint64_t position_set;
+
+/* NFA position: some pattern, some run within it, and the pulses seen of that run so far */
+struct position
+{
+	int type;
+	char pulse;
+	uint8_t min;
+	uint8_t max;
+	uint8_t count;
+	bool last_run;
+	/* Index of the position for the first pulse of the next run, unless last_run */
+	size_t next_run;
+};
+
+struct nfa
+{
+	struct position positions[sync_pattern_max_positions];
+	size_t count;
+	/* Positions for the first pulse of each pattern */
+	position_set initial;
+};
+
+static void nfa_build(struct nfa *nfa, const struct sync_pattern *patterns, size_t pattern_count, uint32_t *longest)
+{
+	nfa->count = 0;
+	nfa->initial = 0;
+	*longest = 0;
+	for (size_t pattern_index = 0; pattern_index < pattern_count; pattern_index++) {
+		const struct sync_pattern *pattern = &patterns[pattern_index];
+		uint32_t length = 0;
+		for (size_t run_index = 0; run_index < sync_pattern_max_runs && pattern->runs[run_index].pulse; run_index++) {
+			const struct sync_pattern_run *run = &pattern->runs[run_index];
+			bool last_run = run_index + 1 == sync_pattern_max_runs || !pattern->runs[run_index + 1].pulse;
+			assert_equal(true, run->min >= 1 && run->min <= run->max);
+			assert_equal(true, nfa->count + run->max <= sync_pattern_max_positions);
+			if (run_index == 0) {
+				nfa->initial |= (position_set) 1 << nfa->count;
+			}
+			for (uint8_t count = 1; count <= run->max; count++) {
+				struct position *position = &nfa->positions[nfa->count++];
+				position->type = pattern->type;
+				position->pulse = run->pulse;
+				position->min = run->min;
+				position->max = run->max;
+				position->count = count;
+				position->last_run = last_run;
+				position->next_run = last_run ? 0 : nfa->count - count + run->max;
+			}
+			length += run->max;
+		}
+		if (length > *longest) {
+			*longest = length;
+		}
+	}
+}
+
+static position_set nfa_step(const struct nfa *nfa, position_set from, char pulse)
+{
+	position_set to = 0;
+	for (size_t index = 0; index < nfa->count; index++) {
+		const struct position *position = &nfa->positions[index];
+		if ((nfa->initial >> index & 1) && position->pulse == pulse) {
+			to |= (position_set) 1 << index;
+		}
+		if (!(from >> index & 1)) {
+			continue;
+		}
+		if (position->pulse == pulse && position->count < position->max) {
+			to |= (position_set) 1 << (index + 1);
+		}
+		if (position->count >= position->min && !position->last_run && nfa->positions[position->next_run].pulse == pulse) {
+			to |= (position_set) 1 << position->next_run;
+		}
+	}
+	return to;
+}
+
+/* First pattern (in table order) completed in this set, else zero */
+static int nfa_accepts(const struct nfa *nfa, position_set set)
+{
+	int type = 0;
+	size_t best = nfa->count;
+	for (size_t index = 0; index < nfa->count; index++) {
+		const struct position *position = &nfa->positions[index];
+		if ((set >> index & 1) && position->last_run && position->count >= position->min && index < best) {
+			best = index;
+			type = position->type;
+		}
+	}
+	return type;
+}
+
+/******************************************************************************/
+
+void sync_recogniser_init(struct sync_recogniser *self, const struct sync_pattern *patterns, size_t count)
+{
+	struct nfa nfa;
+	nfa_build(&nfa, patterns, count, &self->longest);
+	/* Symbol zero is any pulse which appears in no pattern */
+	char alphabet[sync_pattern_max_positions + 1];
+	memset(self->symbol_of, 0, sizeof(self->symbol_of));
+	self->symbol_count = 1;
+	alphabet[0] = 0;
+	for (size_t index = 0; index < nfa.count; index++) {
+		uint8_t pulse = nfa.positions[index].pulse;
+		if (!self->symbol_of[pulse]) {
+			self->symbol_of[pulse] = self->symbol_count;
+			alphabet[self->symbol_count++] = pulse;
+		}
+	}
+	/* Subset construction, state zero being the empty set */
+	position_set *sets = malloc(sync_recogniser_max_states * sizeof(*sets));
+	self->transitions = malloc(sync_recogniser_max_states * self->symbol_count * sizeof(*self->transitions));
+	self->accept = malloc(sync_recogniser_max_states * sizeof(*self->accept));
+	sets[0] = 0;
+	self->state_count = 1;
+	for (uint32_t state = 0; state < self->state_count; state++) {
+		self->accept[state] = nfa_accepts(&nfa, sets[state]);
+		for (uint32_t symbol = 0; symbol < self->symbol_count; symbol++) {
+			position_set next = symbol ? nfa_step(&nfa, sets[state], alphabet[symbol]) : 0;
+			uint32_t target = 0;
+			while (target < self->state_count && sets[target] != next) {
+				target++;
+			}
+			if (target == self->state_count) {
+				if (self->state_count == sync_recogniser_max_states) {
+					fatal_error("Sync pattern table needs more than %d automaton states", sync_recogniser_max_states);
+				}
+				sets[self->state_count++] = next;
+			}
+			self->transitions[state * self->symbol_count + symbol] = target;
+		}
+	}
+	free(sets);
+	sync_recogniser_reset(self);
+}
+
+void sync_recogniser_reset(struct sync_recogniser *self)
+{
+	self->state = 0;
+	self->length = 0;
+}
+
+void sync_recogniser_destroy(struct sync_recogniser *self)
+{
+	free(self->transitions);
+	free(self->accept);
+}
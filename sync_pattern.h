@@ -0,0 +1,60 @@
+#pragma once
+#include "stdinc.h"
+
+enum
+{
+	sync_pattern_max_runs = 8,
+	/* NFA positions are tracked in a 64-bit set while building the DFA */
+	sync_pattern_max_positions = 64,
+	sync_recogniser_max_states = 256,
+};
+
+/* Between (min) and (max) consecutive pulses of one type */
+struct sync_pattern_run
+{
+	char pulse;
+	uint8_t min;
+	uint8_t max;
+};
+
+/* Sequence of runs, terminated by a run with pulse == 0 */
+struct sync_pattern
+{
+	int type;
+	struct sync_pattern_run runs[sync_pattern_max_runs];
+};
+
+/*
+ * Deterministic automaton recognising any of a table of sync patterns at the
+ * end of the pulse sequence fed so far, advanced with one table lookup per
+ * pulse.  Tolerance for missing pulses comes from runs with min < max.
+ */
+struct sync_recogniser
+{
+	uint8_t symbol_of[256];
+	uint32_t symbol_count;
+	uint32_t state_count;
+	uint8_t *transitions;
+	int *accept;
+	uint8_t state;
+	/* Pulses fed since the last reset, and the most any pattern can span */
+	uint32_t length;
+	uint32_t longest;
+};
+
+void sync_recogniser_init(struct sync_recogniser *self, const struct sync_pattern *patterns, size_t count);
+void sync_recogniser_reset(struct sync_recogniser *self);
+void sync_recogniser_destroy(struct sync_recogniser *self);
+
+/* Returns the type of the pattern completed by this pulse, or zero */
+static inline int sync_recogniser_next(struct sync_recogniser *self, char pulse)
+{
+	self->length++;
+	self->state = self->transitions[self->state * self->symbol_count + self->symbol_of[(uint8_t) pulse]];
+	return self->accept[self->state];
+}
+
+static inline bool sync_recogniser_overlong(const struct sync_recogniser *self)
+{
+	return self->length > self->longest;
+}
@@ -0,0 +1,95 @@
+#include <math.h>
+#include "tone_map.h"
+#ifdef __AVX2__
+#include <immintrin.h>
+#endif
+
+static bool tone_curve_equal(const struct tone_curve *a, const struct tone_curve *b)
+{
+	return a->black_level == b->black_level &&
+		a->white_level == b->white_level &&
+		a->gamma == b->gamma &&
+		a->contrast == b->contrast;
+}
+
+static void tone_map_build(struct tone_map *self)
+{
+	const struct tone_curve *curve = &self->curve;
+	double gamma = curve->gamma ? curve->gamma : 1;
+	double contrast = curve->contrast ? curve->contrast : 1;
+	bool linear = gamma == 1 && contrast == 1;
+	sample_t range = curve->white_level - curve->black_level;
+	self->range = range > 0 ? range : 1;
+	free(self->table);
+	self->table = malloc((self->range + 1) * sizeof(*self->table));
+	for (uint32_t index = 0; index <= self->range; index++) {
+		if (linear) {
+			self->table[index] = 255 * index / self->range;
+			continue;
+		}
+		double level = 0.5 + contrast * ((double) index / self->range - 0.5);
+		level = level < 0 ? 0 : level > 1 ? 1 : level;
+		self->table[index] = lround(255 * pow(level, 1 / gamma));
+	}
+}
+
+static inline uint8_t tone_map_lookup(const struct tone_map *self, int32_t value)
+{
+	int64_t index = (int64_t) value - self->curve.black_level;
+	index = index < 0 ? 0 : index > self->range ? self->range : index;
+	return self->table[index];
+}
+
+#ifdef __AVX2__
+static size_t tone_map_apply_avx2(const struct tone_map *self, const int32_t *values, uint8_t *out, size_t count)
+{
+	const __m256i black = _mm256_set1_epi32(self->curve.black_level);
+	const __m256i zero = _mm256_setzero_si256();
+	const __m256i range = _mm256_set1_epi32(self->range);
+	const int *table = (const int *) self->table;
+	const size_t length = count & ~(size_t) 7;
+	for (size_t index = 0; index < length; index += 8) {
+		__m256i level = _mm256_sub_epi32(_mm256_loadu_si256((const __m256i *) &values[index]), black);
+		level = _mm256_min_epi32(_mm256_max_epi32(level, zero), range);
+		__m256i luma = _mm256_i32gather_epi32(table, level, 4);
+		__m128i words = _mm_packus_epi32(_mm256_castsi256_si128(luma), _mm256_extracti128_si256(luma, 1));
+		_mm_storel_epi64((__m128i *) &out[index], _mm_packus_epi16(words, words));
+	}
+	return length;
+}
+#endif
+
+/******************************************************************************/
+
+void tone_map_init(struct tone_map *self, const struct tone_curve *curve)
+{
+	self->curve = *curve;
+	self->table = NULL;
+	tone_map_build(self);
+}
+
+/* Rebuild the table, if the curve changed */
+void tone_map_set(struct tone_map *self, const struct tone_curve *curve)
+{
+	if (tone_curve_equal(&self->curve, curve)) {
+		return;
+	}
+	self->curve = *curve;
+	tone_map_build(self);
+}
+
+void tone_map_apply(const struct tone_map *self, const int32_t *values, uint8_t *out, size_t count)
+{
+	size_t index = 0;
+#ifdef __AVX2__
+	index = tone_map_apply_avx2(self, values, out, count);
+#endif
+	for (; index < count; index++) {
+		out[index] = tone_map_lookup(self, values[index]);
+	}
+}
+
+void tone_map_destroy(struct tone_map *self)
+{
+	free(self->table);
+}
@@ -0,0 +1,28 @@
+#pragma once
+#include "stdinc.h"
+#include "buffer.h"
+
+/*
+ * Transfer function from signal level to 8-bit luma: black and white levels,
+ * then contrast about mid-grey and gamma.  Zero gamma or contrast mean one.
+ */
+struct tone_curve
+{
+	sample_t black_level;
+	sample_t white_level;
+	float gamma;
+	float contrast;
+};
+
+/* Lookup table of a tone_curve over every level from black to white */
+struct tone_map
+{
+	struct tone_curve curve;
+	uint32_t range;
+	uint32_t *table;
+};
+
+void tone_map_init(struct tone_map *self, const struct tone_curve *curve);
+void tone_map_set(struct tone_map *self, const struct tone_curve *curve);
+void tone_map_apply(const struct tone_map *self, const int32_t *values, uint8_t *out, size_t count);
+void tone_map_destroy(struct tone_map *self);
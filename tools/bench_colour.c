@@ -0,0 +1,173 @@
+/* Before errors.h, whose log() macro would otherwise clash */
+#include <math.h>
+
+#include "stdinc.h"
+#include "errors.h"
+#include "decoder.h"
+#include "video_standard.h"
+#include "common/synthetic_signal.h"
+#include "common/bench.h"
+
+/*
+ * Lines per second of grey against colour decoding, at a few multiples of
+ * the colour subcarrier, and how closely the colour matches what was sent.
+ */
+
+enum {
+	default_chunk_count = 100,
+	default_repeat = 3,
+	/* Columns of the synthetic picture, each a step around the hue circle */
+	hue_columns = 16,
+};
+
+static const unsigned oversampling[] = { 3, 4, 6 };
+
+struct bench_result
+{
+	double seconds;
+	double signal_seconds;
+	uint64_t lines;
+	/* Rows with colour, those without, and the mean error of their Cb and Cr at column centres */
+	uint64_t colour_rows;
+	uint64_t grey_rows;
+	double chroma_error;
+};
+
+/* Compare the middle of each column of each row with the hue that the generator gave it */
+static void check_colour(const uint8_t *image, uint32_t width, uint32_t height, struct bench_result *result)
+{
+	const double cb_swing = 0.15 * 255 * 0.564 / 0.493;
+	const double cr_swing = 0.15 * 255 * 0.713 / 0.877;
+	for (uint32_t row = 0; row < height; row++) {
+		const uint8_t *pixels = &image[row * width * 3];
+		double error = 0;
+		bool grey = true;
+		for (int column = 0; column < hue_columns; column++) {
+			const uint8_t *pixel = &pixels[((2 * column + 1) * width / (2 * hue_columns)) * 3];
+			double hue = 2 * M_PI * column / hue_columns;
+			grey = grey && pixel[1] == 128 && pixel[2] == 128;
+			error += fabs(pixel[1] - (128 + cb_swing * cos(hue))) + fabs(pixel[2] - (128 + cr_swing * sin(hue)));
+		}
+		if (grey) {
+			result->grey_rows++;
+		} else {
+			result->colour_rows++;
+			result->chroma_error += error / (2 * hue_columns);
+		}
+	}
+}
+
+/* Decode a copy of the signal, timing only the decoder */
+static void bench_run(const struct decoder_config *config, const struct buffer *signal, struct bench_result *result)
+{
+	struct decoder decoder;
+	decoder_init(&decoder, config);
+	uint32_t width;
+	uint32_t height;
+	decoder_image_size(config, &width, &height);
+	struct buffer input;
+	buffer_init(&input);
+	for (const struct buffer_chunk *source = signal->tail; source; source = source->next) {
+		bench_copy_chunk(&input, source);
+		struct timespec start;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		decoder_bind_and_steal(&decoder, &input);
+		while (decoder_read_frame(&decoder)) {
+			result->lines += config->timing.frame_height;
+			if (decoder.image_components == 3) {
+				check_colour(decoder.image, width, height, result);
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		result->seconds += bench_elapsed(&start, &end);
+		result->signal_seconds += source->length * (config->sample_period_ps * 1e-12);
+	}
+	buffer_destroy(&input);
+	decoder_destroy(&decoder);
+}
+
+static void bench_rate(const struct video_standard *standard, unsigned multiple, size_t chunk_count, unsigned repeat)
+{
+	const uint64_t sample_rate_hz = multiple * standard->timing.colour_subcarrier_millihertz / 1000;
+	const struct synthetic_signal_config signal_config = {
+		.sample_period_ps = 1000000000000ull / sample_rate_hz,
+		.black_level = 300,
+		.white_level = 1000,
+		.edge_ns = 150,
+		.noise_mv = 20,
+		.colour = true,
+	};
+	/* Chunks of 5ms, as the scope delivers */
+	const size_t chunk_samples = sample_rate_hz / 200;
+	struct synthetic_signal generator;
+	struct buffer signal;
+	buffer_init(&signal);
+	synthetic_signal_init(&generator, &signal_config, standard);
+	synthetic_signal_generate(&generator, &signal, chunk_count, chunk_samples);
+	synthetic_signal_destroy(&generator);
+	struct decoder_config config = {
+		.sample_period_ps = signal_config.sample_period_ps,
+		/* Below the troughs of the burst, which dips 3/14 of the luma range under black */
+		.sync_threshold = 100,
+		.black_level = signal_config.black_level,
+		.white_level = signal_config.white_level,
+		.max_backlog_samples = chunk_count * chunk_samples,
+		.specialise = true,
+		.flywheel = true,
+		.render_threads = 1,
+	};
+	decoder_config_set_standard(&config, standard);
+	struct bench_result results[2];
+	memset(results, 0, sizeof(results));
+	for (unsigned iteration = 0; iteration < repeat; iteration++) {
+		for (int colour = 0; colour < 2; colour++) {
+			struct bench_result run = { 0 };
+			config.colour = colour;
+			bench_run(&config, &signal, &run);
+			if (iteration == 0 || run.seconds < results[colour].seconds) {
+				results[colour] = run;
+			}
+		}
+	}
+	printf("%s @ %ux subcarrier, %.2fMHz:\n", standard->description, multiple, sample_rate_hz / 1e6);
+	for (int colour = 0; colour < 2; colour++) {
+		const struct bench_result *result = &results[colour];
+		printf(
+			"  %-6s %9.0f lines/s  %6.1fx real-time",
+			colour ? "colour" : "grey",
+			result->lines / result->seconds,
+			result->signal_seconds / result->seconds
+		);
+		if (colour) {
+			printf(
+				"  %lu/%lu rows in colour, Cb/Cr mean error %.2f",
+				result->colour_rows,
+				result->colour_rows + result->grey_rows,
+				result->colour_rows ? result->chroma_error / result->colour_rows : 0
+			);
+		}
+		printf("\n");
+	}
+	buffer_destroy(&signal);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 3) {
+		fprintf(stderr, "Usage: %s [chunk-count] [repeat]\n", argv[0]);
+		return 1;
+	}
+	size_t chunk_count = argc > 1 ? atoi(argv[1]) : default_chunk_count;
+	unsigned repeat = argc > 2 ? atoi(argv[2]) : default_repeat;
+	for (size_t index = 0; video_standard_get(index); index++) {
+		const struct video_standard *standard = video_standard_get(index);
+		if (!standard->timing.colour_subcarrier_millihertz) {
+			continue;
+		}
+		for (size_t rate = 0; rate < sizeof(oversampling) / sizeof(oversampling[0]); rate++) {
+			bench_rate(standard, oversampling[rate], chunk_count, repeat);
+		}
+	}
+	return 0;
+}
@@ -0,0 +1,194 @@
+#include "stdinc.h"
+#include "errors.h"
+#include "decoder.h"
+#include "pulse_width.h"
+#include "video_standard.h"
+#include "common/synthetic_signal.h"
+#include "common/bench.h"
+
+/* Throughput of the specialised decoder instantiations against the generic path, on a synthetic signal */
+
+enum {
+	sample_period_ps = 104166,
+	chunk_samples = 48000,
+	default_chunk_count = 100,
+	default_repeat = 5,
+	/* Times over the signal's pulses that each run classifies them, as there are few next to its samples */
+	classify_passes = 200,
+};
+
+struct bench_result
+{
+	double seconds;
+	uint64_t samples;
+	uint64_t frames;
+	uint64_t frame_hash;
+	const char *implementation;
+	/* Pulses classified alone, the part of decoding that the specialised code speeds up most */
+	double classify_seconds;
+	uint64_t pulses;
+};
+
+static uint64_t hash_frame(uint64_t hash, const uint8_t *frame, size_t length)
+{
+	for (size_t index = 0; index < length; index++) {
+		hash = (hash ^ frame[index]) * 1099511628211ull;
+	}
+	return hash;
+}
+
+/* Decode a copy of the signal, timing only the decoder */
+static void bench_run(const struct decoder_config *config, const struct buffer *signal, struct bench_result *result)
+{
+	struct decoder decoder;
+	decoder_init(&decoder, config);
+	result->implementation = decoder_implementation(&decoder);
+	const size_t image_bytes = decoder.row_bytes * decoder.image_height;
+	struct buffer input;
+	buffer_init(&input);
+	for (const struct buffer_chunk *source = signal->tail; source; source = source->next) {
+		bench_copy_chunk(&input, source);
+		struct timespec start;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		decoder_bind_and_steal(&decoder, &input);
+		while (decoder_read_frame(&decoder)) {
+			result->frames++;
+			result->frame_hash = hash_frame(result->frame_hash, decoder.image, image_bytes);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		result->seconds += bench_elapsed(&start, &end);
+		result->samples += source->length;
+	}
+	buffer_destroy(&input);
+	decoder_destroy(&decoder);
+}
+
+/* The pulses in the signal, as the decoder would find them */
+static struct pulse_info *bench_find_pulses(const struct decoder_config *config, const struct buffer *signal, size_t *count)
+{
+	struct pulse_analyser pulse_analyser;
+	struct pulse_stream_reader reader;
+	pulse_analyser_init(&pulse_analyser, 0, pulse_right_aligned);
+	pulse_stream_reader_init(&reader, &pulse_analyser, config->sync_threshold, false, 0);
+	size_t capacity = 1024;
+	struct pulse_info *pulses = malloc(capacity * sizeof(*pulses));
+	*count = 0;
+	for (struct buffer_chunk *chunk = signal->tail; chunk; chunk = chunk->next) {
+		pulse_stream_reader_bind(&reader, chunk);
+		while (pulse_stream_reader_next(&reader, &pulses[*count])) {
+			if (++*count == capacity) {
+				capacity *= 2;
+				pulses = realloc(pulses, capacity * sizeof(*pulses));
+			}
+		}
+	}
+	pulse_stream_reader_destroy(&reader);
+	pulse_analyser_destroy(&pulse_analyser);
+	return pulses;
+}
+
+static void bench_classify(const struct decoder_config *config, const struct pulse_info *pulses, size_t count, struct bench_result *result)
+{
+	struct decoder decoder;
+	decoder_init(&decoder, config);
+	char *types = malloc(count);
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned pass = 0; pass < classify_passes; pass++) {
+		decoder_classify_pulses(&decoder, pulses, types, count);
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	result->classify_seconds = bench_elapsed(&start, &end);
+	result->pulses = (uint64_t) count * classify_passes;
+	free(types);
+	decoder_destroy(&decoder);
+}
+
+static void bench_standard(const struct video_standard *standard, size_t chunk_count, unsigned repeat)
+{
+	const struct synthetic_signal_config signal_config = {
+		.sample_period_ps = sample_period_ps,
+		.black_level = 300,
+		.white_level = 1000,
+		.edge_ns = 150,
+		.noise_mv = 20,
+	};
+	struct synthetic_signal generator;
+	struct buffer signal;
+	buffer_init(&signal);
+	synthetic_signal_init(&generator, &signal_config, standard);
+	synthetic_signal_generate(&generator, &signal, chunk_count, chunk_samples);
+	synthetic_signal_destroy(&generator);
+	struct decoder_config config = {
+		.sample_period_ps = sample_period_ps,
+		.sync_threshold = 200,
+		.black_level = signal_config.black_level,
+		.white_level = signal_config.white_level,
+		.max_backlog_samples = chunk_count * chunk_samples,
+	};
+	decoder_config_set_standard(&config, standard);
+	size_t pulse_count;
+	struct pulse_info *pulses = bench_find_pulses(&config, &signal, &pulse_count);
+	/* Best of the runs, each of which should make the same frames */
+	struct bench_result results[2];
+	memset(results, 0, sizeof(results));
+	bool differs = false;
+	for (unsigned iteration = 0; iteration < repeat; iteration++) {
+		/* Interleave so that frequency scaling affects both alike */
+		for (int specialise = 0; specialise < 2; specialise++) {
+			struct bench_result run = { 0 };
+			config.specialise = specialise;
+			bench_run(&config, &signal, &run);
+			bench_classify(&config, pulses, pulse_count, &run);
+			struct bench_result *best = &results[specialise];
+			differs = differs || (iteration && run.frame_hash != best->frame_hash);
+			/* Each timing is the best of its own */
+			if (iteration && best->classify_seconds < run.classify_seconds) {
+				run.classify_seconds = best->classify_seconds;
+			}
+			if (iteration == 0 || run.seconds < best->seconds) {
+				*best = run;
+			} else {
+				best->classify_seconds = run.classify_seconds;
+			}
+		}
+	}
+	printf("%s:\n", standard->description);
+	for (int specialise = 0; specialise < 2; specialise++) {
+		const struct bench_result *result = &results[specialise];
+		printf(
+			"  %-28s %8.1f Msamples/s  %6.1fx real-time  %6.1f Mpulses/s classified  %3lu frames  hash %016lx\n",
+			result->implementation,
+			result->samples / result->seconds / 1e6,
+			result->samples * (sample_period_ps * 1e-12) / result->seconds,
+			result->pulses / result->classify_seconds / 1e6,
+			result->frames,
+			result->frame_hash
+		);
+	}
+	differs = differs || results[0].frame_hash != results[1].frame_hash;
+	printf(
+		"  speed-up: %.2fx decoding, %.2fx classifying pulses%s\n",
+		results[0].seconds / results[1].seconds,
+		results[0].classify_seconds / results[1].classify_seconds,
+		differs ? "  (OUTPUT DIFFERS)" : ""
+	);
+	free(pulses);
+	buffer_destroy(&signal);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 3) {
+		fprintf(stderr, "Usage: %s [chunk-count] [repeat]\n", argv[0]);
+		return 1;
+	}
+	size_t chunk_count = argc > 1 ? atoi(argv[1]) : default_chunk_count;
+	unsigned repeat = argc > 2 ? atoi(argv[2]) : default_repeat;
+	for (size_t index = 0; video_standard_get(index); index++) {
+		bench_standard(video_standard_get(index), chunk_count, repeat);
+	}
+	return 0;
+}
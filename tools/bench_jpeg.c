@@ -0,0 +1,426 @@
+#include "stdinc.h"
+#include "errors.h"
+#include "decoder.h"
+#include "jpeg.h"
+#include "jpeg_pool.h"
+#include "raw_writer.h"
+#include "video_standard.h"
+#include "common/synthetic_signal.h"
+#include "common/bench.h"
+
+#include <setjmp.h>
+#include <jpeglib.h>
+
+/*
+ * Encode time per image of a JPEG encoder kept for the stream and writing
+ * into memory, against setting one up for each image and writing through
+ * stdio as before, and whether the two make the same JPEG.  Then the same
+ * for pools of encoding threads, given rows a slice at a time, and whether
+ * their JPEGs come out in order.  Pools that split images into strips are
+ * checked against libjpeg encoding the whole image with the same restart
+ * interval, and timed for the latency of one image given alone as well.
+ * Last, writing Y4M instead, for what skipping JPEG altogether saves.
+ */
+
+enum {
+	default_image_count = 200,
+	default_repeat = 3,
+	quality = 85,
+	/* Decoded images to encode in turn */
+	max_images = 4,
+	slice_rows = 16,
+};
+
+enum bench_mode
+{
+	bench_per_image,
+	bench_persistent,
+	bench_pool_1,
+	bench_pool_2,
+	bench_pool_4,
+	bench_strips_1,
+	bench_strips_2,
+	bench_strips_4,
+	bench_y4m,
+	bench_modes,
+};
+
+static const uint32_t bench_pool_threads[bench_modes] = {
+	[bench_pool_1] = 1,
+	[bench_pool_2] = 2,
+	[bench_pool_4] = 4,
+	[bench_strips_1] = 1,
+	[bench_strips_2] = 2,
+	[bench_strips_4] = 4,
+};
+
+static const uint32_t bench_pool_strips[bench_modes] = {
+	[bench_pool_1] = 1,
+	[bench_pool_2] = 1,
+	[bench_pool_4] = 1,
+	[bench_strips_1] = 4,
+	[bench_strips_2] = 2,
+	[bench_strips_4] = 4,
+};
+
+static const char *const bench_mode_names[] = {
+	[bench_per_image] = "set up per image, stdio",
+	[bench_persistent] = "persistent, in memory",
+	[bench_pool_1] = "pool of 1, inline",
+	[bench_pool_2] = "pool of 2 threads",
+	[bench_pool_4] = "pool of 4 threads",
+	[bench_strips_1] = "1 thread, 4 strips",
+	[bench_strips_2] = "2 threads, 2 strips",
+	[bench_strips_4] = "4 threads, 4 strips",
+	[bench_y4m] = "y4m, no encoding",
+};
+
+struct bench_images
+{
+	uint8_t *images[max_images];
+	size_t count;
+	uint32_t width;
+	uint32_t height;
+	enum jpeg_format format;
+};
+
+struct bench_result
+{
+	double seconds;
+	uint64_t images;
+	uint64_t bytes;
+	/* JPEGs from a pool that are not those of the images given in turn */
+	uint64_t out_of_order;
+	/* From giving the last rows of an image alone until its JPEG is emitted */
+	double latency_seconds;
+};
+
+/* What a pool's JPEGs should be, one for each image decoded */
+struct bench_expected
+{
+	uint8_t *jpegs[max_images];
+	size_t lengths[max_images];
+};
+
+struct bench_pool_sink
+{
+	const struct bench_images *images;
+	const struct bench_expected *expected;
+	FILE *file;
+	uint64_t emitted;
+	struct bench_result *result;
+	struct timespec emitted_at;
+};
+
+/* Decode a few images of a synthetic signal to have something realistic to compress */
+static void bench_decode(const struct video_standard *standard, bool colour, struct bench_images *images)
+{
+	const uint64_t sample_rate_hz = colour ? 4 * standard->timing.colour_subcarrier_millihertz / 1000 : 9600000;
+	const struct synthetic_signal_config signal_config = {
+		.sample_period_ps = 1000000000000ull / sample_rate_hz,
+		.black_level = 300,
+		.white_level = 1000,
+		.edge_ns = 150,
+		.noise_mv = 20,
+		.colour = colour,
+	};
+	const size_t chunk_samples = sample_rate_hz / 200;
+	const size_t chunk_count = 50;
+	struct synthetic_signal generator;
+	struct buffer signal;
+	buffer_init(&signal);
+	synthetic_signal_init(&generator, &signal_config, standard);
+	synthetic_signal_generate(&generator, &signal, chunk_count, chunk_samples);
+	synthetic_signal_destroy(&generator);
+	struct decoder_config config = {
+		.sample_period_ps = signal_config.sample_period_ps,
+		.sync_threshold = colour ? 100 : 200,
+		.black_level = signal_config.black_level,
+		.white_level = signal_config.white_level,
+		.max_backlog_samples = chunk_count * chunk_samples,
+		.specialise = true,
+		.flywheel = true,
+		.render_threads = 1,
+		.colour = colour,
+	};
+	decoder_config_set_standard(&config, standard);
+	struct decoder decoder;
+	decoder_init(&decoder, &config);
+	decoder_bind_and_steal(&decoder, &signal);
+	images->width = decoder.row_bytes / decoder.image_components;
+	images->height = decoder.image_height;
+	images->format = decoder.image_components == 3 ? jpeg_format_ycbcr : jpeg_format_grey;
+	images->count = 0;
+	const size_t image_bytes = decoder.row_bytes * decoder.image_height;
+	while (images->count < max_images && decoder_read_frame(&decoder)) {
+		images->images[images->count] = malloc(image_bytes);
+		memcpy(images->images[images->count], decoder.image, image_bytes);
+		images->count++;
+	}
+	decoder_destroy(&decoder);
+	buffer_destroy(&signal);
+}
+
+/* As the encoder worked before: a compressor made, set up and destroyed for each image, optionally with restart markers */
+static bool bench_encode_per_image(const struct bench_images *images, const uint8_t *image, unsigned restart_interval, FILE *sink)
+{
+	struct jpeg_compress_struct info;
+	struct jpeg_error_mgr err;
+	info.err = jpeg_std_error(&err);
+	jpeg_create_compress(&info);
+	jpeg_stdio_dest(&info, sink);
+	info.image_width = images->width;
+	info.image_height = images->height;
+	info.input_components = images->format == jpeg_format_grey ? 1 : 3;
+	info.in_color_space = images->format == jpeg_format_grey ? JCS_GRAYSCALE : JCS_YCbCr;
+	jpeg_set_defaults(&info);
+	jpeg_set_quality(&info, quality, TRUE);
+	info.restart_interval = restart_interval;
+	jpeg_start_compress(&info, TRUE);
+	const size_t row_bytes = (size_t) info.input_components * images->width;
+	for (uint32_t row = 0; row < images->height; row++) {
+		JSAMPROW scanline = (JSAMPROW) &image[row * row_bytes];
+		jpeg_write_scanlines(&info, &scanline, 1);
+	}
+	jpeg_finish_compress(&info);
+	jpeg_destroy_compress(&info);
+	return fflush(sink) == 0;
+}
+
+/* Restart interval, in MCUs, of a pool's JPEGs when it splits images into (strips), as the pool works it out */
+static unsigned bench_restart_interval(const struct bench_images *images, uint32_t strips)
+{
+	if (strips <= 1) {
+		return 0;
+	}
+	const unsigned mcu_size = jpeg_mcu_height(images->format);
+	const unsigned mcu_rows = (images->height + mcu_size - 1) / mcu_size;
+	return (images->width + mcu_size - 1) / mcu_size * ((mcu_rows + strips - 1) / strips);
+}
+
+static void bench_pool_emit(void *context, const uint8_t *data, size_t length, uint64_t completed_ns)
+{
+	struct bench_pool_sink *sink = context;
+	/* Rows are given with no capture time, so latency is timed here instead */
+	(void) completed_ns;
+	const size_t index = sink->emitted++ % sink->images->count;
+	if (!data) {
+		fatal_error("Failed to encode");
+	}
+	sink->result->out_of_order += length != sink->expected->lengths[index] || memcmp(data, sink->expected->jpegs[index], length) != 0;
+	sink->result->bytes += length;
+	fwrite(data, 1, length, sink->file);
+	clock_gettime(CLOCK_MONOTONIC, &sink->emitted_at);
+}
+
+/* Give a pool the rows of an image a slice at a time, as the decoder would */
+static void bench_add_image(struct jpeg_pool *pool, const struct bench_images *images, const uint8_t *image)
+{
+	const size_t row_bytes = (size_t) images->width * (images->format == jpeg_format_grey ? 1 : 3);
+	for (uint32_t row = 0; row < images->height; row += slice_rows) {
+		const uint32_t count = images->height - row < slice_rows ? images->height - row : slice_rows;
+		jpeg_pool_add_rows(pool, &image[row * row_bytes], row, count, 0);
+	}
+}
+
+/* Give a pool the images in turn, then each again alone to time until it is emitted */
+static void bench_run_pool(uint32_t threads, uint32_t strips, const struct bench_images *images, const struct bench_expected *expected, size_t image_count, struct bench_result *result)
+{
+	struct bench_pool_sink sink = {
+		.images = images,
+		.expected = expected,
+		.file = fopen("/dev/null", "wb"),
+		.result = result,
+	};
+	struct jpeg_pool pool;
+	jpeg_pool_init(&pool, threads, strips, images->width, images->height, images->format, quality, bench_pool_emit, &sink);
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t index = 0; index < image_count; index++) {
+		bench_add_image(&pool, images, images->images[index % images->count]);
+	}
+	jpeg_pool_flush(&pool);
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	result->seconds = bench_elapsed(&start, &end);
+	result->images = image_count;
+	result->out_of_order += sink.emitted != image_count;
+	/* The rows of an image come over a field or frame, so the latency that matters is from the last of them */
+	for (size_t index = 0; index < images->count; index++) {
+		const size_t row_bytes = (size_t) images->width * (images->format == jpeg_format_grey ? 1 : 3);
+		const uint8_t *image = images->images[(image_count + index) % images->count];
+		const uint32_t last = images->height - (images->height - 1) % slice_rows - 1;
+		for (uint32_t row = 0; row < last; row += slice_rows) {
+			jpeg_pool_add_rows(&pool, &image[row * row_bytes], row, slice_rows, 0);
+		}
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		jpeg_pool_add_rows(&pool, &image[last * row_bytes], last, images->height - last, 0);
+		jpeg_pool_flush(&pool);
+		result->latency_seconds += bench_elapsed(&start, &sink.emitted_at);
+	}
+	result->latency_seconds /= images->count;
+	jpeg_pool_destroy(&pool);
+	fclose(sink.file);
+}
+
+static void bench_run(enum bench_mode mode, const struct bench_images *images, const struct bench_expected *expected, size_t image_count, struct bench_result *result)
+{
+	if (bench_pool_threads[mode]) {
+		bench_run_pool(bench_pool_threads[mode], bench_pool_strips[mode], images, &expected[mode], image_count, result);
+		return;
+	}
+	FILE *sink = fopen("/dev/null", "wb");
+	if (mode == bench_y4m) {
+		const struct raw_timing timing = { .rate_numerator = 25, .rate_denominator = 1 };
+		const uint32_t components = images->format == jpeg_format_grey ? 1 : 3;
+		struct raw_writer writer;
+		raw_writer_init(&writer, fileno(sink), raw_format_y4m, images->width, images->height, components, &timing);
+		struct timespec start;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t index = 0; index < image_count; index++) {
+			const uint8_t *image = images->images[index % images->count];
+			for (uint32_t row = 0; row < images->height; row += slice_rows) {
+				const uint32_t count = images->height - row < slice_rows ? images->height - row : slice_rows;
+				if (!raw_writer_add_rows(&writer, image, row, count)) {
+					fatal_error("Failed to write");
+				}
+			}
+			result->bytes += (size_t) images->width * images->height * components;
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		result->seconds = bench_elapsed(&start, &end);
+		result->images = image_count;
+		raw_writer_destroy(&writer);
+		fclose(sink);
+		return;
+	}
+	struct jpeg_encoder *encoder = jpeg_encoder_create(images->width, images->height, images->format, quality);
+	if (!encoder) {
+		fatal_error("Failed to create JPEG encoder");
+	}
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (size_t index = 0; index < image_count; index++) {
+		const uint8_t *image = images->images[index % images->count];
+		if (mode == bench_per_image) {
+			if (!bench_encode_per_image(images, image, 0, sink)) {
+				fatal_error("Failed to encode");
+			}
+			continue;
+		}
+		const uint8_t *data;
+		size_t length;
+		if (!jpeg_encoder_begin(encoder) || !jpeg_encoder_write(encoder, image, images->height) || !jpeg_encoder_end(encoder, &data, &length)) {
+			fatal_error("Failed to encode");
+		}
+		fwrite(data, 1, length, sink);
+		result->bytes += length;
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	result->seconds = bench_elapsed(&start, &end);
+	result->images = image_count;
+	jpeg_encoder_destroy(encoder);
+	fclose(sink);
+}
+
+/* Images that differ between the two ways of encoding */
+static size_t bench_check(const struct bench_images *images)
+{
+	struct jpeg_encoder *encoder = jpeg_encoder_create(images->width, images->height, images->format, quality);
+	if (!encoder) {
+		fatal_error("Failed to create JPEG encoder");
+	}
+	size_t mismatches = 0;
+	/* Twice over, so that later images come from a reused encoder */
+	for (size_t index = 0; index < 2 * images->count; index++) {
+		const uint8_t *image = images->images[index % images->count];
+		char *expected;
+		size_t expected_length;
+		FILE *sink = open_memstream(&expected, &expected_length);
+		bench_encode_per_image(images, image, 0, sink);
+		fclose(sink);
+		const uint8_t *data;
+		size_t length;
+		bool encoded = jpeg_encoder_begin(encoder) && jpeg_encoder_write(encoder, image, images->height) && jpeg_encoder_end(encoder, &data, &length);
+		mismatches += !encoded || length != expected_length || memcmp(data, expected, length) != 0;
+		free(expected);
+	}
+	jpeg_encoder_destroy(encoder);
+	return mismatches;
+}
+
+static void bench_standard(const struct video_standard *standard, bool colour, size_t image_count, unsigned repeat)
+{
+	struct bench_images images;
+	bench_decode(standard, colour, &images);
+	if (!images.count) {
+		fatal_error("No images decoded");
+	}
+	/* What libjpeg makes of each image whole, with a restart marker between strips for the pools that make them */
+	struct bench_expected expected[bench_modes];
+	for (int mode = 0; mode < bench_modes; mode++) {
+		for (size_t index = 0; bench_pool_threads[mode] && index < images.count; index++) {
+			FILE *sink = open_memstream((char **) &expected[mode].jpegs[index], &expected[mode].lengths[index]);
+			if (!bench_encode_per_image(&images, images.images[index], bench_restart_interval(&images, bench_pool_strips[mode]), sink)) {
+				fatal_error("Failed to encode");
+			}
+			fclose(sink);
+		}
+	}
+	struct bench_result results[bench_modes];
+	memset(results, 0, sizeof(results));
+	for (unsigned iteration = 0; iteration < repeat; iteration++) {
+		for (int mode = 0; mode < bench_modes; mode++) {
+			struct bench_result run = { 0 };
+			bench_run(mode, &images, expected, image_count, &run);
+			if (iteration == 0 || run.seconds < results[mode].seconds) {
+				results[mode] = run;
+			}
+		}
+	}
+	printf("%s, %ux%u %s:\n", standard->description, images.width, images.height, colour ? "colour" : "grey");
+	for (int mode = 0; mode < bench_modes; mode++) {
+		const struct bench_result *result = &results[mode];
+		printf(
+			"  %-26s %7.3f ms/image  %7.1f images/s  %+6.1f%%\n",
+			bench_mode_names[mode],
+			1e3 * result->seconds / result->images,
+			result->images / result->seconds,
+			100 * (result->seconds / results[bench_per_image].seconds - 1)
+		);
+	}
+	for (int mode = 0; mode < bench_modes; mode++) {
+		if (bench_pool_threads[mode]) {
+			printf("  %-26s %7.3f ms from an image's last rows to its JPEG\n", bench_mode_names[mode], 1e3 * results[mode].latency_seconds);
+		}
+	}
+	printf("  %lu bytes/image, %zu of %zu images differ between the first two\n", results[bench_persistent].bytes / image_count, bench_check(&images), 2 * images.count);
+	for (int mode = 0; mode < bench_modes; mode++) {
+		if (bench_pool_threads[mode] && results[mode].out_of_order) {
+			printf("  %s: %lu JPEGs out of order or wrong\n", bench_mode_names[mode], results[mode].out_of_order);
+		}
+	}
+	for (size_t index = 0; index < images.count; index++) {
+		free(images.images[index]);
+		for (int mode = 0; mode < bench_modes; mode++) {
+			if (bench_pool_threads[mode]) {
+				free(expected[mode].jpegs[index]);
+			}
+		}
+	}
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 3) {
+		fprintf(stderr, "Usage: %s [image-count] [repeat]\n", argv[0]);
+		return 1;
+	}
+	size_t image_count = argc > 1 ? atoi(argv[1]) : default_image_count;
+	unsigned repeat = argc > 2 ? atoi(argv[2]) : default_repeat;
+	bench_standard(&video_standard_pal_bg, false, image_count, repeat);
+	bench_standard(&video_standard_pal_bg, true, image_count, repeat);
+	return 0;
+}
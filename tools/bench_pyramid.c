@@ -0,0 +1,195 @@
+#include "stdinc.h"
+#include "errors.h"
+#include "decoder.h"
+#include "video_standard.h"
+#include "common/synthetic_signal.h"
+#include "common/bench.h"
+
+/*
+ * Cost of making half and quarter size images alongside the full one, in
+ * one decoding pass, against a second decoder making a small image on its
+ * own, and whether the smaller images are exact averages of the full one.
+ */
+
+enum {
+	default_chunk_count = 100,
+	default_repeat = 3,
+	slice_rows = 16,
+};
+
+enum bench_mode
+{
+	bench_full,
+	bench_pyramid,
+	bench_second_decoder,
+	bench_modes,
+};
+
+static const char *const bench_mode_names[] = {
+	[bench_full] = "full only",
+	[bench_pyramid] = "full + 1/2 + 1/4",
+	[bench_second_decoder] = "full, then 1/4 again",
+};
+
+struct bench_result
+{
+	double seconds;
+	double signal_seconds;
+	uint64_t images;
+	/* Bytes of the smaller images that differ from averages of the full one */
+	uint64_t mismatches;
+};
+
+/* Compare an image with the one above it, halved the slow way */
+static uint64_t check_half(const uint8_t *source, uint32_t source_width, uint32_t source_height, const uint8_t *image, uint32_t width, uint32_t height, uint32_t components)
+{
+	uint64_t mismatches = 0;
+	for (uint32_t row = 0; row < height; row++) {
+		const uint32_t rows[2] = { 2 * row, 2 * row + 1 < source_height ? 2 * row + 1 : 2 * row };
+		for (uint32_t column = 0; column < width; column++) {
+			const uint32_t columns[2] = { 2 * column, 2 * column + 1 < source_width ? 2 * column + 1 : 2 * column };
+			for (uint32_t component = 0; component < components; component++) {
+				uint32_t sum = 2;
+				for (int y = 0; y < 2; y++) {
+					for (int x = 0; x < 2; x++) {
+						sum += source[(rows[y] * source_width + columns[x]) * components + component];
+					}
+				}
+				mismatches += image[(row * width + column) * components + component] != sum >> 2;
+			}
+		}
+	}
+	return mismatches;
+}
+
+static void check_pyramid(const struct decoder *decoder, struct bench_result *result)
+{
+	const uint8_t *source = decoder->image;
+	uint32_t width = decoder->row_bytes / decoder->image_components;
+	uint32_t height = decoder->image_height;
+	for (uint32_t index = 0; index < decoder->config.pyramid_levels; index++) {
+		const struct decoder_pyramid_level *level = &decoder->pyramid[index];
+		result->mismatches += check_half(source, width, height, level->image, level->width, level->height, decoder->image_components);
+		source = level->image;
+		width = level->width;
+		height = level->height;
+	}
+}
+
+/* Decode a copy of the signal with each decoder in turn, timing only the decoders */
+static void bench_run(const struct decoder_config *configs, size_t decoder_count, const struct buffer *signal, bool check, struct bench_result *result)
+{
+	struct decoder decoders[2];
+	struct buffer inputs[2];
+	for (size_t index = 0; index < decoder_count; index++) {
+		decoder_init(&decoders[index], &configs[index]);
+		buffer_init(&inputs[index]);
+	}
+	for (const struct buffer_chunk *source = signal->tail; source; source = source->next) {
+		for (size_t index = 0; index < decoder_count; index++) {
+			bench_copy_chunk(&inputs[index], source);
+		}
+		struct timespec start;
+		struct timespec end;
+		clock_gettime(CLOCK_MONOTONIC, &start);
+		for (size_t index = 0; index < decoder_count; index++) {
+			decoder_bind_and_steal(&decoders[index], &inputs[index]);
+			while (decoder_read_frame(&decoders[index])) {
+				if (index == 0) {
+					result->images++;
+				}
+				if (check) {
+					check_pyramid(&decoders[index], result);
+				}
+			}
+		}
+		clock_gettime(CLOCK_MONOTONIC, &end);
+		result->seconds += bench_elapsed(&start, &end);
+		result->signal_seconds += source->length * (configs[0].sample_period_ps * 1e-12);
+	}
+	for (size_t index = 0; index < decoder_count; index++) {
+		buffer_destroy(&inputs[index]);
+		decoder_destroy(&decoders[index]);
+	}
+}
+
+static void bench_standard(const struct video_standard *standard, bool colour, size_t chunk_count, unsigned repeat)
+{
+	/* Colour at 4x the subcarrier, grey at the scope's usual rate */
+	const uint64_t sample_rate_hz = colour ? 4 * standard->timing.colour_subcarrier_millihertz / 1000 : 9600000;
+	const struct synthetic_signal_config signal_config = {
+		.sample_period_ps = 1000000000000ull / sample_rate_hz,
+		.black_level = 300,
+		.white_level = 1000,
+		.edge_ns = 150,
+		.noise_mv = 20,
+		.colour = colour,
+	};
+	const size_t chunk_samples = sample_rate_hz / 200;
+	struct synthetic_signal generator;
+	struct buffer signal;
+	buffer_init(&signal);
+	synthetic_signal_init(&generator, &signal_config, standard);
+	synthetic_signal_generate(&generator, &signal, chunk_count, chunk_samples);
+	synthetic_signal_destroy(&generator);
+	struct decoder_config config = {
+		.sample_period_ps = signal_config.sample_period_ps,
+		.sync_threshold = colour ? 100 : 200,
+		.black_level = signal_config.black_level,
+		.white_level = signal_config.white_level,
+		.max_backlog_samples = chunk_count * chunk_samples,
+		.specialise = true,
+		.flywheel = true,
+		.render_threads = 1,
+		.slice_rows = slice_rows,
+		.colour = colour,
+	};
+	decoder_config_set_standard(&config, standard);
+	struct decoder_config configs[bench_modes][2];
+	for (int mode = 0; mode < bench_modes; mode++) {
+		configs[mode][0] = config;
+		configs[mode][1] = config;
+	}
+	configs[bench_pyramid][0].pyramid_levels = decoder_max_pyramid_levels;
+	configs[bench_second_decoder][1].horizontal_decimation = 4;
+	configs[bench_second_decoder][1].vertical_decimation = 4;
+	struct bench_result results[bench_modes];
+	memset(results, 0, sizeof(results));
+	for (unsigned iteration = 0; iteration < repeat; iteration++) {
+		for (int mode = 0; mode < bench_modes; mode++) {
+			struct bench_result run = { 0 };
+			bench_run(configs[mode], mode == bench_second_decoder ? 2 : 1, &signal, false, &run);
+			if (iteration == 0 || run.seconds < results[mode].seconds) {
+				results[mode] = run;
+			}
+		}
+	}
+	struct bench_result checked = { 0 };
+	bench_run(configs[bench_pyramid], 1, &signal, true, &checked);
+	printf("%s, %s:\n", standard->description, colour ? "colour" : "grey");
+	for (int mode = 0; mode < bench_modes; mode++) {
+		const struct bench_result *result = &results[mode];
+		printf(
+			"  %-22s %7.1f images/s  %6.1fx real-time  %+6.1f%%\n",
+			bench_mode_names[mode],
+			result->images / result->seconds,
+			result->signal_seconds / result->seconds,
+			100 * (result->seconds / results[bench_full].seconds - 1)
+		);
+	}
+	printf("  smaller images: %lu bytes differ from averages of the full one\n", checked.mismatches);
+	buffer_destroy(&signal);
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc > 3) {
+		fprintf(stderr, "Usage: %s [chunk-count] [repeat]\n", argv[0]);
+		return 1;
+	}
+	size_t chunk_count = argc > 1 ? atoi(argv[1]) : default_chunk_count;
+	unsigned repeat = argc > 2 ? atoi(argv[2]) : default_repeat;
+	bench_standard(&video_standard_pal_bg, false, chunk_count, repeat);
+	bench_standard(&video_standard_pal_bg, true, chunk_count, repeat);
+	return 0;
+}
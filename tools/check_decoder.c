@@ -0,0 +1,382 @@
+#include "stdinc.h"
+#include "errors.h"
+#include "decoder.h"
+#include "video_standard.h"
+#include "common/synthetic_signal.h"
+#include "common/bench.h"
+#include "pulse_width.h"
+
+/*
+ * Checks of what the decoder promises its callers, mostly on a synthetic
+ * signal.  Prints each failure and exits non-zero if there were any.
+ */
+
+enum {
+	chunk_count = 100,
+	/* A gap in the chunk offsets, losing sync, every so many chunks */
+	gap_every_chunks = 11,
+	gap_samples = 12345,
+	slice_rows = 16,
+	/* Fine units either side of each tolerance boundary that pulse widths are swept over */
+	sweep_fine = 300,
+};
+
+/* Sample rates the pulse classifier is checked at, as multiples of the colour subcarrier where there is one */
+static const unsigned classifier_oversampling[] = { 3, 4, 6 };
+
+/* Sizes of the pieces that the signal is pushed in, against reading it a chunk at a time */
+static const size_t push_samples[] = { 48000, decoder_push_chunk_samples, 1000, 1 };
+
+static const char *const output_names[] = {
+	[decoder_output_frame] = "frame",
+	[decoder_output_weave] = "weave",
+	[decoder_output_bob] = "bob",
+	[decoder_output_field] = "field",
+	[decoder_output_single_field] = "single",
+};
+
+static unsigned failures;
+
+struct check_signal
+{
+	struct synthetic_signal_config config;
+	struct buffer buffer;
+	size_t chunk_samples;
+};
+
+/* Images a decoder made, by number and hash, whichever way they came */
+struct check_images
+{
+	size_t image_bytes;
+	uint64_t count;
+	uint64_t hash;
+};
+
+static void check_signal_init(struct check_signal *self, const struct video_standard *standard, bool colour)
+{
+	const uint64_t sample_rate_hz = colour ? 4 * standard->timing.colour_subcarrier_millihertz / 1000 : 9600000;
+	self->config = (struct synthetic_signal_config) {
+		.sample_period_ps = 1000000000000ull / sample_rate_hz,
+		.black_level = 300,
+		.white_level = 1000,
+		.edge_ns = 150,
+		.noise_mv = 20,
+		.missing_sync_every = 101,
+		.colour = colour,
+	};
+	self->chunk_samples = sample_rate_hz / 200;
+	struct synthetic_signal generator;
+	buffer_init(&self->buffer);
+	synthetic_signal_init(&generator, &self->config, standard);
+	synthetic_signal_generate(&generator, &self->buffer, chunk_count, self->chunk_samples);
+	synthetic_signal_destroy(&generator);
+}
+
+static void check_signal_destroy(struct check_signal *self)
+{
+	buffer_destroy(&self->buffer);
+}
+
+static void check_images_add(struct check_images *self, const uint8_t *image)
+{
+	for (size_t index = 0; index < self->image_bytes; index++) {
+		self->hash = (self->hash ^ image[index]) * 1099511628211ull;
+	}
+	self->count++;
+}
+
+static void check_images_field(void *context, const uint8_t *image, int field)
+{
+	(void) field;
+	check_images_add(context, image);
+}
+
+static void check_images_frame(void *context, const uint8_t *image)
+{
+	check_images_add(context, image);
+}
+
+static void check_config(struct decoder_config *config, const struct video_standard *standard, const struct check_signal *signal, enum decoder_output output)
+{
+	*config = (struct decoder_config) {
+		.sample_period_ps = signal->config.sample_period_ps,
+		.sync_threshold = signal->config.colour ? 100 : 200,
+		.black_level = signal->config.black_level,
+		.white_level = signal->config.white_level,
+		.max_backlog_samples = chunk_count * signal->chunk_samples,
+		.flywheel = true,
+		.render_threads = 1,
+		.output = output,
+		.colour = signal->config.colour,
+	};
+	decoder_config_set_standard(config, standard);
+}
+
+/*
+ * Rows handed out in slices are not written again before their image is
+ * complete, even when sync is lost part way through it: the consumer may be
+ * reading them in place.
+ */
+static void check_slices_unchanged(const struct video_standard *standard, const struct check_signal *signal, enum decoder_output output)
+{
+	struct decoder_config config;
+	check_config(&config, standard, signal, output);
+	config.slice_rows = slice_rows;
+	struct decoder decoder;
+	decoder_init(&decoder, &config);
+	const size_t row_bytes = decoder.row_bytes;
+	uint8_t *copy = malloc(row_bytes * decoder.image_height);
+	uint32_t rows = 0;
+	uint64_t images = 0;
+	uint64_t rows_changed = 0;
+	struct buffer input;
+	buffer_init(&input);
+	size_t index = 0;
+	for (const struct buffer_chunk *source = signal->buffer.tail; source; source = source->next, index++) {
+		bench_copy_chunk(&input, source)->offset += index / gap_every_chunks * gap_samples;
+		decoder_bind_and_steal(&decoder, &input);
+		struct decoder_slice slice;
+		while (decoder_read_slice(&decoder, &slice)) {
+			const uint8_t *image = slice.rows - slice.first_row * row_bytes;
+			if (slice.first_row != rows) {
+				printf("  %s: slice starts at row %u, not %u\n", output_names[output], slice.first_row, rows);
+				failures++;
+			}
+			for (uint32_t row = 0; row < rows; row++) {
+				rows_changed += memcmp(&image[row * row_bytes], &copy[row * row_bytes], row_bytes) != 0;
+			}
+			memcpy(&copy[slice.first_row * row_bytes], slice.rows, slice.row_count * row_bytes);
+			rows = slice.first_row + slice.row_count;
+			if (slice.last) {
+				rows = 0;
+				images++;
+			}
+		}
+	}
+	struct decoder_stats stats = { 0 };
+	decoder_reset_stats(&decoder, &stats);
+	printf("  %-8s %3lu images with a gap every %d chunks, %2lu losses of sync, %lu rows changed after they were handed out\n", output_names[output], images, gap_every_chunks, stats.acquisitions, rows_changed);
+	if (rows_changed || !images) {
+		failures++;
+	}
+	buffer_destroy(&input);
+	decoder_destroy(&decoder);
+	free(copy);
+}
+
+/*
+ * Pushing the signal in pieces of any size, with the backlog left to the
+ * decoder, makes the same images as binding it a chunk at a time and reading
+ * frames, and never overruns.
+ */
+static void check_push(const struct video_standard *standard, const struct check_signal *signal, enum decoder_output output)
+{
+	struct decoder_config config;
+	check_config(&config, standard, signal, output);
+	struct decoder decoder;
+	decoder_init(&decoder, &config);
+	struct check_images expected = { .image_bytes = decoder.row_bytes * decoder.image_height };
+	struct buffer input;
+	buffer_init(&input);
+	for (const struct buffer_chunk *source = signal->buffer.tail; source; source = source->next) {
+		bench_copy_chunk(&input, source);
+		decoder_bind_and_steal(&decoder, &input);
+		while (decoder_read_frame(&decoder)) {
+			check_images_add(&expected, decoder.image);
+		}
+	}
+	buffer_destroy(&input);
+	decoder_destroy(&decoder);
+	sample_t *samples = malloc(signal->buffer.samples * sizeof(*samples));
+	size_t count = 0;
+	for (const struct buffer_chunk *source = signal->buffer.tail; source; source = source->next) {
+		memcpy(&samples[count], source->data, source->length * sizeof(*samples));
+		count += source->length;
+	}
+	printf("  %-8s %3lu images read a chunk at a time, pushed in pieces of", output_names[output], expected.count);
+	for (size_t size = 0; size < sizeof(push_samples) / sizeof(push_samples[0]); size++) {
+		struct check_images pushed = { .image_bytes = expected.image_bytes };
+		config.max_backlog_samples = 0;
+		config.callbacks = (struct decoder_callbacks) {
+			.context = &pushed,
+			.field = check_images_field,
+			.frame = check_images_frame,
+		};
+		decoder_init(&decoder, &config);
+		for (size_t offset = 0; offset < count; offset += push_samples[size]) {
+			decoder_push(&decoder, &samples[offset], count - offset < push_samples[size] ? count - offset : push_samples[size]);
+		}
+		struct decoder_errors errors = { 0 };
+		decoder_reset_error_counters(&decoder, &errors);
+		decoder_destroy(&decoder);
+		const bool same = pushed.count == expected.count && pushed.hash == expected.hash && !errors.no_signal_or_overrun;
+		printf(" %zu: %s", push_samples[size], same ? "same" : "DIFFERENT");
+		if (!same) {
+			printf(" (%lu images, %lu overruns)", pushed.count, errors.no_signal_or_overrun);
+			failures++;
+		}
+	}
+	printf("\n");
+	if (!expected.count) {
+		failures++;
+	}
+	free(samples);
+}
+
+/* The code specialised for the standard and sample rate makes the same images as the generic code */
+static void check_specialised(const struct video_standard *standard, const struct check_signal *signal)
+{
+	struct check_images images[2] = { { 0 } };
+	const char *implementation = NULL;
+	for (int specialise = 0; specialise < 2; specialise++) {
+		struct decoder_config config;
+		check_config(&config, standard, signal, decoder_output_frame);
+		config.specialise = specialise;
+		struct decoder decoder;
+		decoder_init(&decoder, &config);
+		implementation = decoder_implementation(&decoder);
+		images[specialise].image_bytes = decoder.row_bytes * decoder.image_height;
+		struct buffer input;
+		buffer_init(&input);
+		for (const struct buffer_chunk *source = signal->buffer.tail; source; source = source->next) {
+			bench_copy_chunk(&input, source);
+			decoder_bind_and_steal(&decoder, &input);
+			while (decoder_read_frame(&decoder)) {
+				check_images_add(&images[specialise], decoder.image);
+			}
+		}
+		buffer_destroy(&input);
+		decoder_destroy(&decoder);
+	}
+	const bool same = images[0].count && images[0].count == images[1].count && images[0].hash == images[1].hash;
+	const bool specialised = strcmp(implementation, "generic") != 0;
+	printf("  %3lu images decoded by generic code, %s by %s\n", images[0].count, same ? "the same" : "DIFFERENT", specialised ? "specialised code" : "GENERIC CODE instead of specialised");
+	if (!same || !specialised) {
+		failures++;
+	}
+}
+
+/* How pulses were classified before the lookup table, in whole nanoseconds */
+static bool old_is_similar(uint32_t measurement, uint32_t reference, uint32_t tolerance)
+{
+	int32_t difference = measurement;
+	difference -= reference;
+	return (uint32_t) abs(difference) <= tolerance;
+}
+
+static char old_classify(const struct video_timing *timing, uint32_t sample_period_ps, uint64_t duration_fine, uint64_t low_fine)
+{
+	uint32_t duration_ns = (duration_fine * sample_period_ps / 1000) >> pulse_fraction_bits;
+	uint32_t high_ns = ((duration_fine - low_fine) * sample_period_ps / 1000) >> pulse_fraction_bits;
+	uint32_t low_ns = duration_ns - high_ns;
+	uint32_t tolerance_ns = timing->tolerance_ns;
+	if (old_is_similar(duration_ns, timing->line_duration_ns, tolerance_ns) && old_is_similar(low_ns, timing->horizontal_sync_low_ns, tolerance_ns)) {
+		return pulse_type_horizontal;
+	}
+	if (old_is_similar(duration_ns, timing->line_duration_ns, tolerance_ns) && old_is_similar(low_ns, timing->equaliser_low_ns, tolerance_ns)) {
+		return pulse_type_field;
+	}
+	if (old_is_similar(duration_ns, timing->sync_duration_ns, tolerance_ns) && old_is_similar(low_ns, timing->horizontal_sync_low_ns, tolerance_ns)) {
+		return pulse_type_field;
+	}
+	if (old_is_similar(duration_ns, timing->sync_duration_ns, tolerance_ns) && old_is_similar(low_ns, timing->vertical_sync_low_ns, tolerance_ns)) {
+		return pulse_type_vertical;
+	}
+	if (old_is_similar(duration_ns, timing->sync_duration_ns, tolerance_ns) && old_is_similar(low_ns, timing->equaliser_low_ns, tolerance_ns)) {
+		return pulse_type_equaliser;
+	}
+	return pulse_type_none;
+}
+
+/* Centres of the windows swept on one axis: each reference, and each edge of its tolerance */
+static size_t classifier_centres(uint64_t *centres, const uint32_t *references, size_t count, uint32_t tolerance_ns, uint32_t sample_period_ps)
+{
+	const uint64_t fine_per_ns_numerator = 1000 << pulse_fraction_bits;
+	size_t length = 0;
+	for (size_t index = 0; index < count; index++) {
+		centres[length++] = references[index] * fine_per_ns_numerator / sample_period_ps;
+		centres[length++] = (references[index] - tolerance_ns) * fine_per_ns_numerator / sample_period_ps;
+		centres[length++] = (references[index] + tolerance_ns + 1) * fine_per_ns_numerator / sample_period_ps;
+	}
+	return length;
+}
+
+/*
+ * The decoder's pulse classifier, and the bounds that specialised decoders
+ * compare with instead, agree with the comparisons they replaced for
+ * every pulse within sweep_fine of any reference or tolerance boundary, on
+ * both axes at once.
+ */
+static void check_pulse_classifier(const struct video_standard *standard, uint32_t sample_period_ps)
+{
+	struct decoder_config config = {
+		.sample_period_ps = sample_period_ps,
+		.max_backlog_samples = 1,
+	};
+	decoder_config_set_standard(&config, standard);
+	struct decoder decoder;
+	decoder_init(&decoder, &config);
+	const struct pulse_classifier *classifier = &decoder.pulse_classifier;
+	const struct video_timing *timing = &standard->timing;
+	const uint32_t durations[] = { timing->line_duration_ns, timing->sync_duration_ns };
+	const uint32_t lows[] = { timing->horizontal_sync_low_ns, timing->equaliser_low_ns, timing->vertical_sync_low_ns };
+	uint64_t duration_centres[3 * 2];
+	uint64_t low_centres[3 * 3];
+	const size_t duration_count = classifier_centres(duration_centres, durations, 2, timing->tolerance_ns, sample_period_ps);
+	const size_t low_count = classifier_centres(low_centres, lows, 3, timing->tolerance_ns, sample_period_ps);
+	uint64_t pulses = 0;
+	uint64_t mismatches = 0;
+	for (size_t duration_index = 0; duration_index < duration_count; duration_index++) {
+		for (size_t low_index = 0; low_index < low_count; low_index++) {
+			for (uint64_t duration = duration_centres[duration_index] - sweep_fine; duration <= duration_centres[duration_index] + sweep_fine; duration++) {
+				for (uint64_t low = low_centres[low_index] - sweep_fine; low <= low_centres[low_index] + sweep_fine; low++) {
+					char expected = old_classify(timing, sample_period_ps, duration, low);
+					char actual = pulse_classifier_classify(classifier, duration, low);
+					char bounded = pulse_classifier_match_fine(classifier->prototypes, classifier->prototype_count, sample_period_ps, duration, low);
+					if ((actual != expected || bounded != expected) && mismatches++ < 5) {
+						printf("  pulse of %lu / %lu fine: '%c' by table and '%c' by bounds, not '%c' as before\n", low, duration, actual ? actual : '-', bounded ? bounded : '-', expected ? expected : '-');
+					}
+					pulses++;
+				}
+			}
+		}
+	}
+	printf("  pulse classifier @ %.2fMHz: %lu of %lu pulses classified differently from before\n", 1e6 / sample_period_ps, mismatches, pulses);
+	if (mismatches) {
+		failures++;
+	}
+	decoder_destroy(&decoder);
+}
+
+int main(int argc, char *argv[])
+{
+	(void) argv;
+	if (argc > 1) {
+		fprintf(stderr, "Usage: %s\n", argv[0]);
+		return 1;
+	}
+	for (size_t index = 0; video_standard_get(index); index++) {
+		const struct video_standard *standard = video_standard_get(index);
+		printf("%s:\n", standard->description);
+		check_pulse_classifier(standard, 104166);
+		for (size_t rate = 0; standard->timing.colour_subcarrier_millihertz && rate < sizeof(classifier_oversampling) / sizeof(classifier_oversampling[0]); rate++) {
+			check_pulse_classifier(standard, 1000000000000000ull / (classifier_oversampling[rate] * standard->timing.colour_subcarrier_millihertz));
+		}
+	}
+	const struct video_standard *standard = &video_standard_pal_bg;
+	for (int colour = 0; colour < 2; colour++) {
+		struct check_signal signal;
+		check_signal_init(&signal, standard, colour);
+		printf("%s, %s:\n", standard->description, colour ? "colour" : "grey");
+		for (int output = 0; output < (int) (sizeof(output_names) / sizeof(output_names[0])); output++) {
+			check_slices_unchanged(standard, &signal, output);
+		}
+		for (int output = 0; output < (int) (sizeof(output_names) / sizeof(output_names[0])); output++) {
+			check_push(standard, &signal, output);
+		}
+		check_specialised(standard, &signal);
+		check_signal_destroy(&signal);
+	}
+	printf(failures ? "%u checks FAILED\n" : "All checks passed\n", failures);
+	return failures ? 1 : 0;
+}
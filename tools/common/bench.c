@@ -0,0 +1,14 @@
+#include "bench.h"
+
+double bench_elapsed(const struct timespec *start, const struct timespec *end)
+{
+	return (end->tv_sec - start->tv_sec) + (end->tv_nsec - start->tv_nsec) * 1e-9;
+}
+
+struct buffer_chunk *bench_copy_chunk(struct buffer *input, const struct buffer_chunk *source)
+{
+	struct buffer_chunk *chunk = buffer_append(input, source->length);
+	chunk->offset = source->offset;
+	memcpy(chunk->data, source->data, source->length * sizeof(source->data[0]));
+	return chunk;
+}
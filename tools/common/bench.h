@@ -0,0 +1,15 @@
+#pragma once
+#include "stdinc.h"
+#include "buffer.h"
+
+#include <time.h>
+
+/*
+ * Shared by the benchmarks.  Those comparing several modes run each in turn
+ * within every repeat, so that frequency scaling affects all alike, and keep
+ * the fastest run of each.
+ */
+
+double bench_elapsed(const struct timespec *start, const struct timespec *end);
+/* Append a copy of a chunk of the generated signal, for a decoder to steal */
+struct buffer_chunk *bench_copy_chunk(struct buffer *input, const struct buffer_chunk *source);
@@ -0,0 +1,235 @@
+/* Before errors.h, whose log() macro would otherwise clash */
+#include <math.h>
+
+#include "synthetic_signal.h"
+#include "errors.h"
+
+/* One sync pulse and whatever follows it up to the next */
+struct synthetic_signal_segment
+{
+	uint64_t start_ps;
+	uint64_t duration_ps;
+	uint64_t low_ps;
+	/* Picture line index within the frame, or -1 for vertical blanking */
+	int32_t line;
+};
+
+static void synthetic_signal_add(struct synthetic_signal *self, size_t *capacity, uint64_t duration_ns, uint64_t low_ns, int32_t line)
+{
+	if (self->segment_count == *capacity) {
+		*capacity = *capacity ? *capacity * 2 : 1024;
+		self->segments = realloc(self->segments, *capacity * sizeof(*self->segments));
+	}
+	self->segments[self->segment_count++] = (struct synthetic_signal_segment) {
+		.start_ps = self->frame_ps,
+		.duration_ps = duration_ns * 1000,
+		.low_ps = low_ns * 1000,
+		.line = line,
+	};
+	self->frame_ps += duration_ns * 1000;
+}
+
+/* Emit the runs of a vertical sync pattern at their longest */
+static uint32_t synthetic_signal_add_vertical_sync(struct synthetic_signal *self, size_t *capacity, const struct sync_pattern *pattern)
+{
+	const struct video_timing *timing = &self->timing;
+	uint32_t half_lines = 0;
+	for (size_t run = 0; run < sync_pattern_max_runs && pattern->runs[run].pulse; run++) {
+		for (uint32_t count = 0; count < pattern->runs[run].max; count++) {
+			switch (pattern->runs[run].pulse) {
+			case pulse_type_equaliser:
+				synthetic_signal_add(self, capacity, timing->sync_duration_ns, timing->equaliser_low_ns, -1);
+				half_lines += 1;
+				break;
+			case pulse_type_vertical:
+				synthetic_signal_add(self, capacity, timing->sync_duration_ns, timing->vertical_sync_low_ns, -1);
+				half_lines += 1;
+				break;
+			case pulse_type_field:
+				synthetic_signal_add(self, capacity, timing->line_duration_ns, timing->equaliser_low_ns, -1);
+				half_lines += 2;
+				break;
+			default:
+				fatal_error("Cannot synthesise pulse type '%c'", pattern->runs[run].pulse);
+			}
+		}
+	}
+	return half_lines;
+}
+
+static const struct sync_pattern *synthetic_signal_find_pattern(const struct video_standard *standard, int type)
+{
+	for (size_t index = 0; index < standard->sync_pattern_count; index++) {
+		if (standard->sync_patterns[index].type == type) {
+			return &standard->sync_patterns[index];
+		}
+	}
+	fatal_error("Standard %s has no sync pattern of type %d", standard->name, type);
+}
+
+static double synthetic_signal_ramp(double position)
+{
+	return position < 0 ? 0 : position > 1 ? 1 : position;
+}
+
+/* Active part of a line, after the sync and back porch, as the decoder renders it */
+static void synthetic_signal_active(const struct synthetic_signal *self, const struct synthetic_signal_segment *segment, uint64_t *begin_ps, uint64_t *end_ps)
+{
+	const struct video_timing *timing = &self->timing;
+	*begin_ps = ((uint64_t) timing->horizontal_sync_low_ns + timing->back_porch_ns) * 1000;
+	*end_ps = segment->duration_ps - (uint64_t) timing->front_porch_ns * 1000;
+}
+
+static double synthetic_signal_picture(const struct synthetic_signal *self, const struct synthetic_signal_segment *segment, uint64_t into_ps)
+{
+	uint64_t begin_ps;
+	uint64_t end_ps;
+	synthetic_signal_active(self, segment, &begin_ps, &end_ps);
+	if (segment->line < 0 || into_ps <= begin_ps || into_ps >= end_ps) {
+		return self->config.black_level;
+	}
+	/* 16 columns across the active line, alternating every 32 lines */
+	double column = (double) (into_ps - begin_ps) / (end_ps - begin_ps) * 16;
+	bool white = ((int) column + segment->line / 32) % 2;
+	if (self->config.colour) {
+		/* Mid greys, leaving room for the chroma either side */
+		return self->config.black_level + (white ? 0.7 : 0.3) * (self->config.white_level - self->config.black_level);
+	}
+	return white ? self->config.white_level : self->config.black_level;
+}
+
+/*
+ * PAL chroma of a picture line at (time_ps): U and V of 0.15 of the luma range
+ * at a hue for each column, and the burst, whose V component follows the
+ * line's V-switch as the picture's does.
+ */
+static double synthetic_signal_chroma(const struct synthetic_signal *self, const struct synthetic_signal_segment *segment, uint64_t into_ps, uint64_t time_ps)
+{
+	const struct video_timing *timing = &self->timing;
+	const double range = self->config.white_level - self->config.black_level;
+	const uint64_t burst_ps = (uint64_t) timing->colour_burst_start_ns * 1000;
+	uint64_t begin_ps;
+	uint64_t end_ps;
+	synthetic_signal_active(self, segment, &begin_ps, &end_ps);
+	if (segment->line < 0) {
+		return 0;
+	}
+	/* Whole cycles are dropped before converting, to keep the phase exact over long runs */
+	const uint64_t femto = 1000000000000000ull;
+	double cycle = (double) ((unsigned __int128) time_ps * timing->colour_subcarrier_millihertz % femto) / femto;
+	double subcarrier_sin = sin(2 * M_PI * cycle);
+	double subcarrier_cos = cos(2 * M_PI * cycle);
+	double v_switch = (segment->line / (timing->interlaced ? 2 : 1)) % 2 ? -1 : 1;
+	if (into_ps >= burst_ps && into_ps < burst_ps + timing->colour_burst_ns * 1000ull) {
+		return 3.0 / 14 * range * M_SQRT1_2 * (v_switch * subcarrier_cos - subcarrier_sin);
+	}
+	if (into_ps <= begin_ps || into_ps >= end_ps) {
+		return 0;
+	}
+	double hue = 2 * M_PI * floor((double) (into_ps - begin_ps) / (end_ps - begin_ps) * 16) / 16;
+	double u = 0.15 * range * cos(hue);
+	double v = 0.15 * range * sin(hue);
+	return u * subcarrier_sin + v_switch * v * subcarrier_cos;
+}
+
+static double synthetic_signal_level(const struct synthetic_signal *self, uint64_t time_ps)
+{
+	uint64_t frame_time_ps = time_ps % self->frame_ps;
+	size_t low = 0;
+	size_t high = self->segment_count;
+	while (high - low > 1) {
+		size_t middle = (low + high) / 2;
+		if (self->segments[middle].start_ps <= frame_time_ps) {
+			low = middle;
+		} else {
+			high = middle;
+		}
+	}
+	const struct synthetic_signal_segment *segment = &self->segments[low];
+	const double edge_ps = self->config.edge_ns * 1000.0;
+	uint64_t into_ps = frame_time_ps - segment->start_ps;
+	double level = synthetic_signal_picture(self, segment, into_ps);
+	if (self->config.colour) {
+		level += synthetic_signal_chroma(self, segment, into_ps, time_ps);
+	}
+	if (segment->low_ps) {
+		double fall = synthetic_signal_ramp(into_ps / edge_ps + 0.5);
+		double rise = synthetic_signal_ramp(((double) into_ps - segment->low_ps) / edge_ps + 0.5);
+		level *= 1 - fall + rise;
+	}
+	/* Start falling into the next pulse half an edge early */
+	double next = ((double) into_ps - segment->duration_ps) / edge_ps + 0.5;
+	if (next > 0) {
+		level *= 1 - synthetic_signal_ramp(next);
+	}
+	return level;
+}
+
+static double synthetic_signal_noise(struct synthetic_signal *self)
+{
+	self->random = self->random * 6364136223846793005ull + 1442695040888963407ull;
+	return ((double) (self->random >> 11) / (1ull << 53) - 0.5) * self->config.noise_mv;
+}
+
+/******************************************************************************/
+
+void synthetic_signal_init(struct synthetic_signal *self, const struct synthetic_signal_config *config, const struct video_standard *standard)
+{
+	self->config = *config;
+	self->timing = standard->timing;
+	self->segments = NULL;
+	self->segment_count = 0;
+	self->frame_ps = 0;
+	self->random = 1;
+	size_t capacity = 0;
+	const int fields = self->timing.interlaced ? 2 : 1;
+	const struct sync_pattern *patterns[2] = {
+		synthetic_signal_find_pattern(standard, pattern_type_next_frame),
+		synthetic_signal_find_pattern(standard, pattern_type_next_field),
+	};
+	/* Dry run of the vertical syncs to find how many lines are left for picture */
+	uint32_t half_lines = 0;
+	for (int field = 0; field < fields; field++) {
+		half_lines += synthetic_signal_add_vertical_sync(self, &capacity, patterns[field]);
+	}
+	self->segment_count = 0;
+	self->frame_ps = 0;
+	uint32_t lines_per_field = (self->timing.frame_height * 2 - half_lines + 1) / 2 / fields;
+	uint32_t sync_count = 0;
+	for (int field = 0; field < fields; field++) {
+		synthetic_signal_add_vertical_sync(self, &capacity, patterns[field]);
+		for (uint32_t line = 0; line < lines_per_field; line++) {
+			bool drop = config->missing_sync_every && ++sync_count % config->missing_sync_every == 0;
+			uint32_t low_ns = drop ? 0 : self->timing.horizontal_sync_low_ns;
+			synthetic_signal_add(self, &capacity, self->timing.line_duration_ns, low_ns, line * fields + field);
+		}
+	}
+}
+
+void synthetic_signal_fill(struct synthetic_signal *self, struct buffer_chunk *chunk)
+{
+	for (size_t index = 0; index < chunk->length; index++) {
+		double level = synthetic_signal_level(self, (chunk->offset + index) * self->config.sample_period_ps);
+		if (self->config.noise_mv) {
+			level += synthetic_signal_noise(self);
+		}
+		chunk->data[index] = lrint(level);
+	}
+}
+
+/* Appends consecutive chunks, continuing from the end of the buffer */
+void synthetic_signal_generate(struct synthetic_signal *self, struct buffer *out, size_t chunk_count, size_t chunk_samples)
+{
+	offset_t offset = out->head ? out->head->offset + out->head->length : 0;
+	for (size_t index = 0; index < chunk_count; index++) {
+		struct buffer_chunk *chunk = buffer_append(out, chunk_samples);
+		chunk->offset = offset;
+		synthetic_signal_fill(self, chunk);
+		offset += chunk_samples;
+	}
+}
+
+void synthetic_signal_destroy(struct synthetic_signal *self)
+{
+	free(self->segments);
+}
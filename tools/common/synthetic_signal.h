@@ -0,0 +1,42 @@
+#pragma once
+#include "stdinc.h"
+#include "buffer.h"
+#include "video_standard.h"
+
+/*
+ * Generates composite video for a given standard with finite edge slopes,
+ * optional noise and dropped horizontal syncs, for benchmarks and offline
+ * checks without a scope attached.  The picture is a checkerboard, so that
+ * rendering errors are easy to spot.  In colour it is a grey checkerboard
+ * under columns stepping around the hue circle, with PAL chroma and bursts.
+ */
+
+struct synthetic_signal_config
+{
+	uint64_t sample_period_ps;
+	sample_t black_level;
+	sample_t white_level;
+	uint32_t edge_ns;
+	uint32_t noise_mv;
+	/* Drop one horizontal sync every this many lines (0 = never) */
+	uint32_t missing_sync_every;
+	/* Add PAL chroma at the standard's colour subcarrier */
+	bool colour;
+};
+
+struct synthetic_signal_segment;
+
+struct synthetic_signal
+{
+	struct synthetic_signal_config config;
+	struct video_timing timing;
+	struct synthetic_signal_segment *segments;
+	size_t segment_count;
+	uint64_t frame_ps;
+	uint64_t random;
+};
+
+void synthetic_signal_init(struct synthetic_signal *self, const struct synthetic_signal_config *config, const struct video_standard *standard);
+void synthetic_signal_fill(struct synthetic_signal *self, struct buffer_chunk *chunk);
+void synthetic_signal_generate(struct synthetic_signal *self, struct buffer *out, size_t chunk_count, size_t chunk_samples);
+void synthetic_signal_destroy(struct synthetic_signal *self);
@@ -0,0 +1,361 @@
+/* Before errors.h, whose log() macro would otherwise clash */
+#include <math.h>
+
+#include "stdinc.h"
+#include "errors.h"
+#include "decoder.h"
+#include "edge_stream.h"
+#include "pulse_width.h"
+#include "common/synthetic_signal.h"
+#include "common/bench.h"
+
+#include <time.h>
+
+/* Standalone analysis / replay of edge streams recorded by the decoder (-e), and a check of recording and replay */
+
+enum {
+	/* Signal for the check: chunks of 5ms, with a gap in their offsets, losing sync, every so many */
+	check_chunk_count = 100,
+	check_gap_every_chunks = 11,
+	check_gap_samples = 12345,
+};
+
+/* Timing and sync patterns are taken from the PAL profile, as the capture program defaults to */
+static struct decoder_config decoder_config = {
+	.max_backlog_samples = 1,
+	.specialise = true,
+};
+
+struct replay_event
+{
+	bool reset;
+	struct pulse_info pulse_info;
+};
+
+static void usage(const char *name)
+{
+	fprintf(stderr, "Usage: %s dump|pulses|replay <edge-stream> [replay-count]\n", name);
+	fprintf(stderr, "       %s check\n", name);
+	exit(1);
+}
+
+static double fine_to_ns(const struct edge_stream_reader *reader, uint64_t fine)
+{
+	return (double) fine * reader->header.sample_period_ps / 1000 / (1 << pulse_fraction_bits);
+}
+
+static void dump(struct edge_stream_reader *reader)
+{
+	uint64_t offset;
+	uint64_t previous = 0;
+	bool state;
+	enum edge_stream_record record;
+	while ((record = edge_stream_reader_next(reader, &offset, &state)) != edge_stream_record_end) {
+		if (record == edge_stream_record_error) {
+			fatal_error("Truncated or corrupt edge stream");
+		} else if (record == edge_stream_record_reset) {
+			printf("reset @ sample %lu\n", offset);
+			previous = (offset - 1) << pulse_fraction_bits;
+		} else {
+			printf(
+				"%s @ %12.3f us (+%9.1f ns)\n",
+				state ? "rise" : "fall",
+				fine_to_ns(reader, offset) / 1000,
+				fine_to_ns(reader, offset - previous)
+			);
+			previous = offset;
+		}
+	}
+}
+
+/* Read the whole stream through a pulse analyser, as the decoder would */
+static struct replay_event *load_pulses(struct edge_stream_reader *reader, size_t *count)
+{
+	struct pulse_analyser pulse_analyser;
+	pulse_analyser_init(&pulse_analyser, 0, pulse_right_aligned);
+	size_t capacity = 4096;
+	size_t length = 0;
+	struct replay_event *events = malloc(capacity * sizeof(*events));
+	uint64_t offset;
+	bool state;
+	enum edge_stream_record record;
+	while ((record = edge_stream_reader_next(reader, &offset, &state)) != edge_stream_record_end) {
+		if (record == edge_stream_record_error) {
+			fatal_error("Truncated or corrupt edge stream");
+		}
+		if (length == capacity) {
+			capacity *= 2;
+			events = realloc(events, capacity * sizeof(*events));
+		}
+		struct replay_event *event = &events[length];
+		if (record == edge_stream_record_reset) {
+			pulse_analyser_reset(&pulse_analyser, offset);
+			event->reset = true;
+			length++;
+		} else if (pulse_analyser_transition(&pulse_analyser, offset, state, &event->pulse_info)) {
+			event->reset = false;
+			length++;
+		}
+	}
+	pulse_analyser_destroy(&pulse_analyser);
+	*count = length;
+	return events;
+}
+
+static void pulses(struct edge_stream_reader *reader)
+{
+	size_t count;
+	struct replay_event *events = load_pulses(reader, &count);
+	/* Run-length collapse pulses within 1% of each other */
+	double run_ns = 0;
+	double run_low_ns = 0;
+	size_t run_length = 0;
+	for (size_t index = 0; index <= count; index++) {
+		const struct replay_event *event = index < count ? &events[index] : NULL;
+		double pulse_ns = 0;
+		double low_ns = 0;
+		if (event && !event->reset) {
+			const struct pulse_info *info = &event->pulse_info;
+			pulse_ns = fine_to_ns(reader, info->end_fine - info->start_fine);
+			low_ns = fine_to_ns(reader, info->transition_fine - info->start_fine);
+			if (run_length && fabs(pulse_ns - run_ns) < run_ns / 100 && fabs(low_ns - run_low_ns) < run_ns / 100) {
+				run_length++;
+				continue;
+			}
+		}
+		if (run_length) {
+			printf("Pulse %6.2f / %6.2f us x%zu\n", run_low_ns / 1000, run_ns / 1000, run_length);
+		}
+		if (event && event->reset) {
+			printf("Reset\n");
+		}
+		run_ns = pulse_ns;
+		run_low_ns = low_ns;
+		run_length = event && !event->reset;
+	}
+	free(events);
+}
+
+static void replay(struct edge_stream_reader *reader, unsigned repeat)
+{
+	size_t count;
+	struct replay_event *events = load_pulses(reader, &count);
+	decoder_config.sample_period_ps = reader->header.sample_period_ps;
+	decoder_config.sync_threshold = reader->header.threshold;
+	decoder_config_set_standard(&decoder_config, &video_standard_pal_bg);
+	struct decoder decoder;
+	decoder_init(&decoder, &decoder_config);
+	uint64_t frames = 0;
+	struct timespec start;
+	struct timespec end;
+	clock_gettime(CLOCK_MONOTONIC, &start);
+	for (unsigned iteration = 0; iteration < repeat; iteration++) {
+		for (size_t index = 0; index < count; index++) {
+			const struct replay_event *event = &events[index];
+			if (event->reset) {
+				decoder_replay_desync(&decoder);
+			} else {
+				frames += decoder_replay_pulse(&decoder, &event->pulse_info);
+			}
+		}
+	}
+	clock_gettime(CLOCK_MONOTONIC, &end);
+	double elapsed = (end.tv_sec - start.tv_sec) + (end.tv_nsec - start.tv_nsec) * 1e-9;
+	struct decoder_errors errors = { 0 };
+	decoder_reset_error_counters(&decoder, &errors);
+	uint64_t duration = 0;
+	for (size_t index = count; index > 0; index--) {
+		if (!events[index - 1].reset) {
+			duration = events[index - 1].pulse_info.end;
+			break;
+		}
+	}
+	double signal_s = (double) duration * repeat * reader->header.sample_period_ps * 1e-12;
+	printf("Pulses: %zu x%u, frames: %lu\n", count, repeat, frames);
+	printf(
+		"Errors: no_signal_or_overrun = %lu, unrecognised_pulse_type = %lu, long_sync_pattern = %lu, unrecognised_sync_pattern = %lu\n",
+		errors.no_signal_or_overrun,
+		errors.unrecognised_pulse_type,
+		errors.long_sync_pattern,
+		errors.unrecognised_sync_pattern
+	);
+	printf(
+		"Replayed %.1fs of signal in %.3fs: %.1fM pulses/s, %.1fx real-time, equivalent to %.2fGS/s\n",
+		signal_s,
+		elapsed,
+		count * repeat / elapsed / 1e6,
+		signal_s / elapsed,
+		signal_s / elapsed * 1e12 / reader->header.sample_period_ps / 1e9
+	);
+	decoder_destroy(&decoder);
+	free(events);
+}
+
+/* Edges either side of resets, including just before a reset's sample and at sample zero, read back as written */
+static unsigned check_round_trip(void)
+{
+	static const struct {
+		bool reset;
+		uint64_t offset;
+		bool state;
+	} records[] = {
+		{ true, 1000, false },
+		{ false, (999 << pulse_fraction_bits) + 1, true },
+		{ false, 1000 << pulse_fraction_bits, false },
+		{ false, (1000 << pulse_fraction_bits) + 1, true },
+		{ true, 0, false },
+		{ false, 1, false },
+		{ true, 5000, false },
+		{ false, (4999 << pulse_fraction_bits) + pulse_fraction_one / 2, false },
+		{ false, 123456789ull << pulse_fraction_bits, true },
+	};
+	const size_t count = sizeof(records) / sizeof(records[0]);
+	FILE *file = tmpfile();
+	struct edge_stream_writer *writer = malloc(sizeof(*writer));
+	edge_stream_writer_init(writer, file, 104166, -1234);
+	for (size_t index = 0; index < count; index++) {
+		if (records[index].reset) {
+			edge_stream_writer_reset(writer, records[index].offset);
+		} else {
+			edge_stream_writer_edge(writer, records[index].offset, records[index].state);
+		}
+	}
+	edge_stream_writer_destroy(writer);
+	free(writer);
+	rewind(file);
+	unsigned failures = 0;
+	struct edge_stream_reader reader;
+	if (!edge_stream_reader_init(&reader, file) || reader.header.sample_period_ps != 104166 || reader.header.threshold != -1234) {
+		printf("  header not read back as written\n");
+		failures++;
+	}
+	uint64_t offset;
+	bool state;
+	for (size_t index = 0; index < count; index++) {
+		enum edge_stream_record record = edge_stream_reader_next(&reader, &offset, &state);
+		enum edge_stream_record expected = records[index].reset ? edge_stream_record_reset : edge_stream_record_edge;
+		if (record != expected || offset != records[index].offset || (!records[index].reset && state != records[index].state)) {
+			printf("  record %zu read back wrong: %d @ %lu, not %d @ %lu\n", index, record, offset, expected, records[index].offset);
+			failures++;
+		}
+	}
+	if (edge_stream_reader_next(&reader, &offset, &state) != edge_stream_record_end) {
+		printf("  records after the last written\n");
+		failures++;
+	}
+	edge_stream_reader_destroy(&reader);
+	fclose(file);
+	printf("Round trip across resets: %s\n", failures ? "FAILED" : "passed");
+	return failures;
+}
+
+/*
+ * Record the edges of a synthetic signal that loses sync now and then, and
+ * replay them, which should make as many frames as decoding it did.
+ */
+static unsigned check_replay(void)
+{
+	const struct video_standard *standard = &video_standard_pal_bg;
+	const struct synthetic_signal_config signal_config = {
+		.sample_period_ps = 104166,
+		.black_level = 300,
+		.white_level = 1000,
+		.edge_ns = 150,
+		.noise_mv = 20,
+	};
+	const size_t chunk_samples = 1000000000000ull / signal_config.sample_period_ps / 200;
+	struct synthetic_signal generator;
+	struct buffer signal;
+	buffer_init(&signal);
+	synthetic_signal_init(&generator, &signal_config, standard);
+	synthetic_signal_generate(&generator, &signal, check_chunk_count, chunk_samples);
+	synthetic_signal_destroy(&generator);
+	struct decoder_config config = {
+		.sample_period_ps = signal_config.sample_period_ps,
+		.sync_threshold = 200,
+		.black_level = signal_config.black_level,
+		.white_level = signal_config.white_level,
+	};
+	decoder_config_set_standard(&config, standard);
+	FILE *file = tmpfile();
+	struct edge_stream_writer *writer = malloc(sizeof(*writer));
+	edge_stream_writer_init(writer, file, config.sample_period_ps, config.sync_threshold);
+	struct decoder decoder;
+	decoder_init(&decoder, &config);
+	decoder_record_edges(&decoder, writer);
+	uint64_t frames = 0;
+	struct buffer input;
+	buffer_init(&input);
+	size_t index = 0;
+	for (const struct buffer_chunk *source = signal.tail; source; source = source->next, index++) {
+		bench_copy_chunk(&input, source)->offset += index / check_gap_every_chunks * check_gap_samples;
+		decoder_bind_and_steal(&decoder, &input);
+		while (decoder_read_frame(&decoder)) {
+			frames++;
+		}
+	}
+	decoder_destroy(&decoder);
+	buffer_destroy(&input);
+	buffer_destroy(&signal);
+	edge_stream_writer_destroy(writer);
+	free(writer);
+	rewind(file);
+	struct edge_stream_reader reader;
+	if (!edge_stream_reader_init(&reader, file)) {
+		fatal_error("Recorded edge stream not readable");
+	}
+	size_t count;
+	struct replay_event *events = load_pulses(&reader, &count);
+	edge_stream_reader_destroy(&reader);
+	fclose(file);
+	decoder_config = config;
+	decoder_config.max_backlog_samples = 1;
+	decoder_init(&decoder, &decoder_config);
+	uint64_t replayed = 0;
+	uint64_t resets = 0;
+	for (size_t event = 0; event < count; event++) {
+		if (events[event].reset) {
+			decoder_replay_desync(&decoder);
+			resets++;
+		} else {
+			replayed += decoder_replay_pulse(&decoder, &events[event].pulse_info);
+		}
+	}
+	decoder_destroy(&decoder);
+	free(events);
+	const bool passed = resets > 1 && frames && replayed == frames;
+	printf("Replay across %lu resets: %lu frames decoded, %lu replayed: %s\n", resets, frames, replayed, passed ? "passed" : "FAILED");
+	return !passed;
+}
+
+int main(int argc, char *argv[])
+{
+	if (argc == 2 && strcmp(argv[1], "check") == 0) {
+		unsigned failures = check_round_trip() + check_replay();
+		return failures ? 1 : 0;
+	}
+	if (argc < 3) {
+		usage(argv[0]);
+	}
+	const char *command = argv[1];
+	FILE *source = fopen(argv[2], "rb");
+	if (!source) {
+		fatal_error("Failed to open %s", argv[2]);
+	}
+	struct edge_stream_reader reader;
+	if (!edge_stream_reader_init(&reader, source)) {
+		fatal_error("Not a supported edge stream: %s", argv[2]);
+	}
+	if (strcmp(command, "dump") == 0) {
+		dump(&reader);
+	} else if (strcmp(command, "pulses") == 0) {
+		pulses(&reader);
+	} else if (strcmp(command, "replay") == 0) {
+		replay(&reader, argc > 3 ? atoi(argv[3]) : 1);
+	} else {
+		usage(argv[0]);
+	}
+	edge_stream_reader_destroy(&reader);
+	fclose(source);
+	return 0;
+}
@@ -0,0 +1,44 @@
+#include "video_standard.h"
+
+static const struct video_standard *const video_standards[] = {
+	&video_standard_pal_bg,
+	&video_standard_ntsc_m,
+	&video_standard_pal_m,
+};
+
+const struct video_standard *video_standard_find(const char *name)
+{
+	for (size_t index = 0; index < sizeof(video_standards) / sizeof(video_standards[0]); index++) {
+		if (strcmp(video_standards[index]->name, name) == 0) {
+			return video_standards[index];
+		}
+	}
+	return NULL;
+}
+
+/* For iterating the known standards, NULL after the last */
+const struct video_standard *video_standard_get(size_t index)
+{
+	if (index >= sizeof(video_standards) / sizeof(video_standards[0])) {
+		return NULL;
+	}
+	return video_standards[index];
+}
+
+bool video_timing_equal(const struct video_timing *a, const struct video_timing *b)
+{
+	return a->frame_width == b->frame_width &&
+		a->frame_height == b->frame_height &&
+		a->interlaced == b->interlaced &&
+		a->sync_duration_ns == b->sync_duration_ns &&
+		a->line_duration_ns == b->line_duration_ns &&
+		a->equaliser_low_ns == b->equaliser_low_ns &&
+		a->vertical_sync_low_ns == b->vertical_sync_low_ns &&
+		a->horizontal_sync_low_ns == b->horizontal_sync_low_ns &&
+		a->front_porch_ns == b->front_porch_ns &&
+		a->back_porch_ns == b->back_porch_ns &&
+		a->tolerance_ns == b->tolerance_ns &&
+		a->colour_subcarrier_millihertz == b->colour_subcarrier_millihertz &&
+		a->colour_burst_start_ns == b->colour_burst_start_ns &&
+		a->colour_burst_ns == b->colour_burst_ns;
+}
@@ -0,0 +1,193 @@
+#pragma once
+#include "stdinc.h"
+#include "sync_pattern.h"
+
+enum pulse_type
+{
+	pulse_type_none = 0,
+	pulse_type_equaliser = 'e',
+	pulse_type_vertical = 'v',
+	pulse_type_horizontal = 'h',
+	pulse_type_field = 'f',
+};
+
+enum pattern_type
+{
+	pattern_type_none,
+	pattern_type_next_frame,
+	pattern_type_next_field,
+};
+
+/* Everything the per-pulse and per-line code depends on */
+struct video_timing
+{
+	uint32_t frame_width;
+	uint32_t frame_height;
+	bool interlaced;
+	uint32_t sync_duration_ns;
+	uint32_t line_duration_ns;
+	uint32_t equaliser_low_ns;
+	uint32_t vertical_sync_low_ns;
+	uint32_t horizontal_sync_low_ns;
+	uint32_t front_porch_ns;
+	uint32_t back_porch_ns;
+	uint32_t tolerance_ns;
+	/* Colour subcarrier, zero where colour is not decoded, and its burst after the sync's leading edge */
+	uint64_t colour_subcarrier_millihertz;
+	uint32_t colour_burst_start_ns;
+	uint32_t colour_burst_ns;
+};
+
+/* Lines that carry picture, leaving out the vertical blanking interval */
+struct video_active_area
+{
+	/* Horizontal sync lines of each field, after its vertical sync, before the picture */
+	uint32_t first_line;
+	/* Picture lines of the frame, as frame_height counts them */
+	uint32_t height;
+};
+
+struct video_standard
+{
+	const char *name;
+	const char *description;
+	struct video_timing timing;
+	struct video_active_area active_area;
+	const struct sync_pattern *sync_patterns;
+	size_t sync_pattern_count;
+};
+
+/*
+ * The profiles are static const so that every translation unit sees their
+ * values, letting the decoder instantiate specialised code for each with all
+ * timing folded into constants.
+ *
+ * Vertical sync sequences are matched against the non-horizontal pulses.  One
+ * lost pre-equaliser or broad pulse is tolerated; the final run is exact, as
+ * it is what tells the two sequences apart.
+ */
+
+static const struct sync_pattern video_sync_patterns_625[] = {
+	{
+		.type = pattern_type_next_frame,
+		.runs = {
+			{ pulse_type_equaliser, 4, 5 },
+			{ pulse_type_vertical, 4, 5 },
+			{ pulse_type_equaliser, 5, 5 },
+		},
+	},
+	{
+		.type = pattern_type_next_field,
+		.runs = {
+			{ pulse_type_equaliser, 4, 5 },
+			{ pulse_type_vertical, 4, 5 },
+			{ pulse_type_equaliser, 4, 4 },
+			{ pulse_type_field, 1, 1 },
+		},
+	},
+};
+
+static const struct sync_pattern video_sync_patterns_525[] = {
+	{
+		.type = pattern_type_next_frame,
+		.runs = {
+			{ pulse_type_equaliser, 5, 6 },
+			{ pulse_type_vertical, 5, 6 },
+			{ pulse_type_equaliser, 6, 6 },
+		},
+	},
+	{
+		.type = pattern_type_next_field,
+		.runs = {
+			{ pulse_type_equaliser, 5, 6 },
+			{ pulse_type_vertical, 5, 6 },
+			{ pulse_type_equaliser, 5, 5 },
+			{ pulse_type_field, 1, 1 },
+		},
+	},
+};
+
+/* With a lot of help from http://martin.hinner.info/vga/pal.html */
+static const struct video_standard video_standard_pal_bg = {
+	.name = "pal-bg",
+	.description = "PAL-B/G, 625 lines @ 25Hz",
+	.timing = {
+		.frame_width = 720,
+		.frame_height = 625,
+		.interlaced = true,
+		.sync_duration_ns = 32000,
+		.line_duration_ns = 64000,
+		.equaliser_low_ns = 2350,
+		.vertical_sync_low_ns = 32000 - 4700,
+		.horizontal_sync_low_ns = 4700,
+		.front_porch_ns = 1650,
+		.back_porch_ns = 5700,
+		.tolerance_ns = 250,
+		.colour_subcarrier_millihertz = 4433618750,
+		.colour_burst_start_ns = 5600,
+		.colour_burst_ns = 2250,
+	},
+	/* Lines 23-310 and 336-623 */
+	.active_area = {
+		.first_line = 17,
+		.height = 576,
+	},
+	.sync_patterns = video_sync_patterns_625,
+	.sync_pattern_count = sizeof(video_sync_patterns_625) / sizeof(video_sync_patterns_625[0]),
+};
+
+static const struct video_standard video_standard_ntsc_m = {
+	.name = "ntsc-m",
+	.description = "NTSC-M, 525 lines @ 29.97Hz",
+	.timing = {
+		.frame_width = 720,
+		.frame_height = 525,
+		.interlaced = true,
+		.sync_duration_ns = 31778,
+		.line_duration_ns = 63556,
+		.equaliser_low_ns = 2300,
+		.vertical_sync_low_ns = 31778 - 4700,
+		.horizontal_sync_low_ns = 4700,
+		.front_porch_ns = 1500,
+		.back_porch_ns = 4700,
+		.tolerance_ns = 250,
+	},
+	/* Lines 23-262 and 286-525, as digital video has them */
+	.active_area = {
+		.first_line = 13,
+		.height = 480,
+	},
+	.sync_patterns = video_sync_patterns_525,
+	.sync_pattern_count = sizeof(video_sync_patterns_525) / sizeof(video_sync_patterns_525[0]),
+};
+
+static const struct video_standard video_standard_pal_m = {
+	.name = "pal-m",
+	.description = "PAL-M, 525 lines @ 29.97Hz",
+	.timing = {
+		.frame_width = 720,
+		.frame_height = 525,
+		.interlaced = true,
+		.sync_duration_ns = 31778,
+		.line_duration_ns = 63556,
+		.equaliser_low_ns = 2300,
+		.vertical_sync_low_ns = 31778 - 4700,
+		.horizontal_sync_low_ns = 4700,
+		.front_porch_ns = 1900,
+		.back_porch_ns = 4300,
+		.tolerance_ns = 250,
+		.colour_subcarrier_millihertz = 3575611490,
+		.colour_burst_start_ns = 5800,
+		.colour_burst_ns = 2520,
+	},
+	.active_area = {
+		.first_line = 13,
+		.height = 480,
+	},
+	.sync_patterns = video_sync_patterns_525,
+	.sync_pattern_count = sizeof(video_sync_patterns_525) / sizeof(video_sync_patterns_525[0]),
+};
+
+const struct video_standard *video_standard_find(const char *name);
+const struct video_standard *video_standard_get(size_t index);
+bool video_timing_equal(const struct video_timing *a, const struct video_timing *b);